@@ -0,0 +1,843 @@
+/****************************************************************************
+ *   FILENAME: BasicBufferedFileWriter.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Boost file write performance by adding buffering.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       NOT a circular buffer:  accumulates bytes until either the buffer is full, which
+ *       triggers an automatic flush(), or until flush() is called.  Then the buffer contents
+ *       are written to media and the buffer is cleared.
+ *
+ *       In one context using Segger emFile with an SD card, FS_FWrite() has a great deal of 
+ *       overhead.  In one example, using a 4k buffer for file writes reduced time to write
+ *       10,000 lines from many minutes to under two seconds.  Using this class allows minimizing
+ *        the number of FS_FWrite() calls.
+ *
+ *       Counts the bytes written.
+ *       Current usage includes writing logfiles, and we track the number of bytes written
+ *       to the file to avoid the (roughly 100ms) very expensive file size check needed to
+ *       determine whether to roll-over to a new logfile (when a file size limit is exceeded).
+ *
+ *       The (same) logfiles are repeatedly closed (to flush to disk) and reopened in order to
+ *       avoid data loss by ensuring that:
+ *        - data is written to media, and
+ *        - the media directory is updated to record the existence of the new data.
+ *       The count of bytes written to a file must be reset when opening a new file and
+ *       NOT be reset when re-opening the same file after a close / re-open.  Thus resetting
+ *       the byte count is a separate operation from setting the file.
+ *
+ *       Storage is reached through the Backend policy class, so the same buffering logic runs
+ *       on the emFile target and on Linux build hosts.  A backend provides:
+ *           typedef ... Handle;                     // Open file, e.g. FS_FILE *, fd, FILE *
+ *           static Handle noFile(void);             // Handle value meaning "no file set"
+ *           static uint32_t write(Handle file, const char *data, size_t nChars);
+ *                                                   // Write all bytes; returns backend code
+ *       Backends:  EmFileBackend (FS_FWrite()), PosixFileBackend (write() on an fd),
+ *       StdioFileBackend (fwrite() on a FILE *), MemoryFileBackend (caller's array) and
+ *       NullFileBackend (discards data, counts bytes; measures buffering overhead alone).
+ *       Optional backend capabilities are listed in FileBackend.h.
+ *
+ *       writev() takes a record in pieces (e.g. header, message, trailer) without the caller
+ *       assembling it first.  Pieces that fit are copied into the buffer; a piece that does
+ *       not fit is written straight from the caller's memory, together with the buffered
+ *       bytes in one gathered write on backends that support it (SupportsGather).
+ *
+ *       vprintf() formats straight into the free tail of the write buffer, so a formatted
+ *       line is copied once (by vsnprintf()) rather than staged in a line buffer and copied
+ *       again.  A line that does not fit is formatted a second time after a flush(), which
+ *       costs one extra vsnprintf() call per buffer's worth of output.  The line buffer is
+ *       kept only as a spill area when LineSize exceeds BufSize; otherwise it shrinks to one
+ *       byte and lines are limited to BufSize - 1 characters.
+ *
+ *       Buffer sizes are template parameters so each instance can pick its own footprint and
+ *       flush granularity at compile time, e.g. large buffers for a high-rate trace log and
+ *       small ones for a rarely written audit log.  BufferedFileWriter (BufferedFileWriter.h)
+ *       is the 4096 / 2048 byte emFile instantiation used by existing code.
+ *
+ *       Flash media (SD cards) program in pages and erase in blocks; a write that ends part
+ *       way into a page makes the card's translation layer read-modify-write that page when
+ *       the next write continues it.  setFlushAlignment() makes every flush caused by a full
+ *       buffer end on a multiple of the alignment (e.g. the card's 4k or 16k write unit)
+ *       relative to the file offset, carrying the bytes past the last boundary forward in
+ *       the buffer (the file offset is counted in bytesFlushedTotal).  Large payloads are
+ *       written directly in whole multiples of the alignment.  Only flush() itself writes
+ *       an unaligned tail; the next full buffer realigns.
+ *
+ *       Growing a file one buffer at a time makes the file system allocate (and on FAT,
+ *       update the allocation table and directory entry) on nearly every flush.
+ *       setPreallocation() reserves space in larger chunks instead, from setFile() on and
+ *       again whenever the flushes have used it up (backends with SupportsReserve, see
+ *       FileBackend.h:  fallocate(2), FS_SetFileSize()).  The space past the data must be
+ *       released with trimPreallocation() before the file is closed; setFile() cannot do it,
+ *       because the previous handle may already be closed (close / re-open pattern).
+ *
+ *       Suggest using only static instances of this class in order to keep the (large)
+ *       data and line buffers off of the stack.
+ *
+ ****************************************************************************/
+
+#ifndef BASIC_BUFFERED_FILE_WRITER_H
+#define BASIC_BUFFERED_FILE_WRITER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "FileBackend.h"
+#include "NumberFormat.h"
+#include "TimestampFormat.h"
+#include "TypedFormat.h"
+
+#ifndef _ATTRIBUTE
+#define _ATTRIBUTE(attrs) __attribute__ (attrs)
+#endif
+
+template <size_t BufSize, size_t LineSize, class Backend>
+class BasicBufferedFileWriter
+{
+public:
+    enum WriteResult {
+        WriteNoFile = UINT32_MAX      // Unable to write because file pointer hasn't been set
+    };
+
+    // Write buffer size; made constant to allow static allocation.
+    static const size_t BufferSize = BufSize;
+    // Longest printf line when larger than BufferSize - 1; made constant to allow static allocation.
+    static const size_t LineBuffSize = LineSize;
+
+    BasicBufferedFileWriter(void);
+
+    virtual ~BasicBufferedFileWriter(void);
+
+    // Connect to ((re-)opened for write) file.  Clear buffer.
+    // Must NOT reset bytes written count (see file header), because code may close and
+    // re-open (append to) the same file in order to update the directory entry.
+    void setFile(typename Backend::Handle _file);
+
+    // Return number of bytes buffered.
+    size_t bufferCount(void);
+
+    // Return true if a write to the file came up short since setFile():  some data written
+    // since then is not in the file.
+    bool writeFailed(void);
+
+    // Return bytes written (including buffer) since initialization or last resetBytesWrittenTotal().
+    size_t getBytesWrittenTotal(void);
+
+    // Reset count of bytes written.  Alignment (setFlushAlignment()) is relative to the file
+    // offset at this call, which should be made with an empty buffer, e.g. for a new file.
+    void resetBytesWrittenTotal(void);
+
+    // Make each flush caused by a full buffer end on a multiple of alignment bytes (file
+    // offset); 0 or 1 turns alignment off.  alignment must divide BufferSize.
+    // Returns false, and turns alignment off, if it does not.
+    // Keep alignment at most BufferSize / 2:  reserve() and printf lines that do not fit
+    // beside the carried-over bytes fall back to an unaligned flush.
+    bool setFlushAlignment(size_t alignment);
+
+    // Reserve file space chunkSize bytes at a time ahead of the data, from the next setFile()
+    // on; 0 turns it off.  Returns false, and turns it off, on a backend without reserve.
+    bool setPreallocation(size_t chunkSize);
+
+    // Flush, then release the space reserved past the data.  Call before closing the file
+    // (or switching to another one).  Returns false if there was nothing to release or the
+    // backend failed.
+    bool trimPreallocation(void);
+
+    // Clear buffer.  
+    // Must NOT zero the total count of bytes written (see file header comments).
+    void clear(void);
+
+    // Flush disk buffer to disk.
+    // After the last write, call flush().
+    // Returns Backend::write() return code,
+    // or WriteNoFile if setFile() was never called, or was last called with Backend::noFile().
+    uint32_t flush(void);
+
+    // Write (binary) data to disk buffer with specified length.
+    // When the disk buffer is full, flush disk buffer to disk.
+    // Data of BufferSize bytes or more is written directly to the file after flushing the
+    // buffer, rather than being copied through the buffer.
+    // After the last write, user must call flush().
+    // If buffer is flushed, returns Backend::write() return code (number of bytes written),
+    // or WriteNoFile if setFile() was never called, or was last called with Backend::noFile()),
+    // 0 otherwise.
+    uint32_t write(const char *source,    // Source buffer of data to write to disk buffer / disk
+            size_t nChars);         // Count of bytes just written to buffer.
+
+    // Write (binary) data given as count segments, in order, to disk buffer.
+    // Segments that fit in the buffer are copied into it.  A segment that does not fit is
+    // written directly (no copy):  together with the buffered bytes as one gathered write if
+    // the backend supports it, otherwise after flushing the buffer if it is BufferSize bytes
+    // or more.  Smaller segments on other backends are copied, flushing when full.
+    // After the last write, user must call flush().
+    // Return code as for write().
+    uint32_t writev(const WriteSegment *segments, size_t count);
+
+    // Write string to disk buffer, length from strlen().  Writes 0 bytes for NULL string.
+    // When the disk buffer is full, flush disk buffer to disk.
+    // After the last write, user must call flush().
+    // If buffer is flushed, returns Backend::write() return code,
+    // If buffer is flushed, returns Backend::write() return code (number of bytes written),
+    // or WriteNoFile if setFile() was never called, or was last called with Backend::noFile()),
+    // 0 otherwise.
+    uint32_t writeStr(const char *string);
+
+    // Reserve nChars contiguous bytes at the end of the disk buffer, so a record can be
+    // formatted in place instead of being copied in by write().  Flushes first if fewer than
+    // nChars bytes remain.
+    // Returns pointer to the reserved bytes, or NULL if nChars > BufferSize or setFile() was
+    // never called, or was last called with Backend::noFile().
+    // Nothing is written until commit(); another reserve() abandons the reservation.
+    char *reserve(size_t nChars);
+
+    // Add the first used bytes of the last reserve() (used must not exceed the reserved
+    // size) to the disk buffer.  When the disk buffer is full, flush disk buffer to disk.
+    // Returns Backend::write() return code if buffer is flushed, 0 otherwise.
+    uint32_t commit(size_t used);
+
+    // vprintf formatting directly into disk buffer (no intermediate copy).
+    // When the line does not fit, flush disk buffer to disk and format it again.
+    // Lines are truncated to BufferSize - 1 or LineBuffSize characters, whichever is more.
+    // After the last write, user must call flush().
+    // Return code is number of bytes written,
+    // or WriteNoFile if setFile() was never called or was last called with Backend::noFile().
+    int vprintf(const char * fmt, va_list arglist)
+            _ATTRIBUTE ((__format__ (__printf__, 2, 0)));
+
+    // Typed printf-style formatting directly into disk buffer (see TypedFormat.h); no varargs.
+    // Use TYPED_PRINTF(writer, fmt, ...) to check fmt against the arguments at compile time.
+    // Lines are fitted and truncated as by vprintf().
+    // Return code as for vprintf().
+    template <class... Args>
+    int format(const char *fmt, const Args&... args);
+
+    // Append number as text, converted directly into the disk buffer (see NumberFormat.h).
+    // Decimal integer of any integral type.
+    // Return code as for write().
+    template <class T>
+    uint32_t appendDec(T value);
+
+    // Lower case hex, zero-padded to at least minDigits digits.  Return code as for write().
+    uint32_t appendHex(uint64_t value, size_t minDigits = 1);
+
+    // Scaled integer value / 10^decimals, e.g. appendFixed(1234, 3) appends "1.234".
+    // Return code as for write().
+    uint32_t appendFixed(int64_t value, unsigned decimals);
+
+    // Shortest text that reads back as the same double.  Return code as for write().
+    uint32_t appendDouble(double value);
+
+    // ISO-8601 UTC timestamp (see TimestampFormat.h), converted directly into the disk buffer.
+    // timestamp holds the cached date prefix.  Return code as for write().
+    uint32_t appendTimestamp(TimestampFormat &timestamp, int64_t seconds, uint32_t nanoseconds);
+
+    // hexdump -C style lines for nBytes of data, offset being the dump position of data[0]
+    // (see NumberFormat::formatHexDumpLine()).  Return code as for writev().
+    uint32_t appendHexDump(const void *data, size_t nBytes, uint64_t offset = 0);
+
+private:
+    // write() copies records up to this size with an inline loop rather than memcpy().
+    static const size_t SmallCopyMax = 8;
+
+    // Block copy-ctor, assignment operator.
+    BasicBufferedFileWriter(const BasicBufferedFileWriter &obj);
+    BasicBufferedFileWriter& operator=(const BasicBufferedFileWriter& obj);
+
+    // Write data straight to the file (file must be set).  Returns Backend::write() return code.
+    uint32_t writeThrough(const char *source, size_t nChars);
+
+    // With preallocation, reserve the next chunk(s) if nChars about to be written would use
+    // up the reserved space.
+    void reserveAhead(size_t nChars);
+
+    // Write buffered bytes and then data (file must be set):  with flush alignment, only up
+    // to the last alignment boundary, copying the rest into the buffer; see writeBufferAndData().
+    // Returns return code of the (last) backend write.
+    uint32_t writeAfterBuffer(const char *source, size_t nChars);
+
+    // Write buffered bytes and then data (file must be set), leaving the buffer empty:
+    // one gathered write if the backend supports it, otherwise flush() then writeThrough().
+    // Returns return code of the (last) backend write, or of the flush if that came up short.
+    uint32_t writeBufferAndData(const char *source, size_t nChars);
+
+    // Make room in the buffer (file must be set):  write the buffered bytes up to the last
+    // alignment boundary and move the rest to the front of the buffer; without alignment, or
+    // without a boundary in the buffer, flush().  Returns return code as for flush().
+    uint32_t flushAligned(void);
+
+    // Copy data into the buffer, flushing whenever it fills (file must be set).
+    // Returns flush() return code if flushed, 0 otherwise.
+    uint32_t copyToBuffer(const char *source, size_t nChars);
+
+    // Format one line into the buffer (file must be set) with formatter(dest, space), which
+    // has snprintf() semantics; see vprintf().  Returns number of bytes written.
+    template <class Formatter>
+    int printLine(const Formatter &formatter);
+
+    // Append the text converter(dest) writes (at most MaxChars bytes); see appendDec().
+    template <size_t MaxChars, class Converter>
+    uint32_t appendConverted(const Converter &converter);
+
+    // File data buffer, aligned for the backend (see FileBackend.h)
+    alignas(Backend::BufferAlignment) char buff[BufferSize];
+    // printf spill buffer for lines longer than buff; only needed if LineBuffSize is larger
+    char        lineBuff[(LineBuffSize >= BufferSize) ? (LineBuffSize + 1) : 1];
+    typename Backend::Handle file;
+    char *      writePtr;
+    const char * writeEndPtr;
+    // Bytes written total, including those still in the buffer and those flushed to the file,
+    // since initialization or the last resetBytesWrittenTotal() call.
+    size_t      bytesWrittenTotal;
+    // Bytes passed to the backend since the last resetBytesWrittenTotal():  the file offset
+    // of the first buffered byte.
+    size_t      bytesFlushedTotal;
+    // Flushes of a full buffer end on multiples of this; 0 = off
+    size_t      flushAlignment;
+    // File space is reserved this many bytes at a time; 0 = off
+    size_t      preallocationChunk;
+    // Reserved bytes past the file position
+    size_t      reservedLeft;
+    // A write came up short since setFile()
+    bool        failed;
+};
+
+
+template <size_t BufSize, size_t LineSize, class Backend>
+BasicBufferedFileWriter<BufSize, LineSize, Backend>::BasicBufferedFileWriter(void)
+{
+    bytesWrittenTotal = 0;
+    bytesFlushedTotal = 0;
+    flushAlignment = 0;
+    preallocationChunk = 0;
+    reservedLeft = 0;
+    failed = false;
+    file = Backend::noFile();
+    writeEndPtr = buff + sizeof(buff);
+    clear();
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+BasicBufferedFileWriter<BufSize, LineSize, Backend>::~BasicBufferedFileWriter(void)
+{
+    if (Backend::noFile() != file) {
+        flush();
+        file = Backend::noFile();
+    }
+}
+
+// Connect to (opened for write) file.  Clear buffer.  
+// Must NOT reset bytes written count (see file header), because code may close and
+// re-open (append to) the same file in order to force an update of the directory entry.
+template <size_t BufSize, size_t LineSize, class Backend>
+void BasicBufferedFileWriter<BufSize, LineSize, Backend>::setFile(typename Backend::Handle _file)
+{
+    file = _file;
+    clear();
+    reservedLeft = 0;
+    failed = false;
+    if (Backend::noFile() != file) {
+        reserveAhead(0);
+    }
+}
+
+// Return number of bytes in the buffer.
+template <size_t BufSize, size_t LineSize, class Backend>
+size_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::bufferCount(void)
+{
+    return (size_t)(writePtr - buff);
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+bool BasicBufferedFileWriter<BufSize, LineSize, Backend>::writeFailed(void)
+{
+    return failed;
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+void BasicBufferedFileWriter<BufSize, LineSize, Backend>::resetBytesWrittenTotal(void)
+{
+    bytesWrittenTotal = 0;
+    bytesFlushedTotal = 0;
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+bool BasicBufferedFileWriter<BufSize, LineSize, Backend>::setFlushAlignment(size_t alignment)
+{
+    bool retval = (alignment <= BufferSize) && ((0 == alignment) || (0 == BufferSize % alignment));
+    flushAlignment = (retval && (alignment > 1)) ? alignment : 0;
+    return retval;
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+bool BasicBufferedFileWriter<BufSize, LineSize, Backend>::setPreallocation(size_t chunkSize)
+{
+    preallocationChunk = Backend::SupportsReserve ? chunkSize : 0;
+    return Backend::SupportsReserve || (0 == chunkSize);
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+bool BasicBufferedFileWriter<BufSize, LineSize, Backend>::trimPreallocation(void)
+{
+    bool retval = false;
+    if ((Backend::noFile() != file) && (0 != reservedLeft)) {
+        flush();
+        retval = BackendReserve<Backend>::trim(file);
+        reservedLeft = 0;
+    }
+    return retval;
+}
+
+// Return total bytes written (including bytes still residing in buffer, not yet flushed
+// to file) since initialization or last clear().
+template <size_t BufSize, size_t LineSize, class Backend>
+size_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::getBytesWrittenTotal(void)
+{
+    return bytesWrittenTotal;
+}
+
+// Clear buffer before first use, or to reinitialize.
+// Must NOT zero the total count of bytes written (see file header comments).
+// May be called repeatedly.
+template <size_t BufSize, size_t LineSize, class Backend>
+void BasicBufferedFileWriter<BufSize, LineSize, Backend>::clear(void)
+{
+    writePtr = buff;
+}
+
+// Flush write buffer to disk.
+// After the last write, call flush().
+// Returns Backend::write() return code, or WriteFail if setFile() was not called with a file.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::flush(void)
+{
+    uint32_t retval = 0;
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else if (writePtr > buff) {
+        retval = writeThrough(buff, (size_t)(writePtr - buff));
+        writePtr = buff;
+    }
+    return retval;
+}
+
+// Write the buffered bytes up to the last alignment boundary; keep the rest at the front of
+// the buffer.  Plain flush() without alignment, or when no boundary falls within the buffer.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::flushAligned(void)
+{
+    uint32_t retval;
+    size_t buffered = (size_t)(writePtr - buff);
+    size_t chunk = buffered;
+    if (0 != flushAlignment) {
+        size_t boundary = ((bytesFlushedTotal + buffered) / flushAlignment) * flushAlignment;
+        if (boundary > bytesFlushedTotal) {
+            chunk = boundary - bytesFlushedTotal;
+        }
+    }
+    if (chunk >= buffered) {
+        retval = flush();
+    } else {
+        retval = writeThrough(buff, chunk);
+        memmove(buff, buff + chunk, buffered - chunk);
+        writePtr = buff + (buffered - chunk);
+    }
+    return retval;
+}
+
+// Write data straight to the file, bypassing the buffer.
+// Caller must have checked that the file has been set.
+// Returns Backend::write() return code.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::writeThrough(const char *source, size_t nChars)
+{
+    reserveAhead(nChars);
+    bytesFlushedTotal += nChars;
+    uint32_t retval = Backend::write(file, source, nChars);
+    if (retval != nChars) {
+        failed = true;
+    }
+    return retval;
+}
+
+// Reserve from the file position, whole chunks reaching past the write, so some reserved space
+// is always left after it (trimPreallocation() relies on that).
+template <size_t BufSize, size_t LineSize, class Backend>
+void BasicBufferedFileWriter<BufSize, LineSize, Backend>::reserveAhead(size_t nChars)
+{
+    if ((0 != preallocationChunk) && (nChars >= reservedLeft)) {
+        size_t size = (nChars / preallocationChunk + 1) * preallocationChunk;
+        if (BackendReserve<Backend>::reserve(file, size)) {
+            reservedLeft = size;
+        }
+    }
+    reservedLeft = (nChars < reservedLeft) ? (reservedLeft - nChars) : 0;
+}
+
+// With flush alignment:  copy just enough of the data to end the buffer on a boundary, write
+// buffer and whole multiples of the alignment directly, and copy the remainder.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::writeAfterBuffer(const char *source, size_t nChars)
+{
+    uint32_t retval = 0;
+    if (0 == flushAlignment) {
+        retval = writeBufferAndData(source, nChars);
+    } else {
+        size_t misalignment = (bytesFlushedTotal + (size_t)(writePtr - buff)) % flushAlignment;
+        size_t lead = (0 != misalignment) ? (flushAlignment - misalignment) : 0;
+        if (lead >= nChars) {
+            lead = nChars;
+        }
+        if (lead > 0) {
+            retval = copyToBuffer(source, lead);
+        }
+        size_t tail = (nChars - lead) % flushAlignment;
+        size_t direct = nChars - lead - tail;
+        if (direct > 0) {
+            retval = writeBufferAndData(source + lead, direct);
+        }
+        if (tail > 0) {
+            uint32_t result = copyToBuffer(source + lead + direct, tail);
+            if (0 != result) {
+                retval = result;
+            }
+        }
+    }
+    return retval;
+}
+
+// Write data straight to the file after the buffered bytes; see writeBufferAndData() declaration.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::writeBufferAndData(const char *source, size_t nChars)
+{
+    uint32_t retval;
+    if (Backend::SupportsGather) {
+        WriteSegment segments[2] = { { buff, (size_t)(writePtr - buff) }, { source, nChars } };
+        size_t total = (size_t)(writePtr - buff) + nChars;
+        reserveAhead(total);
+        bytesFlushedTotal += total;
+        retval = BackendGather<Backend>::write(file, segments, 2);
+        if (retval != total) {
+            failed = true;
+        }
+        writePtr = buff;
+    } else {
+        // A short buffer flush is the first failure:  report it, not the later direct write.
+        size_t buffered = (size_t)(writePtr - buff);
+        uint32_t result = flush();
+        retval = writeThrough(source, nChars);
+        if ((buffered > 0) && (result != buffered)) {
+            retval = result;
+        }
+    }
+    return retval;
+}
+
+// Copy in blocks:  fill the remaining buffer space with a single memcpy(), flush when full,
+// and continue with the rest of the source.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::copyToBuffer(const char *source, size_t nChars)
+{
+    uint32_t retval = 0;
+    while (nChars > 0) {
+        size_t space = (size_t)(writeEndPtr - writePtr);
+        size_t chunk = (nChars < space) ? nChars : space;
+        memcpy(writePtr, source, chunk);
+        writePtr += chunk;
+        source += chunk;
+        nChars -= chunk;
+        // If full:  flush to disk and set write pointer back to beginning of buff (or past
+        // the bytes carried over for alignment).
+        if (writePtr >= writeEndPtr) {
+            retval = flushAligned();
+        }
+    }
+    return retval;
+}
+
+// Write data to disk buffer with specified length (handles binary).
+// Copies in blocks:  fills the remaining buffer space with a single memcpy(), flushes when
+// full, and continues with the rest of the source.
+// Data that does not fit is instead written directly after the buffered bytes, when the
+// backend supports gathered writes or the data is BufferSize bytes or more:  no copy, and
+// one Backend::writev() (or a flush() and one Backend::write()).
+// When the disk buffer is full, flush disk buffer to disk.
+// After the last write, user must call flush().
+// Returns Backend::write() return code if buffer is flushed (or payload written directly), 0 otherwise.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::write(const char *source,    // Buffer of data to write to disk buffer / disk
+        size_t nChars)         // Count of bytes just written to buffer.
+{
+    uint32_t retval = 0;
+
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else {
+        bytesWrittenTotal += nChars;
+        if (nChars < (size_t)(writeEndPtr - writePtr)) {
+            // Common case:  fits without filling the buffer.  A few bytes are copied inline;
+            // a memcpy() call costs more than copying them.
+            if (nChars <= SmallCopyMax) {
+                for (size_t i = 0; i < nChars; ++i) {
+                    writePtr[i] = source[i];
+                }
+            } else {
+                memcpy(writePtr, source, nChars);
+            }
+            writePtr += nChars;
+        } else if (Backend::SupportsGather || (nChars >= BufferSize)) {
+            // Copying would only split the data across buffer flushes:  write it directly.
+            retval = writeAfterBuffer(source, nChars);
+        } else {
+            retval = copyToBuffer(source, nChars);
+        }
+    }
+    return retval;
+}
+
+// Write segments in order; each is copied or written directly by the same rule as write().
+// Returns return code of the last backend write, 0 if none.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::writev(const WriteSegment *segments, size_t count)
+{
+    uint32_t retval = 0;
+
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            const char *source = segments[i].data;
+            size_t nChars = segments[i].length;
+            bytesWrittenTotal += nChars;
+            if (nChars < (size_t)(writeEndPtr - writePtr)) {
+                memcpy(writePtr, source, nChars);
+                writePtr += nChars;
+            } else if (Backend::SupportsGather || (nChars >= BufferSize)) {
+                retval = writeAfterBuffer(source, nChars);
+            } else {
+                retval = copyToBuffer(source, nChars);
+            }
+        }
+    }
+    return retval;
+}
+
+// Reserve space in the disk buffer for formatting in place.
+// Flushes first if fewer than nChars bytes remain (completely, if the bytes carried over for
+// alignment leave too little room).
+// Returns pointer into the buffer, or NULL if nChars > BufferSize or no file is set.
+template <size_t BufSize, size_t LineSize, class Backend>
+char *BasicBufferedFileWriter<BufSize, LineSize, Backend>::reserve(size_t nChars)
+{
+    char *retval = NULL;
+    if ((Backend::noFile() != file) && (nChars <= BufferSize)) {
+        if (nChars > (size_t)(writeEndPtr - writePtr)) {
+            flushAligned();
+            if (nChars > (size_t)(writeEndPtr - writePtr)) {
+                flush();
+            }
+        }
+        retval = writePtr;
+    }
+    return retval;
+}
+
+// Commit used bytes of the last reservation to the disk buffer.
+// When the disk buffer is full, flush disk buffer to disk.
+// Returns Backend::write() return code if buffer is flushed, 0 otherwise.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::commit(size_t used)
+{
+    uint32_t retval = 0;
+    writePtr += used;
+    bytesWrittenTotal += used;
+    if (writePtr >= writeEndPtr) {
+        retval = flushAligned();
+    }
+    return retval;
+}
+
+// Write string to disk buffer, length from strlen().  Writes 0 bytes for NULL string.
+// When the disk buffer is full, flush disk buffer to disk.
+// After the last write, user must call flush().
+// If buffer is flushed, returns Backend::write() return code (or 0xffff if setFile() was not called with a
+// file), 0 otherwise.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::writeStr(const char *string)
+{
+    uint32_t retval = 0;
+    if (NULL != string) {
+        retval = write(string, strlen(string));
+    }
+    return retval;
+}
+
+// Logging-style printf formatting into the disk buffer; see printLine().
+// Writes 0 bytes for NULL fmt or a format error.
+// After the last write, user must call flush().
+// Returns number of bytes written, or WriteNoFile if setFile() was not called with a
+// file.
+template <size_t BufSize, size_t LineSize, class Backend>
+int BasicBufferedFileWriter<BufSize, LineSize, Backend>::vprintf(const char *fmt, va_list arglist)
+{
+    int retval = 0;
+    if (Backend::noFile() == file) {
+        retval = (int)WriteNoFile;
+    } else if (NULL != fmt) {
+        va_list args;
+        va_copy(args, arglist);
+        retval = printLine([&](char *dest, size_t space) {
+            va_list pass;
+            va_copy(pass, args);
+            int nChars = vsnprintf(dest, space, fmt, pass);
+            va_end(pass);
+            return nChars;
+        });
+        va_end(args);
+    }
+    return retval;
+}
+
+// Typed formatting into the disk buffer through TypedFormat::format(); see printLine().
+// Writes 0 bytes for NULL fmt.
+// Returns number of bytes written, or WriteNoFile if setFile() was not called with a
+// file.
+template <size_t BufSize, size_t LineSize, class Backend>
+template <class... Args>
+int BasicBufferedFileWriter<BufSize, LineSize, Backend>::format(const char *fmt, const Args&... args)
+{
+    int retval = 0;
+    if (Backend::noFile() == file) {
+        retval = (int)WriteNoFile;
+    } else if (NULL != fmt) {
+        retval = printLine([&](char *dest, size_t space) {
+            return TypedFormat::format(dest, space, fmt, args...);
+        });
+    }
+    return retval;
+}
+
+// Format straight into the free tail of the disk buffer.
+// If the line does not fit, flush and format it again into the emptied buffer.  A line longer
+// than the whole buffer is truncated to the buffer, unless LineBuffSize is larger:  then it
+// spills through the line buffer (truncated to LineBuffSize) and is written directly.
+template <size_t BufSize, size_t LineSize, class Backend>
+template <class Formatter>
+int BasicBufferedFileWriter<BufSize, LineSize, Backend>::printLine(const Formatter &formatter)
+{
+    int retval = 0;
+    size_t space = (size_t)(writeEndPtr - writePtr);
+    int nChars = formatter(writePtr, space);
+    if ((nChars >= 0) && ((size_t)nChars >= space)) {
+        flushAligned();
+        if ((size_t)nChars >= (size_t)(writeEndPtr - writePtr)) {
+            flush();
+        }
+        space = (size_t)(writeEndPtr - writePtr);
+        if (((size_t)nChars >= space) && (LineBuffSize >= space)) {
+            nChars = formatter(lineBuff, sizeof(lineBuff));
+            if ((size_t)nChars > LineBuffSize) {
+                nChars = (int)LineBuffSize;
+            }
+            write(lineBuff, (size_t)nChars);
+            retval = nChars;
+            nChars = -1;
+        } else {
+            nChars = formatter(writePtr, space);
+            if ((size_t)nChars >= space) {
+                nChars = (int)(space - 1);
+            }
+        }
+    }
+    if (nChars > 0) {
+        commit((size_t)nChars);
+        retval = nChars;
+    }
+    return retval;
+}
+
+// Append decimal integer; see appendConverted().
+template <size_t BufSize, size_t LineSize, class Backend>
+template <class T>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::appendDec(T value)
+{
+    return appendConverted<NumberFormat::MaxDecChars>([&](char *dest) {
+        return NumberFormat::formatDec(dest, value);
+    });
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::appendHex(uint64_t value, size_t minDigits)
+{
+    return appendConverted<NumberFormat::MaxHexChars>([&](char *dest) {
+        return NumberFormat::formatHex(dest, value, minDigits);
+    });
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::appendFixed(int64_t value, unsigned decimals)
+{
+    return appendConverted<NumberFormat::MaxFixedChars>([&](char *dest) {
+        return NumberFormat::formatFixed(dest, value, decimals);
+    });
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::appendDouble(double value)
+{
+    return appendConverted<NumberFormat::MaxDoubleChars>([&](char *dest) {
+        return NumberFormat::formatDouble(dest, value);
+    });
+}
+
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::appendTimestamp(TimestampFormat &timestamp, int64_t seconds, uint32_t nanoseconds)
+{
+    return appendConverted<TimestampFormat::MaxChars>([&](char *dest) {
+        return timestamp.format(dest, seconds, nanoseconds);
+    });
+}
+
+// One line at a time; returns return code of the last backend write, 0 if none.
+template <size_t BufSize, size_t LineSize, class Backend>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::appendHexDump(const void *data, size_t nBytes, uint64_t offset)
+{
+    uint32_t retval = 0;
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else {
+        const uint8_t *bytes = (const uint8_t *)data;
+        while (nBytes > 0) {
+            size_t lineBytes = (nBytes < NumberFormat::HexDumpLineBytes) ? nBytes : NumberFormat::HexDumpLineBytes;
+            uint32_t code = appendConverted<NumberFormat::MaxHexDumpLineChars>([&](char *dest) {
+                return NumberFormat::formatHexDumpLine(dest, offset, bytes, lineBytes);
+            });
+            if (0 != code) {
+                retval = code;
+            }
+            bytes += lineBytes;
+            offset += lineBytes;
+            nBytes -= lineBytes;
+        }
+    }
+    return retval;
+}
+
+// Convert in place when MaxChars fit in the disk buffer; otherwise convert into a local
+// buffer and write() it, so the disk buffer is still filled completely before it is written.
+template <size_t BufSize, size_t LineSize, class Backend>
+template <size_t MaxChars, class Converter>
+uint32_t BasicBufferedFileWriter<BufSize, LineSize, Backend>::appendConverted(const Converter &converter)
+{
+    uint32_t retval;
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else if ((size_t)(writeEndPtr - writePtr) >= MaxChars) {
+        retval = commit(converter(writePtr));
+    } else {
+        char text[MaxChars];
+        retval = write(text, converter(text));
+    }
+    return retval;
+}
+
+#endif //ndef BASIC_BUFFERED_FILE_WRITER_H
@@ -0,0 +1,817 @@
+/****************************************************************************
+ *   FILENAME: BasicDoubleBufferedFileWriter.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Buffered file writes that do not block the writing thread on the backend write.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Same public API as BasicBufferedFileWriter (setFile(), write(), writeStr(), vprintf(),
+ *       flush(), ...), so a call site can switch between the two by changing the type only.
+ *       Buffer sizes and the storage Backend are template parameters, as for
+ *       BasicBufferedFileWriter; DoubleBufferedFileWriter (DoubleBufferedFileWriter.h) is the
+ *       emFile instantiation.
+ *
+ *       Holds a ring of BufferCount buffers.  The writing thread fills one buffer; when it
+ *       is full it is handed to a dedicated flusher thread, which calls Backend::write(),
+ *       and the writing thread carries on in the next free buffer.  The writing thread
+ *       blocks only when every other buffer is still waiting to be written.
+ *
+ *       flush() is a barrier:  hands off the partly filled buffer and waits until all
+ *       handed-off buffers have been written.  Call it before closing the file, exactly as
+ *       with BufferedFileWriter.
+ *
+ *       Because writes complete in the background, write() cannot return the result of its
+ *       own Backend::write().  When write() hands off a buffer it returns the result of the
+ *       most recently completed write; flush() returns the result of the last write completed
+ *       by the time it returns.  A write that came up short (fewer bytes than the buffer held)
+ *       is sticky:  from then on write() and flush() return its result instead, until the
+ *       next setFile(), so a failure is not lost behind later writes that succeed.
+ *
+ *       vprintf() formats straight into the buffer being filled, as in
+ *       BasicBufferedFileWriter; a line that does not fit is formatted again after handing
+ *       the buffer off.
+ *
+ *       setFlushAlignment() works as in BasicBufferedFileWriter:  a full buffer is handed off
+ *       only up to the last alignment boundary, and the bytes past it are copied to the front
+ *       of the next buffer (the flusher only reads the handed-off part, so the copy does not
+ *       wait for the write).
+ *
+ *       setPreallocation() / trimPreallocation() work as in BasicBufferedFileWriter; the
+ *       flusher thread reserves the next chunk before the write that would use up the space.
+ *
+ *       Single producer:  like BufferedFileWriter, an instance must only be written from one
+ *       thread at a time.
+ *
+ *       The flusher thread is started by the first setFile() with a file, so static
+ *       instances (recommended, to keep the buffers off the stack) do not start threads
+ *       during static initialization.
+ *
+ ****************************************************************************/
+
+#ifndef BASIC_DOUBLE_BUFFERED_FILE_WRITER_H
+#define BASIC_DOUBLE_BUFFERED_FILE_WRITER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "FileBackend.h"
+#include "NumberFormat.h"
+#include "TimestampFormat.h"
+#include "TypedFormat.h"
+
+#ifndef _ATTRIBUTE
+#define _ATTRIBUTE(attrs) __attribute__ (attrs)
+#endif
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+class BasicDoubleBufferedFileWriter
+{
+public:
+    enum WriteResult {
+        WriteNoFile = UINT32_MAX      // Unable to write because file pointer hasn't been set
+    };
+
+    // Size of each write buffer; made constant to allow static allocation.
+    static const size_t BufferSize = BufSize;
+    // Number of write buffers in the ring; at least 2.
+    static const size_t BufferCount = BufCount;
+    // Longest printf line when larger than BufferSize - 1; made constant to allow static allocation.
+    static const size_t LineBuffSize = LineSize;
+
+    BasicDoubleBufferedFileWriter(void);
+
+    // Flushes (if a file is set) and stops the flusher thread.
+    virtual ~BasicDoubleBufferedFileWriter(void);
+
+    // Connect to ((re-)opened for write) file.  Clear buffer.
+    // Waits for buffers already handed off to be written to the previous file, then clears
+    // the sticky write failure (see flush()).
+    // Must NOT reset bytes written count (see BasicBufferedFileWriter.h).
+    void setFile(typename Backend::Handle _file);
+
+    // Return number of bytes buffered, including handed-off buffers not yet written.
+    size_t bufferCount(void);
+
+    // Return true if a write to the file came up short since setFile() (the sticky failure,
+    // see flush()).  Buffers still being written are not included:  flush() first.
+    bool writeFailed(void);
+
+    // Return bytes written (including buffers) since initialization or last resetBytesWrittenTotal().
+    size_t getBytesWrittenTotal(void);
+
+    // Reset count of bytes written.  Alignment (setFlushAlignment()) is relative to the file
+    // offset at this call, which should be made with an empty buffer, e.g. for a new file.
+    void resetBytesWrittenTotal(void);
+
+    // Make each hand-off of a full buffer end on a multiple of alignment bytes (file offset);
+    // 0 or 1 turns alignment off.  alignment must divide BufferSize.
+    // Returns false, and turns alignment off, if it does not.
+    // Keep alignment at most BufferSize / 2:  reserve() and printf lines that do not fit
+    // beside the carried-over bytes fall back to an unaligned flush.
+    bool setFlushAlignment(size_t alignment);
+
+    // Reserve file space chunkSize bytes at a time ahead of the data, from the next setFile()
+    // on; 0 turns it off.  Returns false, and turns it off, on a backend without reserve.
+    bool setPreallocation(size_t chunkSize);
+
+    // Flush, then release the space reserved past the data.  Call before closing the file
+    // (or switching to another one).  Returns false if there was nothing to release or the
+    // backend failed.
+    bool trimPreallocation(void);
+
+    // Clear the buffer being filled.  Buffers already handed off are still written.
+    // Must NOT zero the total count of bytes written.
+    void clear(void);
+
+    // Hand off the buffer being filled and wait until every handed-off buffer is written.
+    // After the last write, call flush().
+    // Returns the Backend::write() return code of the first write since setFile() that came
+    // up short, else of the last completed write (0 if none),
+    // or WriteNoFile if setFile() was never called, or was last called with Backend::noFile().
+    uint32_t flush(void);
+
+    // Write (binary) data to disk buffer with specified length.
+    // When the buffer is full, it is handed to the flusher thread.
+    // After the last write, user must call flush().
+    // If a buffer is handed off, returns the Backend::write() return code of the most recently
+    // completed write (of the first short one, as for flush()), or WriteNoFile if setFile() was never called, or was last called with
+    // Backend::noFile(), 0 otherwise.
+    uint32_t write(const char *source,    // Source buffer of data to write to disk buffer / disk
+            size_t nChars);         // Count of bytes just written to buffer.
+
+    // Write (binary) data given as count segments, in order, to disk buffer.
+    // Return code as for write().
+    uint32_t writev(const WriteSegment *segments, size_t count);
+
+    // Write string to disk buffer, length from strlen().  Writes 0 bytes for NULL string.
+    // Return code as for write().
+    uint32_t writeStr(const char *string);
+
+    // Reserve nChars contiguous bytes at the end of the buffer being filled, for formatting
+    // in place.  Hands the buffer off first if fewer than nChars bytes remain.
+    // Returns pointer to the reserved bytes, or NULL if nChars > BufferSize or setFile() was
+    // never called, or was last called with Backend::noFile().
+    // Nothing is written until commit(); another reserve() abandons the reservation.
+    char *reserve(size_t nChars);
+
+    // Add the first used bytes of the last reserve() (used must not exceed the reserved
+    // size) to the buffer.  When the buffer is full, it is handed to the flusher thread.
+    // Return code as for write().
+    uint32_t commit(size_t used);
+
+    // vprintf formatting directly into the buffer being filled (no intermediate copy).
+    // Lines are truncated to BufferSize - 1 or LineBuffSize characters, whichever is more.
+    // After the last write, user must call flush().
+    // Return code is number of bytes written,
+    // or WriteNoFile if setFile() was never called or was last called with Backend::noFile().
+    int vprintf(const char * fmt, va_list arglist)
+            _ATTRIBUTE ((__format__ (__printf__, 2, 0)));
+
+    // Typed printf-style formatting directly into the buffer being filled (see TypedFormat.h).
+    // Use TYPED_PRINTF(writer, fmt, ...) to check fmt against the arguments at compile time.
+    // Return code as for vprintf().
+    template <class... Args>
+    int format(const char *fmt, const Args&... args);
+
+    // Append number as text, converted directly into the buffer being filled (see NumberFormat.h).
+    // Decimal integer of any integral type.
+    // Return code as for write().
+    template <class T>
+    uint32_t appendDec(T value);
+
+    // Lower case hex, zero-padded to at least minDigits digits.  Return code as for write().
+    uint32_t appendHex(uint64_t value, size_t minDigits = 1);
+
+    // Scaled integer value / 10^decimals, e.g. appendFixed(1234, 3) appends "1.234".
+    // Return code as for write().
+    uint32_t appendFixed(int64_t value, unsigned decimals);
+
+    // Shortest text that reads back as the same double.  Return code as for write().
+    uint32_t appendDouble(double value);
+
+    // ISO-8601 UTC timestamp (see TimestampFormat.h), converted directly into the buffer being filled.
+    // timestamp holds the cached date prefix.  Return code as for write().
+    uint32_t appendTimestamp(TimestampFormat &timestamp, int64_t seconds, uint32_t nanoseconds);
+
+    // hexdump -C style lines for nBytes of data, offset being the dump position of data[0]
+    // (see NumberFormat::formatHexDumpLine()).  Return code as for writev().
+    uint32_t appendHexDump(const void *data, size_t nBytes, uint64_t offset = 0);
+
+private:
+    // Block copy-ctor, assignment operator.
+    BasicDoubleBufferedFileWriter(const BasicDoubleBufferedFileWriter &obj);
+    BasicDoubleBufferedFileWriter& operator=(const BasicDoubleBufferedFileWriter& obj);
+
+    struct Buffer {
+        alignas(Backend::BufferAlignment) char data[BufferSize];   // Aligned for the backend
+        size_t      count;          // Bytes to write; set when handed off
+        typename Backend::Handle file;  // File to write to; set when handed off
+    };
+
+    // Hand the buffer being filled to the flusher thread and move to the next free buffer,
+    // waiting for one if necessary.  Returns the result of the most recent completed write.
+    uint32_t handOff(void);
+
+    // handOff() of the bytes up to the last alignment boundary; the rest are carried into the
+    // next buffer.  Plain handOff() without alignment or without a boundary in the buffer.
+    uint32_t handOffAligned(void);
+
+    // Hand off the first count bytes of the buffer being filled, carrying the rest over.
+    uint32_t handOffPart(size_t count);
+
+    // Wait (lock held) until no buffers are waiting to be written.
+    void waitForIdle(std::unique_lock<std::mutex> &guard);
+
+    // Result to report (lock held):  of the first short write since setFile(), else of the
+    // most recently completed write.
+    uint32_t completedResult(void);
+
+    // Flusher thread body.
+    void flusherMain(void);
+
+    // With preallocation, reserve the next chunk(s) of target if nChars about to be written
+    // would use up the reserved space.  Flusher thread, or writing thread while idle.
+    void reserveAhead(typename Backend::Handle target, size_t nChars);
+
+    // Format one line into the buffer being filled (file must be set) with
+    // formatter(dest, space), which has snprintf() semantics; see vprintf().
+    // Returns number of bytes written.
+    template <class Formatter>
+    int printLine(const Formatter &formatter);
+
+    // Append the text converter(dest) writes (at most MaxChars bytes); see appendDec().
+    template <size_t MaxChars, class Converter>
+    uint32_t appendConverted(const Converter &converter);
+
+    // Write buffers
+    Buffer      buffers[BufferCount];
+    // printf spill buffer for lines longer than a write buffer; only needed if LineBuffSize is larger
+    char        lineBuff[(LineBuffSize >= BufferSize) ? (LineBuffSize + 1) : 1];
+    typename Backend::Handle file;
+    // Index of the buffer being filled by the writing thread.
+    size_t      fillIndex;
+    char *      writePtr;
+    const char * writeEndPtr;
+    // Bytes written total, including those still in the buffers and those written to the file,
+    // since initialization or the last resetBytesWrittenTotal() call.
+    size_t      bytesWrittenTotal;
+    // Bytes handed off since the last resetBytesWrittenTotal():  the file offset of the
+    // first byte of the buffer being filled.
+    size_t      bytesHandedOffTotal;
+    // Hand-offs of a full buffer end on multiples of this; 0 = off
+    size_t      flushAlignment;
+    // File space is reserved this many bytes at a time; 0 = off
+    size_t      preallocationChunk;
+    // Reserved bytes past the file position; owned by the flusher thread while it writes
+    size_t      reservedLeft;
+
+    // State shared with the flusher thread; guarded by lock.
+    std::mutex  lock;
+    std::condition_variable changed;
+    // Handed-off buffers are [flushIndex, flushIndex + queuedCount) modulo BufferCount.
+    size_t      flushIndex;
+    size_t      queuedCount;
+    // Backend::write() return code of the most recently completed write.
+    uint32_t    lastResult;
+    // A write came up short since setFile(); its return code.
+    bool        failed;
+    uint32_t    failedResult;
+    bool        stopping;
+    std::thread flusher;
+};
+
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::BasicDoubleBufferedFileWriter(void)
+{
+    bytesWrittenTotal = 0;
+    bytesHandedOffTotal = 0;
+    flushAlignment = 0;
+    preallocationChunk = 0;
+    reservedLeft = 0;
+    file = Backend::noFile();
+    fillIndex = 0;
+    flushIndex = 0;
+    queuedCount = 0;
+    lastResult = 0;
+    failed = false;
+    failedResult = 0;
+    stopping = false;
+    clear();
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::~BasicDoubleBufferedFileWriter(void)
+{
+    if (Backend::noFile() != file) {
+        flush();
+        file = Backend::noFile();
+    }
+    if (flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        changed.notify_all();
+        flusher.join();
+    }
+}
+
+// Connect to (opened for write) file.  Clear buffer.
+// Waits for buffers already handed off, because they belong to the previous file.
+// Must NOT reset bytes written count (see BasicBufferedFileWriter.h).
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+void BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::setFile(typename Backend::Handle _file)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    waitForIdle(guard);
+    file = _file;
+    failed = false;
+    reservedLeft = 0;
+    if (Backend::noFile() != file) {
+        reserveAhead(file, 0);
+    }
+    if ((Backend::noFile() != file) && !flusher.joinable()) {
+        flusher = std::thread(&BasicDoubleBufferedFileWriter::flusherMain, this);
+    }
+    guard.unlock();
+    clear();
+}
+
+// Return number of bytes not yet written to the file:  the buffer being filled plus
+// handed-off buffers.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+size_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::bufferCount(void)
+{
+    size_t count = (size_t)(writePtr - buffers[fillIndex].data);
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; i < queuedCount; ++i) {
+        count += buffers[(flushIndex + i) % BufferCount].count;
+    }
+    return count;
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+bool BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::writeFailed(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return failed;
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+void BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::resetBytesWrittenTotal(void)
+{
+    bytesWrittenTotal = 0;
+    bytesHandedOffTotal = 0;
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+bool BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::setFlushAlignment(size_t alignment)
+{
+    bool retval = (alignment <= BufferSize) && ((0 == alignment) || (0 == BufferSize % alignment));
+    flushAlignment = (retval && (alignment > 1)) ? alignment : 0;
+    return retval;
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+bool BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::setPreallocation(size_t chunkSize)
+{
+    preallocationChunk = Backend::SupportsReserve ? chunkSize : 0;
+    return Backend::SupportsReserve || (0 == chunkSize);
+}
+
+// flush() leaves the flusher idle, so reservedLeft is the writing thread's here.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+bool BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::trimPreallocation(void)
+{
+    bool retval = false;
+    if (Backend::noFile() != file) {
+        flush();
+        std::lock_guard<std::mutex> guard(lock);
+        if (0 != reservedLeft) {
+            retval = BackendReserve<Backend>::trim(file);
+            reservedLeft = 0;
+        }
+    }
+    return retval;
+}
+
+// Return total bytes written (including bytes not yet written to file) since initialization
+// or last resetBytesWrittenTotal().
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+size_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::getBytesWrittenTotal(void)
+{
+    return bytesWrittenTotal;
+}
+
+// Clear the buffer being filled, before first use or to reinitialize.
+// Must NOT zero the total count of bytes written.
+// May be called repeatedly.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+void BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::clear(void)
+{
+    writePtr = buffers[fillIndex].data;
+    writeEndPtr = writePtr + BufferSize;
+}
+
+// Hand off the buffer being filled (if not empty), then wait for all handed-off buffers
+// to be written.
+// Returns Backend::write() return code of the last completed write, or WriteNoFile if setFile()
+// was not called with a file.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::flush(void)
+{
+    uint32_t retval = 0;
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else {
+        if (writePtr > buffers[fillIndex].data) {
+            handOff();
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        waitForIdle(guard);
+        retval = completedResult();
+    }
+    return retval;
+}
+
+// Write data to disk buffer with specified length (handles binary).
+// When the buffer is full, hand it off to the flusher thread.
+// After the last write, user must call flush().
+// Returns the most recent Backend::write() return code if a buffer is handed off, 0 otherwise.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::write(const char *source,    // Buffer of data to write to disk buffer / disk
+        size_t nChars)         // Count of bytes just written to buffer.
+{
+    uint32_t retval = 0;
+
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else {
+        bytesWrittenTotal += nChars;
+        while (nChars > 0) {
+            size_t space = (size_t)(writeEndPtr - writePtr);
+            size_t chunk = (nChars < space) ? nChars : space;
+            memcpy(writePtr, source, chunk);
+            writePtr += chunk;
+            source += chunk;
+            nChars -= chunk;
+            // If full:  hand off to flusher thread and continue in the next buffer.
+            if (writePtr >= writeEndPtr) {
+                retval = handOffAligned();
+            }
+        }
+    }
+    return retval;
+}
+
+// Write segments in order.  Every segment is copied:  the writing thread never waits for
+// the backend, so there is nothing to gain from writing a segment directly.
+// Returns return code as for write() of the last segment that handed off a buffer, 0 if none.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::writev(const WriteSegment *segments,
+        size_t count)
+{
+    uint32_t retval = 0;
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t result = write(segments[i].data, segments[i].length);
+            if (0 != result) {
+                retval = result;
+            }
+        }
+    }
+    return retval;
+}
+
+// Reserve space in the buffer being filled for formatting in place.
+// Hands the buffer off first if fewer than nChars bytes remain (completely, if the bytes
+// carried over for alignment leave too little room).
+// Returns pointer into the buffer, or NULL if nChars > BufferSize or no file is set.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+char *BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::reserve(size_t nChars)
+{
+    char *retval = NULL;
+    if ((Backend::noFile() != file) && (nChars <= BufferSize)) {
+        if (nChars > (size_t)(writeEndPtr - writePtr)) {
+            handOffAligned();
+            if (nChars > (size_t)(writeEndPtr - writePtr)) {
+                handOff();
+            }
+        }
+        retval = writePtr;
+    }
+    return retval;
+}
+
+// Commit used bytes of the last reservation to the buffer being filled.
+// Returns the most recent Backend::write() return code if the buffer is handed off, 0 otherwise.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::commit(size_t used)
+{
+    uint32_t retval = 0;
+    writePtr += used;
+    bytesWrittenTotal += used;
+    if (writePtr >= writeEndPtr) {
+        retval = handOffAligned();
+    }
+    return retval;
+}
+
+// Write string to disk buffer, length from strlen().  Writes 0 bytes for NULL string.
+// Return code as for write().
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::writeStr(const char *string)
+{
+    uint32_t retval = 0;
+    if (NULL != string) {
+        retval = write(string, strlen(string));
+    }
+    return retval;
+}
+
+// vprintf formatting into the buffer being filled; see printLine().
+// Returns number of bytes written, or WriteNoFile if setFile() was not called with a
+// file.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+int BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::vprintf(const char *fmt, va_list arglist)
+{
+    int retval = 0;
+    if (Backend::noFile() == file) {
+        retval = (int)WriteNoFile;
+    } else if (NULL != fmt) {
+        va_list args;
+        va_copy(args, arglist);
+        retval = printLine([&](char *dest, size_t space) {
+            va_list pass;
+            va_copy(pass, args);
+            int nChars = vsnprintf(dest, space, fmt, pass);
+            va_end(pass);
+            return nChars;
+        });
+        va_end(args);
+    }
+    return retval;
+}
+
+// Typed formatting into the buffer being filled through TypedFormat::format(); see printLine().
+// Returns number of bytes written, or WriteNoFile if setFile() was not called with a
+// file.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+template <class... Args>
+int BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::format(const char *fmt, const Args&... args)
+{
+    int retval = 0;
+    if (Backend::noFile() == file) {
+        retval = (int)WriteNoFile;
+    } else if (NULL != fmt) {
+        retval = printLine([&](char *dest, size_t space) {
+            return TypedFormat::format(dest, space, fmt, args...);
+        });
+    }
+    return retval;
+}
+
+// Format straight into the free tail of the buffer being filled.
+// If the line does not fit, hand the buffer off and format it again into the next one.  A line
+// longer than a whole buffer is truncated to the buffer, unless LineBuffSize is larger:  then
+// it spills through the line buffer (truncated to LineBuffSize) and is copied in by write().
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+template <class Formatter>
+int BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::printLine(const Formatter &formatter)
+{
+    int retval = 0;
+    size_t space = (size_t)(writeEndPtr - writePtr);
+    int nChars = formatter(writePtr, space);
+    if ((nChars >= 0) && ((size_t)nChars >= space)) {
+        if (writePtr != buffers[fillIndex].data) {
+            handOffAligned();
+            if ((size_t)nChars >= (size_t)(writeEndPtr - writePtr)) {
+                handOff();
+            }
+        }
+        space = (size_t)(writeEndPtr - writePtr);
+        if (((size_t)nChars >= space) && (LineBuffSize >= space)) {
+            nChars = formatter(lineBuff, sizeof(lineBuff));
+            if ((size_t)nChars > LineBuffSize) {
+                nChars = (int)LineBuffSize;
+            }
+            write(lineBuff, (size_t)nChars);
+            retval = nChars;
+            nChars = -1;
+        } else {
+            nChars = formatter(writePtr, space);
+            if ((size_t)nChars >= space) {
+                nChars = (int)(space - 1);
+            }
+        }
+    }
+    if (nChars > 0) {
+        commit((size_t)nChars);
+        retval = nChars;
+    }
+    return retval;
+}
+
+// Append decimal integer; see appendConverted().
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+template <class T>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::appendDec(T value)
+{
+    return appendConverted<NumberFormat::MaxDecChars>([&](char *dest) {
+        return NumberFormat::formatDec(dest, value);
+    });
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::appendHex(uint64_t value, size_t minDigits)
+{
+    return appendConverted<NumberFormat::MaxHexChars>([&](char *dest) {
+        return NumberFormat::formatHex(dest, value, minDigits);
+    });
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::appendFixed(int64_t value, unsigned decimals)
+{
+    return appendConverted<NumberFormat::MaxFixedChars>([&](char *dest) {
+        return NumberFormat::formatFixed(dest, value, decimals);
+    });
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::appendDouble(double value)
+{
+    return appendConverted<NumberFormat::MaxDoubleChars>([&](char *dest) {
+        return NumberFormat::formatDouble(dest, value);
+    });
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::appendTimestamp(TimestampFormat &timestamp, int64_t seconds, uint32_t nanoseconds)
+{
+    return appendConverted<TimestampFormat::MaxChars>([&](char *dest) {
+        return timestamp.format(dest, seconds, nanoseconds);
+    });
+}
+
+// One line at a time; returns return code of the last backend write, 0 if none.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::appendHexDump(const void *data, size_t nBytes, uint64_t offset)
+{
+    uint32_t retval = 0;
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else {
+        const uint8_t *bytes = (const uint8_t *)data;
+        while (nBytes > 0) {
+            size_t lineBytes = (nBytes < NumberFormat::HexDumpLineBytes) ? nBytes : NumberFormat::HexDumpLineBytes;
+            uint32_t code = appendConverted<NumberFormat::MaxHexDumpLineChars>([&](char *dest) {
+                return NumberFormat::formatHexDumpLine(dest, offset, bytes, lineBytes);
+            });
+            if (0 != code) {
+                retval = code;
+            }
+            bytes += lineBytes;
+            offset += lineBytes;
+            nBytes -= lineBytes;
+        }
+    }
+    return retval;
+}
+
+// Convert in place when MaxChars fit in the buffer being filled; otherwise convert into a local
+// buffer and write() it, so the buffer being filled is still filled completely before it is written.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+template <size_t MaxChars, class Converter>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::appendConverted(const Converter &converter)
+{
+    uint32_t retval;
+    if (Backend::noFile() == file) {
+        retval = WriteNoFile;
+    } else if ((size_t)(writeEndPtr - writePtr) >= MaxChars) {
+        retval = commit(converter(writePtr));
+    } else {
+        char text[MaxChars];
+        retval = write(text, converter(text));
+    }
+    return retval;
+}
+
+// Queue the buffer being filled for the flusher thread; wait for the next buffer in the ring
+// to be free (written), then make it the buffer being filled.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::handOff(void)
+{
+    return handOffPart((size_t)(writePtr - buffers[fillIndex].data));
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::handOffAligned(void)
+{
+    size_t buffered = (size_t)(writePtr - buffers[fillIndex].data);
+    size_t count = buffered;
+    if (0 != flushAlignment) {
+        size_t boundary = ((bytesHandedOffTotal + buffered) / flushAlignment) * flushAlignment;
+        if (boundary > bytesHandedOffTotal) {
+            count = boundary - bytesHandedOffTotal;
+        }
+    }
+    return handOffPart(count);
+}
+
+// The carried-over bytes are read from the handed-off buffer after it is queued:  the flusher
+// only reads its first count bytes, and the buffer cannot be refilled until it is written.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::handOffPart(size_t count)
+{
+    Buffer &full = buffers[fillIndex];
+    size_t carry = (size_t)(writePtr - full.data) - count;
+    full.count = count;
+    full.file = file;
+    bytesHandedOffTotal += count;
+
+    std::unique_lock<std::mutex> guard(lock);
+    ++queuedCount;
+    changed.notify_all();
+    while (queuedCount >= BufferCount) {
+        changed.wait(guard);
+    }
+    uint32_t retval = completedResult();
+    guard.unlock();
+
+    fillIndex = (fillIndex + 1) % BufferCount;
+    clear();
+    if (carry > 0) {
+        memcpy(writePtr, full.data + count, carry);
+        writePtr += carry;
+    }
+    return retval;
+}
+
+// Wait until the flusher thread has written every handed-off buffer.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+void BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::waitForIdle(std::unique_lock<std::mutex> &guard)
+{
+    while (queuedCount > 0) {
+        changed.wait(guard);
+    }
+}
+
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+uint32_t BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::completedResult(void)
+{
+    return failed ? failedResult : lastResult;
+}
+
+// Flusher thread:  write handed-off buffers in order.  A buffer stays counted in queuedCount
+// until written, so the writing thread cannot refill it early.
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+void BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::flusherMain(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        while ((0 == queuedCount) && !stopping) {
+            changed.wait(guard);
+        }
+        if (0 == queuedCount) {
+            break;
+        }
+        Buffer &full = buffers[flushIndex];
+        guard.unlock();
+
+        reserveAhead(full.file, full.count);
+        uint32_t result = Backend::write(full.file, full.data, full.count);
+
+        guard.lock();
+        lastResult = result;
+        if ((result != full.count) && !failed) {
+            failed = true;
+            failedResult = result;
+        }
+        flushIndex = (flushIndex + 1) % BufferCount;
+        --queuedCount;
+        changed.notify_all();
+    }
+}
+
+// Reserve from the file position, whole chunks reaching past the write, so some reserved space
+// is always left after it (trimPreallocation() relies on that).
+template <size_t BufSize, size_t BufCount, size_t LineSize, class Backend>
+void BasicDoubleBufferedFileWriter<BufSize, BufCount, LineSize, Backend>::reserveAhead(
+        typename Backend::Handle target, size_t nChars)
+{
+    if ((0 != preallocationChunk) && (nChars >= reservedLeft)) {
+        size_t size = (nChars / preallocationChunk + 1) * preallocationChunk;
+        if (BackendReserve<Backend>::reserve(target, size)) {
+            reservedLeft = size;
+        }
+    }
+    reservedLeft = (nChars < reservedLeft) ? (reservedLeft - nChars) : 0;
+}
+
+#endif //ndef BASIC_DOUBLE_BUFFERED_FILE_WRITER_H
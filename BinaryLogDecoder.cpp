@@ -0,0 +1,297 @@
+/****************************************************************************
+ *   FILENAME: BinaryLogDecoder.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  turn a BinaryLogWriter file back into text.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  BinaryLogDecoder <binary log> [<text output>]   (default output:  stdout)
+ *
+ *       Reads the whole file, then formats each record with the printf() family, one
+ *       conversion at a time, from the argument values and the format carried by the
+ *       definition records (see BinaryLogWriter.h).  The output is what printf() would have
+ *       written on the target, except that long double arguments were narrowed to double.
+ *
+ *       A file cut short (e.g. by power loss) decodes up to its last complete record; the
+ *       truncation is reported on stderr.
+ *
+ *       Builds for the host only (uses malloc(), stdio); not part of the target image.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "BinaryLogWriter.h"
+
+// Format and argument types from a definition record.
+struct FormatDef
+{
+    char *      format;         // NUL-terminated copy; NULL until defined
+    char        argCodes[256];
+    size_t      argCount;
+};
+
+// One decoded argument.
+struct ArgValue
+{
+    char        code;
+    int64_t     i;
+    uint64_t    u;
+    double      f;
+    const char * s;             // NULL for a NULL string
+    size_t      sLength;
+};
+
+static FormatDef formats[BinaryLogStream::DefinitionTag];
+
+// Read whole file into a malloc()'d buffer.  Returns NULL on failure.
+static char *readFile(const char *path, size_t *size)
+{
+    char *data = NULL;
+    FILE *file = fopen(path, "rb");
+    if (NULL != file) {
+        if ((0 == fseek(file, 0, SEEK_END)) && (ftell(file) >= 0)) {
+            *size = (size_t)ftell(file);
+            rewind(file);
+            data = (char *)malloc(*size + 1);
+            if ((NULL != data) && (fread(data, 1, *size, file) != *size)) {
+                free(data);
+                data = NULL;
+            }
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+// Print one conversion:  spec is "%<flags><width><.precision>" (length modifiers removed),
+// conv the conversion character.  Falls back to a conversion suited to the argument if conv
+// does not suit it.
+static void printArg(FILE *out, char *spec, size_t specLength, char conv, const ArgValue &arg)
+{
+    static char stringBuff[BinaryLogStream::NullString + 1];
+    bool isInteger = (NULL != strchr("iuIU", arg.code));
+    char *end = spec + specLength;
+    if (isInteger) {
+        if ((NULL == strchr("diuoxXc", conv)) || ('\0' == conv)) {
+            conv = (('i' == arg.code) || ('I' == arg.code)) ? 'd' : 'u';
+        }
+        if ('c' != conv) {
+            *end++ = 'l';
+            *end++ = 'l';
+        }
+    } else if ('f' == arg.code) {
+        if ((NULL == strchr("fFeEgGaA", conv)) || ('\0' == conv)) {
+            conv = 'g';
+        }
+    } else if ('s' == arg.code) {
+        conv = 's';
+    } else {
+        conv = 'p';
+    }
+    *end++ = conv;
+    *end = '\0';
+
+    if (isInteger) {
+        if ('c' == conv) {
+            fprintf(out, spec, (int)arg.i);
+        } else if (NULL != strchr("di", conv)) {
+            fprintf(out, spec, (long long)arg.i);
+        } else {
+            fprintf(out, spec, (unsigned long long)arg.u);
+        }
+    } else if ('f' == arg.code) {
+        fprintf(out, spec, arg.f);
+    } else if ('s' == arg.code) {
+        if (NULL == arg.s) {
+            fprintf(out, spec, "(null)");
+        } else {
+            memcpy(stringBuff, arg.s, arg.sLength);
+            stringBuff[arg.sLength] = '\0';
+            fprintf(out, spec, stringBuff);
+        }
+    } else {
+        fprintf(out, spec, (void *)(uintptr_t)arg.u);
+    }
+}
+
+// Print a record's format with its arguments.  Conversions without an argument print as text.
+static void printRecord(FILE *out, const char *format, const ArgValue *args, size_t argCount)
+{
+    char spec[64];
+    size_t argIndex = 0;
+    const char *fmt = format;
+    while ('\0' != *fmt) {
+        if ('%' != *fmt) {
+            fputc(*fmt++, out);
+        } else if ('%' == fmt[1]) {
+            fputc('%', out);
+            fmt += 2;
+        } else {
+            const char *start = fmt++;
+            size_t specLength = 1;
+            spec[0] = '%';
+            while ((NULL != strchr("-+ #0123456789.", *fmt)) && ('\0' != *fmt)) {
+                if (specLength < sizeof(spec) - 4) {
+                    spec[specLength++] = *fmt;
+                }
+                ++fmt;
+            }
+            while ((NULL != strchr("hlLqjzt", *fmt)) && ('\0' != *fmt)) {
+                ++fmt;
+            }
+            char conv = *fmt;
+            if ('\0' != conv) {
+                ++fmt;
+            }
+            if (argIndex < argCount) {
+                printArg(out, spec, specLength, conv, args[argIndex++]);
+            } else {
+                fwrite(start, 1, (size_t)(fmt - start), out);
+            }
+        }
+    }
+}
+
+// Decode arguments of types codes from data.  Returns bytes used, or 0 if data is too short.
+static size_t decodeArgs(const char *data, size_t size, const char *codes, size_t argCount, ArgValue *args)
+{
+    size_t used = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && (i < argCount); ++i) {
+        ArgValue &arg = args[i];
+        arg.code = codes[i];
+        if (('i' == arg.code) || ('u' == arg.code)) {
+            ok = (used + 4 <= size);
+            if (ok) {
+                int32_t signedValue;
+                uint32_t unsignedValue;
+                memcpy(&signedValue, data + used, 4);
+                memcpy(&unsignedValue, data + used, 4);
+                // As the target's printf() reads a 32-bit argument for %d or %u / %x / ...
+                arg.i = signedValue;
+                arg.u = unsignedValue;
+                used += 4;
+            }
+        } else if (('I' == arg.code) || ('U' == arg.code) || ('p' == arg.code) || ('f' == arg.code)) {
+            ok = (used + 8 <= size);
+            if (ok) {
+                memcpy(&arg.u, data + used, 8);
+                memcpy(&arg.i, data + used, 8);
+                memcpy(&arg.f, data + used, 8);
+                used += 8;
+            }
+        } else if ('s' == arg.code) {
+            uint16_t length = 0;
+            ok = (used + 2 <= size);
+            if (ok) {
+                memcpy(&length, data + used, 2);
+                used += 2;
+                if (BinaryLogStream::NullString == length) {
+                    arg.s = NULL;
+                    arg.sLength = 0;
+                } else {
+                    ok = (used + length <= size);
+                    arg.s = data + used;
+                    arg.sLength = length;
+                    used += length;
+                }
+            }
+        } else {
+            fprintf(stderr, "unknown argument type code '%c'\n", arg.code);
+            ok = false;
+        }
+    }
+    return ok ? used : 0;
+}
+
+// Decode the stream after the header.  Returns 0 if it decoded completely, 1 otherwise.
+static int decode(FILE *out, const char *data, size_t size)
+{
+    static ArgValue args[256];
+    size_t pos = BinaryLogStream::HeaderSize;
+    while (pos + 2 <= size) {
+        uint16_t tag;
+        memcpy(&tag, data + pos, 2);
+        if (BinaryLogStream::DefinitionTag == tag) {
+            if (pos + BinaryLogStream::DefinitionSize > size) {
+                break;
+            }
+            uint16_t id;
+            uint16_t formatLength;
+            memcpy(&id, data + pos + 2, 2);
+            size_t argCount = (uint8_t)data[pos + 4];
+            memcpy(&formatLength, data + pos + 5, 2);
+            size_t recordSize = BinaryLogStream::DefinitionSize + argCount + formatLength;
+            if ((pos + recordSize > size) || (BinaryLogStream::DefinitionTag == id)) {
+                break;
+            }
+            FormatDef &def = formats[id];
+            free(def.format);
+            def.format = (char *)malloc(formatLength + 1u);
+            memcpy(def.format, data + pos + BinaryLogStream::DefinitionSize + argCount, formatLength);
+            def.format[formatLength] = '\0';
+            memcpy(def.argCodes, data + pos + BinaryLogStream::DefinitionSize, argCount);
+            def.argCount = argCount;
+            pos += recordSize;
+        } else {
+            const FormatDef &def = formats[tag];
+            if (NULL == def.format) {
+                fprintf(stderr, "record with undefined format ID %u at offset %lu\n",
+                        (unsigned)tag, (unsigned long)pos);
+                return 1;
+            }
+            size_t used = decodeArgs(data + pos + 2, size - pos - 2, def.argCodes, def.argCount, args);
+            if ((0 == used) && (def.argCount > 0)) {
+                break;
+            }
+            printRecord(out, def.format, args, def.argCount);
+            pos += 2 + used;
+        }
+    }
+    if (pos < size) {
+        fprintf(stderr, "log truncated or damaged at offset %lu of %lu\n", (unsigned long)pos, (unsigned long)size);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr, "usage: %s <binary log> [<text output>]\n", argv[0]);
+        return 2;
+    }
+    size_t size = 0;
+    char *data = readFile(argv[1], &size);
+    if (NULL == data) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 2;
+    }
+    const uint16_t endianProbe = 1;
+    uint8_t hostOrder = (1 == *reinterpret_cast<const uint8_t *>(&endianProbe))
+            ? BinaryLogStream::LittleEndian : BinaryLogStream::BigEndian;
+    if ((size < BinaryLogStream::HeaderSize) || (0 != memcmp(data, "EHBL", 4))
+            || (BinaryLogStream::Version != (uint8_t)data[4])) {
+        fprintf(stderr, "%s is not a version %u binary log\n", argv[1], (unsigned)BinaryLogStream::Version);
+        return 2;
+    }
+    if (hostOrder != (uint8_t)data[5]) {
+        fprintf(stderr, "%s was written with the other byte order\n", argv[1]);
+        return 2;
+    }
+    FILE *out = stdout;
+    if (3 == argc) {
+        out = fopen(argv[2], "w");
+        if (NULL == out) {
+            fprintf(stderr, "cannot create %s\n", argv[2]);
+            return 2;
+        }
+    }
+    int retval = decode(out, data, size);
+    if (stdout != out) {
+        fclose(out);
+    }
+    free(data);
+    return retval;
+}
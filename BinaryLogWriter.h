@@ -0,0 +1,376 @@
+/****************************************************************************
+ *   FILENAME: BinaryLogWriter.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Deferred (binary) logging:  format offline, on the host, instead of on target.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Even typed formatting (TypedFormat.h) costs a digit loop per number on the target.
+ *       For the highest-rate trace points, BINARY_LOG() writes only a format ID and the raw
+ *       argument bytes into the writer's buffer (via reserve() / commit(), no copy);
+ *       BinaryLogDecoder.cpp turns the file back into the text printf() would have written.
+ *
+ *       Each BINARY_LOG() call site owns a static BinaryLogFormat, which takes the next
+ *       format ID the first time the call site runs.  The first record of each format in a
+ *       file is preceded by a definition record carrying the format string and argument types,
+ *       so a file is self-describing:  no sidecar table, and call sites in code that is never
+ *       run cost no space.  Definitions are per file:  call begin() after setting a new file
+ *       on the writer (NOT after re-opening the same file, as with resetBytesWrittenTotal()).
+ *
+ *       Formats are checked against their arguments at compile time as for TYPED_PRINTF().
+ *
+ *       Stream layout (host byte order; the header records it and the decoder checks it):
+ *           header:      "EHBL", version (1 byte), byte order (1 = little endian),
+ *                        2 bytes reserved
+ *           definition:  tag 0xffff (2), format ID (2), argument count (1),
+ *                        format length (2), argument type codes, format string (no NUL)
+ *           record:      format ID (2), arguments
+ *       Arguments are packed without padding, by type code:
+ *           'i' / 'u':  32-bit signed / unsigned integer (integral types up to int promote)
+ *           'I' / 'U':  64-bit signed / unsigned integer
+ *           'f':        double (float promotes; long double is narrowed)
+ *           's':        string:  length (2; 0xffff for NULL) then bytes, no NUL
+ *           'p':        pointer, as 64-bit unsigned
+ *
+ *       A record (strings included) must fit in Writer::BufferSize bytes.  The Writer must
+ *       provide reserve() / commit() and writeFailed() (BasicBufferedFileWriter,
+ *       BasicDoubleBufferedFileWriter).
+ *
+ ****************************************************************************/
+
+#ifndef BINARY_LOG_WRITER_H
+#define BINARY_LOG_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include "TypedFormat.h"
+
+// Stream format constants shared with BinaryLogDecoder.cpp.
+struct BinaryLogStream
+{
+    static const size_t HeaderSize = 8;
+    static const uint8_t Version = 1;
+    static const uint8_t LittleEndian = 1;
+    static const uint8_t BigEndian = 2;
+    // Tag of a definition record; record tags below it are format IDs.
+    static const uint16_t DefinitionTag = 0xffff;
+    // String length meaning NULL string.
+    static const uint16_t NullString = 0xffff;
+    // Bytes of a definition record before the type codes and format string.
+    static const size_t DefinitionSize = 7;
+};
+
+// Encoding of one argument type; see file header for the type codes.
+template <class T, class Enable = void>
+struct BinaryLogArg;
+
+template <class T>
+struct BinaryLogArg<T, typename std::enable_if<std::is_integral<T>::value>::type>
+{
+    typedef decltype(+T()) Promoted;
+    static const bool IsSigned = std::is_signed<Promoted>::value;
+    typedef typename std::conditional<(sizeof(Promoted) <= 4),
+            typename std::conditional<IsSigned, int32_t, uint32_t>::type,
+            typename std::conditional<IsSigned, int64_t, uint64_t>::type>::type Stored;
+    static const char Code = (4 == sizeof(Stored)) ? (IsSigned ? 'i' : 'u') : (IsSigned ? 'I' : 'U');
+
+    static size_t size(T) { return sizeof(Stored); }
+
+    static char *store(char *dest, T value)
+    {
+        Stored stored = (Stored)value;
+        memcpy(dest, &stored, sizeof(stored));
+        return dest + sizeof(stored);
+    }
+};
+
+template <class T>
+struct BinaryLogArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static const char Code = 'f';
+
+    static size_t size(T) { return sizeof(double); }
+
+    static char *store(char *dest, T value)
+    {
+        double stored = (double)value;
+        memcpy(dest, &stored, sizeof(stored));
+        return dest + sizeof(stored);
+    }
+};
+
+template <class T>
+struct BinaryLogArg<T, typename std::enable_if<std::is_same<T, const char *>::value
+        || std::is_same<T, char *>::value>::type>
+{
+    static const char Code = 's';
+
+    // Strings longer than NullString - 1 are truncated.
+    static size_t length(const char *string)
+    {
+        size_t nChars = 0;
+        if (NULL != string) {
+            nChars = strlen(string);
+            if (nChars >= BinaryLogStream::NullString) {
+                nChars = BinaryLogStream::NullString - 1;
+            }
+        }
+        return nChars;
+    }
+
+    static size_t size(const char *string) { return sizeof(uint16_t) + length(string); }
+
+    static char *store(char *dest, const char *string)
+    {
+        uint16_t nChars = (NULL == string) ? BinaryLogStream::NullString : (uint16_t)length(string);
+        memcpy(dest, &nChars, sizeof(nChars));
+        dest += sizeof(nChars);
+        if (NULL != string) {
+            memcpy(dest, string, nChars);
+            dest += nChars;
+        }
+        return dest;
+    }
+};
+
+template <class T>
+struct BinaryLogArg<T, typename std::enable_if<(std::is_pointer<T>::value
+        && !std::is_same<T, const char *>::value && !std::is_same<T, char *>::value)
+        || std::is_same<T, std::nullptr_t>::value>::type>
+{
+    static const char Code = 'p';
+
+    static size_t size(T) { return sizeof(uint64_t); }
+
+    static char *store(char *dest, T pointer)
+    {
+        uint64_t stored = (uint64_t)(uintptr_t)pointer;
+        memcpy(dest, &stored, sizeof(stored));
+        return dest + sizeof(stored);
+    }
+};
+
+// NUL-terminated type codes of the (decayed) argument types Args.
+template <class... Args>
+struct BinaryLogSignature
+{
+    static constexpr char codes[sizeof...(Args) + 1] = { BinaryLogArg<Args>::Code..., '\0' };
+};
+
+template <class... Args>
+constexpr char BinaryLogSignature<Args...>::codes[sizeof...(Args) + 1];
+
+// Declared only, for decltype() in BINARY_LOG:  the signature of the given arguments.
+template <class... Args>
+BinaryLogSignature<typename std::decay<Args>::type...> binaryLogSignatureFor(const Args&... args);
+
+// One format string and its argument types, with the format ID taken on construction.
+// Instances are static, one per BINARY_LOG() call site.
+class BinaryLogFormat
+{
+public:
+    BinaryLogFormat(const char *_format, const char *_argCodes)
+        : format(_format), argCodes(_argCodes),
+          id(nextId().fetch_add(1, std::memory_order_relaxed)),
+          formatLength(strlen(_format)), argCount(strlen(_argCodes))
+    {
+    }
+
+    const char *    format;
+    const char *    argCodes;
+    // Format ID; IDs are never reused, and are only valid below the writer's MaxFormats.
+    const uint32_t  id;
+    const size_t    formatLength;
+    const size_t    argCount;
+
+private:
+    // Block copy-ctor, assignment operator.
+    BinaryLogFormat(const BinaryLogFormat &obj);
+    BinaryLogFormat& operator=(const BinaryLogFormat& obj);
+
+    static std::atomic<uint32_t> &nextId(void)
+    {
+        static std::atomic<uint32_t> counter(0);
+        return counter;
+    }
+};
+
+template <class Writer, size_t MaxFormats = 1024>
+class BinaryLogWriter
+{
+public:
+    enum WriteResult {
+        WriteNoFile = UINT32_MAX,           // Writer has no file
+        WriteTooLarge = UINT32_MAX - 1,     // Record larger than Writer::BufferSize; nothing written
+        WriteNoDefinition = UINT32_MAX - 2, // Writing the format's definition came up short; record not written
+        WriteNoFormatId = UINT32_MAX - 3    // Format ID not below MaxFormats; nothing written
+    };
+
+    static_assert(MaxFormats <= BinaryLogStream::DefinitionTag, "MaxFormats too large for 16-bit IDs");
+
+    explicit BinaryLogWriter(Writer &_writer);
+
+    // Start a new file:  write the stream header and forget which formats were defined.
+    // Call after setting a new file on the writer; not after re-opening the same file.
+    // Returns 0, or WriteNoFile.
+    uint32_t begin(void);
+
+    // Write one record of format, defining the format first if this file has not seen it.
+    // Use BINARY_LOG(log, fmt, ...), which supplies the static format for its call site.
+    // Returns Writer::commit() return code, or WriteNoFile, WriteTooLarge, WriteNoDefinition,
+    // WriteNoFormatId.  After WriteNoDefinition the format is defined again by its next record.
+    template <class... Args>
+    uint32_t record(const BinaryLogFormat &format, const Args&... args);
+
+    // Flush the writer.  Returns Writer::flush() return code.
+    uint32_t flush(void);
+
+private:
+    // Block copy-ctor, assignment operator.
+    BinaryLogWriter(const BinaryLogWriter &obj);
+    BinaryLogWriter& operator=(const BinaryLogWriter& obj);
+
+    // Write the definition record of format.  Return code as for record().
+    uint32_t define(const BinaryLogFormat &format);
+
+    static size_t argsSize(void) { return 0; }
+
+    template <class Arg, class... Rest>
+    static size_t argsSize(const Arg &arg, const Rest&... rest);
+
+    static char *pack(char *dest) { return dest; }
+
+    template <class Arg, class... Rest>
+    static char *pack(char *dest, const Arg &arg, const Rest&... rest);
+
+    Writer &    writer;
+    // Bit per format ID:  definition written to the current file.
+    uint32_t    defined[(MaxFormats + 31) / 32];
+};
+
+// Write one record through log (a BinaryLogWriter) after checking at compile time that the
+// literal fmt matches the arguments.  Returns BinaryLogWriter::record() return code.
+#define BINARY_LOG(log, fmt, ...) \
+    ([&]() -> uint32_t { \
+        static_assert(decltype(typedFormatCheckFor(__VA_ARGS__))::check(fmt), \
+                "BINARY_LOG format does not match its arguments"); \
+        static BinaryLogFormat binaryLogFormat(fmt, decltype(binaryLogSignatureFor(__VA_ARGS__))::codes); \
+        return (log).record(binaryLogFormat, ##__VA_ARGS__); \
+    }())
+
+
+template <class Writer, size_t MaxFormats>
+BinaryLogWriter<Writer, MaxFormats>::BinaryLogWriter(Writer &_writer)
+    : writer(_writer)
+{
+    memset(defined, 0, sizeof(defined));
+}
+
+template <class Writer, size_t MaxFormats>
+uint32_t BinaryLogWriter<Writer, MaxFormats>::begin(void)
+{
+    uint32_t retval = WriteNoFile;
+    memset(defined, 0, sizeof(defined));
+    char *dest = writer.reserve(BinaryLogStream::HeaderSize);
+    if (NULL != dest) {
+        const uint16_t endianProbe = 1;
+        memcpy(dest, "EHBL", 4);
+        dest[4] = (char)BinaryLogStream::Version;
+        dest[5] = (char)((1 == *reinterpret_cast<const uint8_t *>(&endianProbe))
+                ? BinaryLogStream::LittleEndian : BinaryLogStream::BigEndian);
+        dest[6] = 0;
+        dest[7] = 0;
+        writer.commit(BinaryLogStream::HeaderSize);
+        retval = 0;
+    }
+    return retval;
+}
+
+// Record is sized first, then reserved and packed in place.
+template <class Writer, size_t MaxFormats>
+template <class... Args>
+uint32_t BinaryLogWriter<Writer, MaxFormats>::record(const BinaryLogFormat &format, const Args&... args)
+{
+    uint32_t retval = 0;
+    if (format.id >= MaxFormats) {
+        retval = WriteNoFormatId;
+    } else if (0 == (defined[format.id / 32] & (1u << (format.id % 32)))) {
+        retval = define(format);
+    }
+    if (0 == retval) {
+        size_t size = sizeof(uint16_t) + argsSize(args...);
+        if (size > Writer::BufferSize) {
+            retval = WriteTooLarge;
+        } else {
+            char *dest = writer.reserve(size);
+            if (NULL == dest) {
+                retval = WriteNoFile;
+            } else {
+                uint16_t tag = (uint16_t)format.id;
+                memcpy(dest, &tag, sizeof(tag));
+                pack(dest + sizeof(tag), args...);
+                retval = writer.commit(size);
+            }
+        }
+    }
+    return retval;
+}
+
+template <class Writer, size_t MaxFormats>
+uint32_t BinaryLogWriter<Writer, MaxFormats>::flush(void)
+{
+    return writer.flush();
+}
+
+template <class Writer, size_t MaxFormats>
+uint32_t BinaryLogWriter<Writer, MaxFormats>::define(const BinaryLogFormat &format)
+{
+    uint32_t retval = 0;
+    size_t size = BinaryLogStream::DefinitionSize + format.argCount + format.formatLength;
+    if ((size > Writer::BufferSize) || (format.formatLength > UINT16_MAX) || (format.argCount > UINT8_MAX)) {
+        retval = WriteTooLarge;
+    } else {
+        char *dest = writer.reserve(size);
+        if (NULL == dest) {
+            retval = WriteNoFile;
+        } else {
+            uint16_t field = BinaryLogStream::DefinitionTag;
+            memcpy(dest, &field, sizeof(field));
+            field = (uint16_t)format.id;
+            memcpy(dest + 2, &field, sizeof(field));
+            dest[4] = (char)format.argCount;
+            field = (uint16_t)format.formatLength;
+            memcpy(dest + 5, &field, sizeof(field));
+            memcpy(dest + BinaryLogStream::DefinitionSize, format.argCodes, format.argCount);
+            memcpy(dest + BinaryLogStream::DefinitionSize + format.argCount, format.format, format.formatLength);
+            // A failure first reported by this commit may have lost the definition (the decoder
+            // accepts a format defined twice); one reported earlier was of data before it.
+            bool failedBefore = writer.writeFailed();
+            writer.commit(size);
+            if (!failedBefore && writer.writeFailed()) {
+                retval = WriteNoDefinition;
+            } else {
+                defined[format.id / 32] |= 1u << (format.id % 32);
+            }
+        }
+    }
+    return retval;
+}
+
+template <class Writer, size_t MaxFormats>
+template <class Arg, class... Rest>
+size_t BinaryLogWriter<Writer, MaxFormats>::argsSize(const Arg &arg, const Rest&... rest)
+{
+    return BinaryLogArg<typename std::decay<Arg>::type>::size(arg) + argsSize(rest...);
+}
+
+template <class Writer, size_t MaxFormats>
+template <class Arg, class... Rest>
+char *BinaryLogWriter<Writer, MaxFormats>::pack(char *dest, const Arg &arg, const Rest&... rest)
+{
+    return pack(BinaryLogArg<typename std::decay<Arg>::type>::store(dest, arg), rest...);
+}
+
+#endif //ndef BINARY_LOG_WRITER_H
@@ -0,0 +1,102 @@
+/****************************************************************************
+ *   FILENAME: BufferSizeBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  sweep of BasicBufferedFileWriter buffer size against write
+ *            throughput on a local file system.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  BufferSizeBench [-d <directory>] [-m <MiB>] [-r <record bytes>]
+ *       Defaults:  current directory, 256 MiB per buffer size, 100-byte records.  The output
+ *       file (bsbench.log) is deleted afterwards.
+ *
+ *       The same records are written through a BasicBufferedFileWriter on PosixFileBackend
+ *       with each buffer size from 512 bytes to 256 KiB; each flush is one write(2).  Reported
+ *       per buffer size:  MB/s including the final flush and close (not a sync, so the page
+ *       cache absorbs the data).  Exit code 1 if a file's size is wrong.
+ *
+ *       Builds for the host only (<chrono>, stat()); not part of the target image.
+ *       Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "PosixFileBackend.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t MaxRecordSize = 4096;
+
+static char record[MaxRecordSize + 64];
+
+// Write total bytes as records of recordSize to path through a writer with a BufSize
+// buffer; prints one result line.  Returns false if the file is not total bytes long.
+template <size_t BufSize>
+static bool sweepOne(const char *path, size_t recordSize, size_t total)
+{
+    // Static:  the larger buffers do not belong on the stack.
+    static BasicBufferedFileWriter<BufSize, 256, PosixFileBackend> writer;
+    PosixFileBackend::Handle file = PosixFileBackend::open(path);
+    if (PosixFileBackend::noFile() == file) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return false;
+    }
+    size_t records = total / recordSize;
+    Clock::time_point start = Clock::now();
+    writer.setFile(file);
+    for (size_t i = 0; i < records; ++i) {
+        writer.write(record + (i & 63), recordSize);
+    }
+    writer.flush();
+    writer.setFile(PosixFileBackend::noFile());
+    PosixFileBackend::close(file);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    struct stat status;
+    bool retval = (0 == stat(path, &status)) && ((size_t)status.st_size == records * recordSize);
+    printf("%9lu %10.0f%s\n", (unsigned long)BufSize, (double)(records * recordSize) / seconds / 1e6,
+            retval ? "" : "  FILE SIZE MISMATCH");
+    PosixFileBackend::remove(path);
+    return retval;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = ".";
+    size_t mebibytes = 256;
+    size_t recordSize = 100;
+    for (int arg = 1; arg < argc; ++arg) {
+        if ((0 == strcmp(argv[arg], "-d")) && (arg + 1 < argc)) {
+            directory = argv[++arg];
+        } else if ((0 == strcmp(argv[arg], "-m")) && (arg + 1 < argc)) {
+            mebibytes = strtoul(argv[++arg], NULL, 0);
+        } else if ((0 == strcmp(argv[arg], "-r")) && (arg + 1 < argc)) {
+            recordSize = strtoul(argv[++arg], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-d <directory>] [-m <MiB>] [-r <record bytes>]\n", argv[0]);
+            return 2;
+        }
+    }
+    if ((0 == mebibytes) || (0 == recordSize) || (recordSize > MaxRecordSize)) {
+        fprintf(stderr, "record bytes:  1 to %lu\n", (unsigned long)MaxRecordSize);
+        return 2;
+    }
+    for (size_t i = 0; i < sizeof(record); ++i) {
+        record[i] = (char)(((i % 80) == 79) ? '\n' : ('a' + i % 26));
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/bsbench.log", directory);
+    size_t total = mebibytes * 1024 * 1024;
+    printf("%lu MiB of %lu-byte records to %s\n", (unsigned long)mebibytes, (unsigned long)recordSize, path);
+    printf("   buffer       MB/s\n");
+    bool ok = sweepOne<512>(path, recordSize, total);
+    ok = sweepOne<1024>(path, recordSize, total) && ok;
+    ok = sweepOne<4096>(path, recordSize, total) && ok;
+    ok = sweepOne<16384>(path, recordSize, total) && ok;
+    ok = sweepOne<65536>(path, recordSize, total) && ok;
+    ok = sweepOne<262144>(path, recordSize, total) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+/****************************************************************************
+ *   FILENAME: CompressedLogDecoder.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  decompress a file written through CompressingBackend.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  CompressedLogDecoder [-l] [-s <offset>] [-n <bytes>] <compressed log> [<output>]
+ *           -l              list the frames (file offset, logical offset, sizes) instead
+ *           -s <offset>     start at this logical (uncompressed) offset
+ *           -n <bytes>      write at most this many bytes
+ *       Default output:  stdout.
+ *
+ *       Seeking skips from frame header to frame header (each holds its logical offset and
+ *       sizes, see CompressingBackend.h) and decompresses only the frames that overlap the
+ *       requested range.
+ *
+ *       A damaged frame (bad header, bad block) is reported on stderr and skipped:  the
+ *       decoder searches forward for the next plausible frame header.  A file cut short
+ *       (e.g. by power loss) decodes up to its last complete frame.  Gaps in the logical
+ *       offsets (lost frames) are reported.  Exit code 1 if anything was damaged.
+ *
+ *       Builds for the host only (uses malloc(), stdio); not part of the target image.
+ *       Link with Lz4Block.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CompressingBackend.h"
+#include "Lz4Block.h"
+
+// Largest frame accepted as plausible when searching past damage.
+static const uint32_t MaxRawSize = 1u << 30;
+
+// Read whole file into a malloc()'d buffer.  Returns NULL on failure.
+static char *readFile(const char *path, size_t *size)
+{
+    char *data = NULL;
+    FILE *file = fopen(path, "rb");
+    if (NULL != file) {
+        if ((0 == fseek(file, 0, SEEK_END)) && (ftell(file) >= 0)) {
+            *size = (size_t)ftell(file);
+            rewind(file);
+            data = (char *)malloc(*size + 1);
+            if ((NULL != data) && (fread(data, 1, *size, file) != *size)) {
+                free(data);
+                data = NULL;
+            }
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+// Header at pos is a frame that fits in the file.
+static bool frameAt(const char *data, size_t size, size_t pos, CompressedFrameHeader &header)
+{
+    return (pos + CompressedFrameHeader::Size <= size) && header.load(data + pos)
+            && (header.rawSize <= MaxRawSize) && (header.flags <= CompressedFrameHeader::FrameStored)
+            && (header.storedSize <= header.rawSize)
+            && (size - pos - CompressedFrameHeader::Size >= header.storedSize);
+}
+
+// Decode (or list) frames overlapping [start, start + count).  Returns exit code.
+static int decode(FILE *out, const char *data, size_t size, bool list, uint64_t start, uint64_t count)
+{
+    int retval = 0;
+    char *raw = NULL;
+    size_t rawCapacity = 0;
+    uint64_t expected = 0;          // Logical offset the next frame should have
+    bool first = true;
+    uint64_t end = (count > UINT64_MAX - start) ? UINT64_MAX : start + count;
+    size_t pos = 0;
+    while (pos < size) {
+        CompressedFrameHeader header;
+        if (!frameAt(data, size, pos, header)) {
+            size_t damaged = pos;
+            do {
+                ++pos;
+            } while ((pos < size) && !frameAt(data, size, pos, header));
+            fprintf(stderr, "%s at offset %lu of %lu%s\n", (pos < size) ? "damaged data" : "log truncated or damaged",
+                    (unsigned long)damaged, (unsigned long)size, (pos < size) ? ", skipped" : "");
+            retval = 1;
+            if (pos >= size) {
+                break;
+            }
+        }
+        if (!first && (header.offset != expected)) {
+            fprintf(stderr, "frame at offset %lu has logical offset %llu, expected %llu\n", (unsigned long)pos,
+                    (unsigned long long)header.offset, (unsigned long long)expected);
+            retval = 1;
+        }
+        first = false;
+        expected = header.offset + header.rawSize;
+        const char *payload = data + pos + CompressedFrameHeader::Size;
+        size_t frameEnd = pos + CompressedFrameHeader::Size + header.storedSize;
+
+        if (list) {
+            fprintf(out, "%12lu %14llu %10u %10u%s\n", (unsigned long)pos, (unsigned long long)header.offset,
+                    (unsigned)header.rawSize, (unsigned)header.storedSize,
+                    (0 != (header.flags & CompressedFrameHeader::FrameStored)) ? " stored" : "");
+        } else if ((header.offset + header.rawSize > start) && (header.offset < end)) {
+            const char *text = payload;
+            if (0 == (header.flags & CompressedFrameHeader::FrameStored)) {
+                if (rawCapacity < header.rawSize) {
+                    free(raw);
+                    rawCapacity = header.rawSize;
+                    raw = (char *)malloc(rawCapacity);
+                }
+                if ((NULL == raw) || !Lz4Block::decompress(payload, header.storedSize, raw, header.rawSize)) {
+                    fprintf(stderr, "damaged frame at offset %lu, skipped\n", (unsigned long)pos);
+                    retval = 1;
+                    pos = frameEnd;
+                    continue;
+                }
+                text = raw;
+            }
+            uint64_t from = (start > header.offset) ? start - header.offset : 0;
+            uint64_t to = (end - header.offset < header.rawSize) ? end - header.offset : header.rawSize;
+            fwrite(text + from, 1, (size_t)(to - from), out);
+        }
+        pos = frameEnd;
+    }
+    free(raw);
+    return retval;
+}
+
+int main(int argc, char *argv[])
+{
+    bool list = false;
+    uint64_t start = 0;
+    uint64_t count = UINT64_MAX;
+    int arg = 1;
+    for (; (arg < argc) && ('-' == argv[arg][0]) && ('\0' != argv[arg][1]); ++arg) {
+        if (0 == strcmp(argv[arg], "-l")) {
+            list = true;
+        } else if ((0 == strcmp(argv[arg], "-s")) && (arg + 1 < argc)) {
+            start = strtoull(argv[++arg], NULL, 0);
+        } else if ((0 == strcmp(argv[arg], "-n")) && (arg + 1 < argc)) {
+            count = strtoull(argv[++arg], NULL, 0);
+        } else {
+            break;
+        }
+    }
+    if ((argc - arg < 1) || (argc - arg > 2)) {
+        fprintf(stderr, "usage: %s [-l] [-s <offset>] [-n <bytes>] <compressed log> [<output>]\n", argv[0]);
+        return 2;
+    }
+    size_t size = 0;
+    char *data = readFile(argv[arg], &size);
+    if (NULL == data) {
+        fprintf(stderr, "cannot read %s\n", argv[arg]);
+        return 2;
+    }
+    FILE *out = stdout;
+    if (argc - arg == 2) {
+        out = fopen(argv[arg + 1], list ? "w" : "wb");
+        if (NULL == out) {
+            fprintf(stderr, "cannot create %s\n", argv[arg + 1]);
+            return 2;
+        }
+    }
+    if (list) {
+        fprintf(out, "%12s %14s %10s %10s\n", "file offset", "logical offset", "raw", "stored");
+    }
+    int retval = decode(out, data, size, list, start, count);
+    if (stdout != out) {
+        fclose(out);
+    }
+    free(data);
+    return retval;
+}
@@ -0,0 +1,321 @@
+/****************************************************************************
+ *   FILENAME: CompressingBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Compression stage between the buffered file writers and their storage backend.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       CompressingBackend<Backend> is a backend for the writers whose handle is a
+ *       CompressedFile wrapping a file of Backend.  Each write() (normally one full writer
+ *       buffer) is compressed (Lz4Block) into one or more independent frames of at most
+ *       FrameSize input bytes, and each frame reaches Backend::write() as one write.  Data
+ *       that does not compress is stored as is, so a frame never exceeds FrameSize plus the
+ *       header.  Choose FrameSize >= the writer's BufferSize, so one flush is one frame.
+ *
+ *       Frame format (little endian):  CompressedFrameHeader (24 bytes), then storedSize
+ *       bytes of payload:  an LZ4 block, or the raw bytes if flags has FrameStored.
+ *       Frames are independent (no dictionary carried over), and each header holds the
+ *       logical (uncompressed) offset of its first byte, so a reader can seek by skipping
+ *       from header to header without decompressing, and a damaged frame loses only its own
+ *       data.  CompressedLogDecoder.cpp is the host tool that decodes (and seeks) these files.
+ *
+ *       Counts:  the writers' getBytesWrittenTotal() stays logical (uncompressed).  The
+ *       CompressedFile counts both, getLogicalBytes() and getStoredBytes() (physical, headers
+ *       included), since attach().  RotatingFileWriter can rotate on the stored size with
+ *       setSizeFunction(CompressingBackend::storedSize).  Stored bytes grow per flush, not
+ *       per record.  The counts are atomic (relaxed), since with a DoubleBufferedFileWriter
+ *       they grow on the flusher thread while the writing thread reads them:  the stored size
+ *       then lags the records written by up to BufCount buffers, so a rotated file can end
+ *       up that much over the limit.
+ *
+ *       setFlushAlignment() aligns logical offsets; with compression the physical offsets
+ *       are not aligned, so leave it off.  Gathered writes are not passed through.  Open /
+ *       close / remove, sync and reserve / trim are passed through when Backend has them;
+ *       open() takes a CompressedFile from a static pool of MaxFiles (RotatingFileWriter
+ *       needs 3:  current, spare, retired).
+ *
+ *       A CompressedFile holds the compressor's hash table and a frame buffer, about
+ *       16k + FrameSize bytes; static instances recommended.  One thread writes a file at a
+ *       time (the writer's thread, or a DoubleBufferedFileWriter's flusher thread, which then
+ *       also takes the compression off the writing thread).
+ *
+ ****************************************************************************/
+
+#ifndef COMPRESSING_BACKEND_H
+#define COMPRESSING_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include "FileBackend.h"
+#include "Lz4Block.h"
+
+// Frame header, stored little endian.
+struct CompressedFrameHeader
+{
+    enum {
+        Magic = 0x315a4c43,             // "CLZ1"
+        FrameStored = 1                 // flags:  payload is the raw bytes
+    };
+    static const size_t Size = 24;
+
+    uint32_t    magic;
+    uint32_t    rawSize;                // Uncompressed bytes in the frame
+    uint32_t    storedSize;             // Payload bytes after the header
+    uint32_t    flags;
+    uint64_t    offset;                 // Logical offset of the frame's first byte
+
+    // Write header to dest (Size bytes).
+    void store(char *dest) const
+    {
+        uint8_t *p = (uint8_t *)dest;
+        storeLe(p, magic, 4);
+        storeLe(p + 4, rawSize, 4);
+        storeLe(p + 8, storedSize, 4);
+        storeLe(p + 12, flags, 4);
+        storeLe(p + 16, offset, 8);
+    }
+
+    // Read header from src (Size bytes).  Returns false if the magic number is wrong.
+    bool load(const char *src)
+    {
+        const uint8_t *p = (const uint8_t *)src;
+        magic = (uint32_t)loadLe(p, 4);
+        rawSize = (uint32_t)loadLe(p + 4, 4);
+        storedSize = (uint32_t)loadLe(p + 8, 4);
+        flags = (uint32_t)loadLe(p + 12, 4);
+        offset = loadLe(p + 16, 8);
+        return Magic == magic;
+    }
+
+private:
+    static void storeLe(uint8_t *p, uint64_t value, size_t nBytes)
+    {
+        for (size_t i = 0; i < nBytes; ++i) {
+            p[i] = (uint8_t)(value >> (8 * i));
+        }
+    }
+
+    static uint64_t loadLe(const uint8_t *p, size_t nBytes)
+    {
+        uint64_t value = 0;
+        for (size_t i = 0; i < nBytes; ++i) {
+            value |= (uint64_t)p[i] << (8 * i);
+        }
+        return value;
+    }
+};
+
+template <class Backend, size_t FrameSize = 65536>
+class CompressedFile
+{
+public:
+    // Largest frame written:  header plus FrameSize (stored) bytes.
+    static const size_t MaxFrameBytes = CompressedFrameHeader::Size + FrameSize;
+
+    CompressedFile(void);
+
+    // Write frames to file (opened for write).  logicalStart:  logical offset of the first
+    // byte (0 for a new file; the decoded length when appending).  Clears the counts.
+    void attach(typename Backend::Handle _file, uint64_t logicalStart = 0);
+
+    // Stop writing to the file.  Returns it.
+    typename Backend::Handle detach(void);
+
+    typename Backend::Handle getFile(void) { return file; }
+
+    // Backend write:  compress data into frames.  Returns nChars if every frame was written
+    // in full, otherwise the input bytes of the frames before the first short one (no frame
+    // is written after it).
+    uint32_t write(const char *data, size_t nChars);
+
+    // Uncompressed bytes written since attach().
+    uint64_t getLogicalBytes(void) { return logicalBytes.load(std::memory_order_relaxed); }
+
+    // Bytes passed to Backend::write() since attach(), headers included.
+    uint64_t getStoredBytes(void) { return storedBytes.load(std::memory_order_relaxed); }
+
+private:
+    // Block copy-ctor, assignment operator.
+    CompressedFile(const CompressedFile &obj);
+    CompressedFile& operator=(const CompressedFile& obj);
+
+    typename Backend::Handle file;
+    uint64_t    logicalOffset;
+    // Written by the writing thread only; read from any thread
+    std::atomic<uint64_t> logicalBytes;
+    std::atomic<uint64_t> storedBytes;
+    uint32_t    table[Lz4Block::HashSize];
+    alignas(Backend::BufferAlignment) char frame[MaxFrameBytes];
+};
+
+template <class Backend, size_t FrameSize = 65536, size_t MaxFiles = 4>
+struct CompressingBackend : public FileBackendDefaults
+{
+    typedef CompressedFile<Backend, FrameSize> * Handle;
+
+    static const bool SupportsOpen = Backend::SupportsOpen;
+    static const bool SupportsSync = Backend::SupportsSync;
+    static const bool SupportsReserve = Backend::SupportsReserve;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Returns input bytes consumed; fewer than nChars if a frame write came up short.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return file->write(data, nChars);
+    }
+
+    // Backend::open(), attached to a free pooled CompressedFile.  noFile() if either fails.
+    static Handle open(const char *name)
+    {
+        Handle retval = NULL;
+        typename Backend::Handle inner = Backend::open(name);
+        if (Backend::noFile() != inner) {
+            std::lock_guard<std::mutex> guard(poolLock());
+            for (size_t i = 0; (i < MaxFiles) && (NULL == retval); ++i) {
+                if (!poolUsed()[i]) {
+                    poolUsed()[i] = true;
+                    retval = &pool()[i];
+                }
+            }
+        }
+        if (NULL != retval) {
+            retval->attach(inner);
+        } else if (Backend::noFile() != inner) {
+            Backend::close(inner);
+        }
+        return retval;
+    }
+
+    // Backend::close(); a pooled CompressedFile goes back to the pool.
+    static void close(Handle file)
+    {
+        Backend::close(file->detach());
+        std::lock_guard<std::mutex> guard(poolLock());
+        for (size_t i = 0; i < MaxFiles; ++i) {
+            if (file == &pool()[i]) {
+                poolUsed()[i] = false;
+            }
+        }
+    }
+
+    static bool remove(const char *name)
+    {
+        return Backend::remove(name);
+    }
+
+    static bool sync(Handle file)
+    {
+        return BackendSync<Backend>::sync(file->getFile());
+    }
+
+    // nBytes is logical; reserving that much physical space over-reserves, never under.
+    static bool reserve(Handle file, size_t nBytes)
+    {
+        return BackendReserve<Backend>::reserve(file->getFile(), nBytes);
+    }
+
+    static bool trim(Handle file)
+    {
+        return BackendReserve<Backend>::trim(file->getFile());
+    }
+
+    // RotatingFileWriter::SizeFunction:  stored (compressed) size of file.
+    static size_t storedSize(Handle file, void *context)
+    {
+        (void)context;
+        return (size_t)file->getStoredBytes();
+    }
+
+private:
+    // Pool for open(); function-local statics, so it only exists if open() is used.
+    static CompressedFile<Backend, FrameSize> *pool(void)
+    {
+        static CompressedFile<Backend, FrameSize> files[MaxFiles];
+        return files;
+    }
+
+    static bool *poolUsed(void)
+    {
+        static bool used[MaxFiles];
+        return used;
+    }
+
+    static std::mutex &poolLock(void)
+    {
+        static std::mutex lock;
+        return lock;
+    }
+};
+
+
+template <class Backend, size_t FrameSize>
+CompressedFile<Backend, FrameSize>::CompressedFile(void)
+    : file(Backend::noFile()), logicalOffset(0), logicalBytes(0), storedBytes(0)
+{
+    memset(table, 0, sizeof(table));
+}
+
+template <class Backend, size_t FrameSize>
+void CompressedFile<Backend, FrameSize>::attach(typename Backend::Handle _file, uint64_t logicalStart)
+{
+    file = _file;
+    logicalOffset = logicalStart;
+    logicalBytes.store(0, std::memory_order_relaxed);
+    storedBytes.store(0, std::memory_order_relaxed);
+}
+
+template <class Backend, size_t FrameSize>
+typename Backend::Handle CompressedFile<Backend, FrameSize>::detach(void)
+{
+    typename Backend::Handle retval = file;
+    file = Backend::noFile();
+    return retval;
+}
+
+// Compress straight into the frame buffer after the header space; if the block would not be
+// smaller than the input, store the input instead.  After a short frame the rest of the input
+// is dropped, but its logical offsets are still used up, so the decoder sees the gap.
+template <class Backend, size_t FrameSize>
+uint32_t CompressedFile<Backend, FrameSize>::write(const char *data, size_t nChars)
+{
+    uint32_t retval = 0;
+    bool ok = true;
+    while (ok && (nChars > 0)) {
+        size_t chunk = (nChars < FrameSize) ? nChars : FrameSize;
+        char *payload = frame + CompressedFrameHeader::Size;
+        CompressedFrameHeader header;
+        header.magic = CompressedFrameHeader::Magic;
+        header.rawSize = (uint32_t)chunk;
+        header.offset = logicalOffset;
+        size_t compressed = Lz4Block::compress(data, chunk, payload, chunk - 1, table);
+        if (0 != compressed) {
+            header.storedSize = (uint32_t)compressed;
+            header.flags = 0;
+        } else {
+            memcpy(payload, data, chunk);
+            header.storedSize = (uint32_t)chunk;
+            header.flags = CompressedFrameHeader::FrameStored;
+        }
+        header.store(frame);
+        size_t frameBytes = CompressedFrameHeader::Size + header.storedSize;
+        ok = (Backend::write(file, frame, frameBytes) == frameBytes);
+        if (ok) {
+            storedBytes.store(storedBytes.load(std::memory_order_relaxed) + frameBytes, std::memory_order_relaxed);
+            logicalBytes.store(logicalBytes.load(std::memory_order_relaxed) + chunk, std::memory_order_relaxed);
+            logicalOffset += chunk;
+            retval += (uint32_t)chunk;
+            data += chunk;
+            nChars -= chunk;
+        } else {
+            logicalOffset += nChars;
+        }
+    }
+    return retval;
+}
+
+#endif //ndef COMPRESSING_BACKEND_H
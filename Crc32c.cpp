@@ -0,0 +1,241 @@
+/****************************************************************************
+ *   FILENAME: Crc32c.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: CRC-32C (Castagnoli) for the checksummed log blocks.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       See .h file.
+ *
+ *       Slicing-by-8:  table k maps a byte to its CRC contribution k bytes further on, so 8
+ *       bytes are folded with 8 independent lookups.  The 8-byte loads assume little endian,
+ *       as does Lz4Block.cpp.
+ ****************************************************************************/
+
+#include <string.h>
+#include "Crc32c.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define CRC32C_HW 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_HW 1
+#elif defined(__x86_64__) && defined(__GNUC__)
+#define CRC32C_HW_DISPATCH 1
+#endif
+
+#if !defined(CRC32C_HW)
+static const uint32_t Polynomial = 0x82f63b78;     // Reflected Castagnoli polynomial
+
+struct Crc32cTables
+{
+    uint32_t    table[8][256];
+
+    Crc32cTables(void)
+    {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? Polynomial : 0);
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (int k = 1; k < 8; ++k) {
+                table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+// crc is the running (inverted) register value.
+static uint32_t updateTable(uint32_t crc, const uint8_t *p, size_t nBytes)
+{
+    static const Crc32cTables tables;
+    const uint32_t (*t)[256] = tables.table;
+    for (; nBytes >= 8; p += 8, nBytes -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff]
+                ^ t[4][(word >> 24) & 0xff] ^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff]
+                ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+    }
+    for (; nBytes > 0; ++p, --nBytes) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+    }
+    return crc;
+}
+#endif
+
+#if defined(CRC32C_HW) || defined(CRC32C_HW_DISPATCH)
+// The crc32 instruction takes 3 cycles but can start every cycle, so long data is done as
+// three interleaved streams of LongBlock (then ShortBlock) bytes; the first two streams' CRCs
+// are then moved past the data after them with a "shift" table (the CRC of appending that
+// many zero bytes, as a linear operator over GF(2)) and combined.  After Mark Adler's
+// crc32c.c.
+static const size_t LongBlock = 8192;
+static const size_t ShortBlock = 256;
+
+struct Crc32cShiftTables
+{
+    uint32_t    longShift[4][256];
+    uint32_t    shortShift[4][256];
+
+    Crc32cShiftTables(void)
+    {
+        build(longShift, LongBlock);
+        build(shortShift, ShortBlock);
+    }
+
+    static uint32_t times(const uint32_t *matrix, uint32_t vector)
+    {
+        uint32_t sum = 0;
+        for (; 0 != vector; vector >>= 1, ++matrix) {
+            if (vector & 1) {
+                sum ^= *matrix;
+            }
+        }
+        return sum;
+    }
+
+    static void square(uint32_t *result, const uint32_t *matrix)
+    {
+        for (int n = 0; n < 32; ++n) {
+            result[n] = times(matrix, matrix[n]);
+        }
+    }
+
+    // Table of the operator appending nBytes (a power of two) zero bytes.
+    static void build(uint32_t table[4][256], size_t nBytes)
+    {
+        uint32_t even[32];
+        uint32_t odd[32];
+        odd[0] = 0x82f63b78;            // One zero bit
+        for (int n = 1; n < 32; ++n) {
+            odd[n] = 1u << (n - 1);
+        }
+        square(even, odd);              // Two zero bits
+        square(odd, even);              // Four zero bits
+        const uint32_t *op = even;
+        for (;;) {
+            square(even, odd);          // Next square:  one zero byte, then 2, 4, ...
+            op = even;
+            nBytes >>= 1;
+            if (0 == nBytes) {
+                break;
+            }
+            square(odd, even);
+            op = odd;
+            nBytes >>= 1;
+            if (0 == nBytes) {
+                break;
+            }
+        }
+        for (uint32_t n = 0; n < 256; ++n) {
+            for (int k = 0; k < 4; ++k) {
+                table[k][n] = times(op, n << (8 * k));
+            }
+        }
+    }
+
+    static uint32_t shift(const uint32_t table[4][256], uint32_t crc)
+    {
+        return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^ table[2][(crc >> 16) & 0xff]
+                ^ table[3][crc >> 24];
+    }
+};
+
+#if defined(CRC32C_HW_DISPATCH)
+__attribute__((target("sse4.2")))
+#endif
+static inline uint32_t crcWord(uint32_t crc, const uint8_t *p)
+{
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+#if defined(__ARM_FEATURE_CRC32)
+    return __crc32cd(crc, word);
+#elif defined(CRC32C_HW_DISPATCH)
+    return (uint32_t)__builtin_ia32_crc32di(crc, word);
+#else
+    return (uint32_t)_mm_crc32_u64(crc, word);
+#endif
+}
+
+#if defined(CRC32C_HW_DISPATCH)
+__attribute__((target("sse4.2")))
+#endif
+static uint32_t updateHardware(uint32_t crc, const uint8_t *p, size_t nBytes)
+{
+    static const Crc32cShiftTables tables;
+    while (nBytes >= 3 * LongBlock) {
+        uint32_t crc1 = 0;
+        uint32_t crc2 = 0;
+        for (const uint8_t *end = p + LongBlock; p < end; p += 8) {
+            crc = crcWord(crc, p);
+            crc1 = crcWord(crc1, p + LongBlock);
+            crc2 = crcWord(crc2, p + 2 * LongBlock);
+        }
+        crc = Crc32cShiftTables::shift(tables.longShift, crc) ^ crc1;
+        crc = Crc32cShiftTables::shift(tables.longShift, crc) ^ crc2;
+        p += 2 * LongBlock;
+        nBytes -= 3 * LongBlock;
+    }
+    while (nBytes >= 3 * ShortBlock) {
+        uint32_t crc1 = 0;
+        uint32_t crc2 = 0;
+        for (const uint8_t *end = p + ShortBlock; p < end; p += 8) {
+            crc = crcWord(crc, p);
+            crc1 = crcWord(crc1, p + ShortBlock);
+            crc2 = crcWord(crc2, p + 2 * ShortBlock);
+        }
+        crc = Crc32cShiftTables::shift(tables.shortShift, crc) ^ crc1;
+        crc = Crc32cShiftTables::shift(tables.shortShift, crc) ^ crc2;
+        p += 2 * ShortBlock;
+        nBytes -= 3 * ShortBlock;
+    }
+    for (; nBytes >= 8; p += 8, nBytes -= 8) {
+        crc = crcWord(crc, p);
+    }
+    for (; nBytes > 0; ++p, --nBytes) {
+#if defined(__ARM_FEATURE_CRC32)
+        crc = __crc32cb(crc, *p);
+#elif defined(CRC32C_HW_DISPATCH)
+        crc = __builtin_ia32_crc32qi(crc, *p);
+#else
+        crc = _mm_crc32_u8(crc, *p);
+#endif
+    }
+    return crc;
+}
+#endif
+
+#if defined(CRC32C_HW_DISPATCH)
+static bool cpuHasCrc(void)
+{
+    static const bool hasCrc = __builtin_cpu_supports("sse4.2");
+    return hasCrc;
+}
+#endif
+
+uint32_t Crc32c::update(uint32_t crc, const void *data, size_t nBytes)
+{
+    const uint8_t *p = (const uint8_t *)data;
+#if defined(CRC32C_HW)
+    return ~updateHardware(~crc, p, nBytes);
+#elif defined(CRC32C_HW_DISPATCH)
+    return cpuHasCrc() ? ~updateHardware(~crc, p, nBytes) : ~updateTable(~crc, p, nBytes);
+#else
+    return ~updateTable(~crc, p, nBytes);
+#endif
+}
+
+bool Crc32c::isAccelerated(void)
+{
+#if defined(CRC32C_HW)
+    return true;
+#elif defined(CRC32C_HW_DISPATCH)
+    return cpuHasCrc();
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,36 @@
+/****************************************************************************
+ *   FILENAME: Crc32c.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: CRC-32C (Castagnoli) for the checksummed log blocks.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       CRC-32C rather than the zlib CRC-32 because x86 (SSE4.2 crc32) and ARMv8 (crc32c*)
+ *       compute it in hardware, 8 bytes per instruction, so checksumming every flushed block
+ *       costs next to nothing on the server build.  Elsewhere a slicing-by-8 table version
+ *       (8k of tables, built on first use) does 8 bytes per step.
+ *
+ *       The hardware version is chosen at compile time (__SSE4_2__, __ARM_FEATURE_CRC32)
+ *       and, on x86-64 builds with GCC or clang without -msse4.2, at run time from the CPU.
+ *
+ *       Standard CRC-32C (reflected, initial value and final XOR 0xffffffff):
+ *       update(0, "123456789", 9) == 0xe3069283.
+ *
+ ****************************************************************************/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Crc32c
+{
+public:
+    // CRC of nBytes of data, continuing crc (0 to start; the result of a previous update() to
+    // continue over more data).  Defined in Crc32c.cpp.
+    static uint32_t update(uint32_t crc, const void *data, size_t nBytes);
+
+    // True if update() uses the CPU's CRC instructions.  Defined in Crc32c.cpp.
+    static bool isAccelerated(void);
+};
+
+#endif //ndef CRC32C_H
@@ -0,0 +1,300 @@
+/****************************************************************************
+ *   FILENAME: CrcFramedBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Checksummed block framing between the buffered file writers and their backend.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       After a power failure during a flush, a log can hold a torn block (part new data,
+ *       part old sectors or zeros) with nothing to tell where the valid data ends.
+ *       CrcFramedBackend<Backend> is a backend for the writers whose handle is a
+ *       CrcFramedFile wrapping a file of Backend.  Each write() (normally one writer flush)
+ *       becomes one block:  a CrcBlockHeader (16 bytes) then the data.  The header holds the
+ *       length, a sequence number (consecutive within the file) and the CRC-32C (Crc32c.h,
+ *       hardware accelerated where the CPU has it) of length, sequence and data.  A block is
+ *       valid only if its magic number, length and CRC check out and its sequence number
+ *       follows the previous block's, so a torn block, a stale block left over from earlier
+ *       contents of the media and a block out of place are all detected.
+ *       FramedLogRecover.cpp is the host tool that checks a file and cuts it back to its last
+ *       valid block (or extracts the data).
+ *
+ *       With a Backend that supports gathered writes the header and the writer's buffer go
+ *       out in one writev(), with no copy; otherwise a block is copied behind its header into
+ *       the CrcFramedFile's buffer (BlockSize bytes, larger writes become several blocks),
+ *       so that header and data still reach the media in one write.
+ *
+ *       The writers' getBytesWrittenTotal() stays the data count; the CrcFramedFile counts
+ *       the bytes stored (headers included), for RotatingFileWriter's
+ *       setSizeFunction(CrcFramedBackend::storedSize).  The count is atomic (relaxed):  with a
+ *       DoubleBufferedFileWriter it grows on the flusher thread, so it lags the records
+ *       written by up to BufCount buffers.  setFlushAlignment() aligns the data, not the
+ *       blocks, so leave it off.  Gathered writes from the writers are not passed through
+ *       (a writer's large write() is its flush plus one block).  Open / close / remove, sync
+ *       and reserve / trim are passed through when Backend has them; open() takes a
+ *       CrcFramedFile from a static pool of MaxFiles (RotatingFileWriter needs 3).  One thread
+ *       writes a file at a time.
+ *
+ ****************************************************************************/
+
+#ifndef CRC_FRAMED_BACKEND_H
+#define CRC_FRAMED_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include "Crc32c.h"
+#include "FileBackend.h"
+
+// Block header, stored little endian.
+struct CrcBlockHeader
+{
+    enum {
+        Magic = 0x31424643              // "CFB1"
+    };
+    static const size_t Size = 16;
+
+    uint32_t    magic;
+    uint32_t    length;                 // Data bytes after the header
+    uint32_t    sequence;               // Previous block's + 1
+    uint32_t    crc;                    // CRC-32C of length, sequence (as stored) and data
+
+    // Write header to dest (Size bytes), with crc computed over data.
+    void store(char *dest, const char *data)
+    {
+        uint8_t *p = (uint8_t *)dest;
+        storeLe(p, magic);
+        storeLe(p + 4, length);
+        storeLe(p + 8, sequence);
+        crc = Crc32c::update(Crc32c::update(0, p + 4, 8), data, length);
+        storeLe(p + 12, crc);
+    }
+
+    // Read header from src (Size bytes).  Returns false if the magic number is wrong.
+    bool load(const char *src)
+    {
+        const uint8_t *p = (const uint8_t *)src;
+        magic = loadLe(p);
+        length = loadLe(p + 4);
+        sequence = loadLe(p + 8);
+        crc = loadLe(p + 12);
+        return Magic == magic;
+    }
+
+    // Header (as stored at src) and length data bytes at data have a matching CRC.
+    bool check(const char *src, const char *data) const
+    {
+        return crc == Crc32c::update(Crc32c::update(0, src + 4, 8), data, length);
+    }
+
+private:
+    static void storeLe(uint8_t *p, uint32_t value)
+    {
+        p[0] = (uint8_t)value;
+        p[1] = (uint8_t)(value >> 8);
+        p[2] = (uint8_t)(value >> 16);
+        p[3] = (uint8_t)(value >> 24);
+    }
+
+    static uint32_t loadLe(const uint8_t *p)
+    {
+        return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+};
+
+template <class Backend, size_t BlockSize = 65536>
+class CrcFramedFile
+{
+public:
+    CrcFramedFile(void);
+
+    // Write blocks to file (opened for write), numbered from firstSequence (0 for a new
+    // file; the next number after the last valid block when appending).  Clears the count.
+    void attach(typename Backend::Handle _file, uint32_t firstSequence = 0);
+
+    // Stop writing to the file.  Returns it.
+    typename Backend::Handle detach(void);
+
+    typename Backend::Handle getFile(void) { return file; }
+
+    // Backend write:  data as one block (several above BlockSize without gathered writes).
+    // Returns nChars if every block was written in full, otherwise the data bytes of the
+    // blocks before the first short one (no block is written after it).
+    uint32_t write(const char *data, size_t nChars);
+
+    // Sequence number of the next block.
+    uint32_t getSequence(void) { return sequence; }
+
+    // Bytes passed to Backend since attach(), headers included.
+    uint64_t getStoredBytes(void) { return storedBytes.load(std::memory_order_relaxed); }
+
+private:
+    // Block copy-ctor, assignment operator.
+    CrcFramedFile(const CrcFramedFile &obj);
+    CrcFramedFile& operator=(const CrcFramedFile& obj);
+
+    typename Backend::Handle file;
+    uint32_t    sequence;
+    std::atomic<uint64_t> storedBytes;  // Written by the writing thread only; read from any thread
+    // Header and data, for Backends without gathered writes
+    alignas(Backend::BufferAlignment) char block[Backend::SupportsGather ? 1 : (CrcBlockHeader::Size + BlockSize)];
+};
+
+template <class Backend, size_t BlockSize = 65536, size_t MaxFiles = 4>
+struct CrcFramedBackend : public FileBackendDefaults
+{
+    typedef CrcFramedFile<Backend, BlockSize> * Handle;
+
+    static const bool SupportsOpen = Backend::SupportsOpen;
+    static const bool SupportsSync = Backend::SupportsSync;
+    static const bool SupportsReserve = Backend::SupportsReserve;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Returns data bytes written; fewer than nChars if a block write came up short.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return file->write(data, nChars);
+    }
+
+    // Backend::open(), attached to a free pooled CrcFramedFile.  noFile() if either fails.
+    static Handle open(const char *name)
+    {
+        Handle retval = NULL;
+        typename Backend::Handle inner = Backend::open(name);
+        if (Backend::noFile() != inner) {
+            std::lock_guard<std::mutex> guard(poolLock());
+            for (size_t i = 0; (i < MaxFiles) && (NULL == retval); ++i) {
+                if (!poolUsed()[i]) {
+                    poolUsed()[i] = true;
+                    retval = &pool()[i];
+                }
+            }
+        }
+        if (NULL != retval) {
+            retval->attach(inner);
+        } else if (Backend::noFile() != inner) {
+            Backend::close(inner);
+        }
+        return retval;
+    }
+
+    // Backend::close(); a pooled CrcFramedFile goes back to the pool.
+    static void close(Handle file)
+    {
+        Backend::close(file->detach());
+        std::lock_guard<std::mutex> guard(poolLock());
+        for (size_t i = 0; i < MaxFiles; ++i) {
+            if (file == &pool()[i]) {
+                poolUsed()[i] = false;
+            }
+        }
+    }
+
+    static bool remove(const char *name)
+    {
+        return Backend::remove(name);
+    }
+
+    static bool sync(Handle file)
+    {
+        return BackendSync<Backend>::sync(file->getFile());
+    }
+
+    // nBytes is the data; headers add 16 bytes per flush beyond it.
+    static bool reserve(Handle file, size_t nBytes)
+    {
+        return BackendReserve<Backend>::reserve(file->getFile(), nBytes);
+    }
+
+    static bool trim(Handle file)
+    {
+        return BackendReserve<Backend>::trim(file->getFile());
+    }
+
+    // RotatingFileWriter::SizeFunction:  stored size of file, headers included.
+    static size_t storedSize(Handle file, void *context)
+    {
+        (void)context;
+        return (size_t)file->getStoredBytes();
+    }
+
+private:
+    // Pool for open(); function-local statics, so it only exists if open() is used.
+    static CrcFramedFile<Backend, BlockSize> *pool(void)
+    {
+        static CrcFramedFile<Backend, BlockSize> files[MaxFiles];
+        return files;
+    }
+
+    static bool *poolUsed(void)
+    {
+        static bool used[MaxFiles];
+        return used;
+    }
+
+    static std::mutex &poolLock(void)
+    {
+        static std::mutex lock;
+        return lock;
+    }
+};
+
+
+template <class Backend, size_t BlockSize>
+CrcFramedFile<Backend, BlockSize>::CrcFramedFile(void)
+    : file(Backend::noFile()), sequence(0), storedBytes(0)
+{
+}
+
+template <class Backend, size_t BlockSize>
+void CrcFramedFile<Backend, BlockSize>::attach(typename Backend::Handle _file, uint32_t firstSequence)
+{
+    file = _file;
+    sequence = firstSequence;
+    storedBytes.store(0, std::memory_order_relaxed);
+}
+
+template <class Backend, size_t BlockSize>
+typename Backend::Handle CrcFramedFile<Backend, BlockSize>::detach(void)
+{
+    typename Backend::Handle retval = file;
+    file = Backend::noFile();
+    return retval;
+}
+
+template <class Backend, size_t BlockSize>
+uint32_t CrcFramedFile<Backend, BlockSize>::write(const char *data, size_t nChars)
+{
+    uint32_t retval = 0;
+    bool ok = true;
+    while (ok && (nChars > 0)) {
+        size_t chunk = (Backend::SupportsGather || (nChars < BlockSize)) ? nChars : BlockSize;
+        CrcBlockHeader header;
+        header.magic = CrcBlockHeader::Magic;
+        header.length = (uint32_t)chunk;
+        header.sequence = sequence++;
+        if (Backend::SupportsGather) {
+            char head[CrcBlockHeader::Size];
+            header.store(head, data);
+            WriteSegment segments[2] = { { head, CrcBlockHeader::Size }, { data, chunk } };
+            ok = (BackendGather<Backend>::write(file, segments, 2) == CrcBlockHeader::Size + chunk);
+        } else {
+            memcpy(block + CrcBlockHeader::Size, data, chunk);
+            header.store(block, block + CrcBlockHeader::Size);
+            ok = (Backend::write(file, block, CrcBlockHeader::Size + chunk) == CrcBlockHeader::Size + chunk);
+        }
+        if (ok) {
+            storedBytes.store(storedBytes.load(std::memory_order_relaxed) + CrcBlockHeader::Size + chunk,
+                    std::memory_order_relaxed);
+            retval += (uint32_t)chunk;
+            data += chunk;
+            nChars -= chunk;
+        }
+    }
+    return retval;
+}
+
+#endif //ndef CRC_FRAMED_BACKEND_H
@@ -0,0 +1,193 @@
+/****************************************************************************
+ *   FILENAME: DirectBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  throughput and page cache footprint of PosixDirectFileBackend
+ *            (O_DIRECT) against PosixFileBackend (page cache).
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  DirectBench [-d <directory>] [-m <MiB>] [-s]
+ *       Defaults:  current directory, 1024 MiB per run.  -s adds an fdatasync(2) before each
+ *       file is closed (timed).  Run it on the server build's disks; the output file
+ *       (dbench.log) is deleted after each run.
+ *
+ *       200-byte log lines go through a BasicBufferedFileWriter<262144> on each backend; the
+ *       O_DIRECT writer uses setFlushAlignment(4096), so full-buffer flushes are whole blocks
+ *       written without a copy.  Reported per run:  MiB/s (open to close), and the file's
+ *       footprint in the page cache after close:  resident pages by mincore(2), and the
+ *       change in Cached in /proc/meminfo (other activity on the host shows up there too).
+ *       Exit code 1 if a file's size is wrong.
+ *
+ *       File systems without O_DIRECT (tmpfs) fall back to the page cache; the tool says so.
+ *
+ *       Builds for Linux hosts only (O_DIRECT, mincore(), /proc); not part of the target
+ *       image.  Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "PosixDirectFileBackend.h"
+#include "PosixFileBackend.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef PosixDirectFileBackend<4096> DirectBackend;
+
+static const size_t LineSize = 200;
+static const size_t TextSize = 328 * LineSize;      // About 64 KiB of lines, repeated
+
+// Statics:  the 256 KiB buffers do not belong on the stack.
+static BasicBufferedFileWriter<262144, 256, PosixFileBackend> bufferedWriter;
+static BasicBufferedFileWriter<262144, 256, DirectBackend> directWriter;
+static DirectFile<4096> directFile;
+static char text[TextSize];
+
+// Cached in /proc/meminfo, in KiB; 0 if unavailable.
+static long cachedKibibytes(void)
+{
+    long retval = 0;
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (NULL != meminfo) {
+        char line[128];
+        while (NULL != fgets(line, sizeof(line), meminfo)) {
+            if (1 == sscanf(line, "Cached: %ld kB", &retval)) {
+                break;
+            }
+        }
+        fclose(meminfo);
+    }
+    return retval;
+}
+
+// Pages of the file at path resident in the page cache, in MiB; -1 on error.
+static double residentMebibytes(const char *path)
+{
+    double retval = -1.0;
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if ((fd >= 0) && (0 == fstat(fd, &status)) && (status.st_size > 0)) {
+        size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        size_t pages = ((size_t)status.st_size + pageSize - 1) / pageSize;
+        void *map = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        unsigned char *vector = (unsigned char *)malloc(pages);
+        if ((MAP_FAILED != map) && (NULL != vector) && (0 == mincore(map, (size_t)status.st_size, vector))) {
+            size_t resident = 0;
+            for (size_t i = 0; i < pages; ++i) {
+                resident += vector[i] & 1;
+            }
+            retval = (double)(resident * pageSize) / (1024.0 * 1024.0);
+        }
+        free(vector);
+        if (MAP_FAILED != map) {
+            munmap(map, (size_t)status.st_size);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return retval;
+}
+
+template <class Writer>
+static void writeLines(Writer &writer, size_t total)
+{
+    for (size_t pos = 0; pos < total; pos += LineSize) {
+        writer.write(text + pos % TextSize, LineSize);
+    }
+    writer.flush();
+}
+
+// Print one result line; returns false if the file is not total bytes long.
+static bool report(const char *label, const char *path, size_t total, double seconds, long cachedBefore)
+{
+    struct stat status;
+    bool retval = (0 == stat(path, &status)) && ((size_t)status.st_size == total);
+    printf("%-20s %8.0f MiB/s   resident %7.1f MiB   Cached %+8.1f MiB%s\n", label,
+            (double)total / seconds / (1024.0 * 1024.0), residentMebibytes(path),
+            (double)(cachedKibibytes() - cachedBefore) / 1024.0, retval ? "" : "  FILE SIZE MISMATCH");
+    unlink(path);
+    return retval;
+}
+
+static bool runBuffered(const char *path, size_t total, bool sync)
+{
+    long cachedBefore = cachedKibibytes();
+    Clock::time_point start = Clock::now();
+    int fd = PosixFileBackend::open(path);
+    if (fd < 0) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return false;
+    }
+    bufferedWriter.setFile(fd);
+    writeLines(bufferedWriter, total);
+    if (sync) {
+        PosixFileBackend::sync(fd);
+    }
+    bufferedWriter.setFile(PosixFileBackend::noFile());
+    PosixFileBackend::close(fd);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return report(sync ? "buffered+fdatasync" : "buffered", path, total, seconds, cachedBefore);
+}
+
+static bool runDirect(const char *path, size_t total, bool sync)
+{
+    long cachedBefore = cachedKibibytes();
+    Clock::time_point start = Clock::now();
+    if (!directFile.open(path, false)) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return false;
+    }
+    if (!directFile.isDirect()) {
+        printf("(%s does not support O_DIRECT:  written through the page cache)\n", path);
+    }
+    directWriter.setFlushAlignment(4096);
+    directWriter.setFile(&directFile);
+    writeLines(directWriter, total);
+    if (sync) {
+        directFile.sync();
+    }
+    directWriter.setFile(NULL);
+    directFile.close();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return report(sync ? "O_DIRECT+fdatasync" : "O_DIRECT", path, total, seconds, cachedBefore);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = ".";
+    size_t mebibytes = 1024;
+    bool sync = false;
+    for (int arg = 1; arg < argc; ++arg) {
+        if ((0 == strcmp(argv[arg], "-d")) && (arg + 1 < argc)) {
+            directory = argv[++arg];
+        } else if ((0 == strcmp(argv[arg], "-m")) && (arg + 1 < argc)) {
+            mebibytes = strtoul(argv[++arg], NULL, 0);
+        } else if (0 == strcmp(argv[arg], "-s")) {
+            sync = true;
+        } else {
+            fprintf(stderr, "usage: %s [-d <directory>] [-m <MiB>] [-s]\n", argv[0]);
+            return 2;
+        }
+    }
+    for (size_t pos = 0; pos < sizeof(text); pos += LineSize) {
+        snprintf(text + pos, LineSize, "2020-06-30T14:05:%02lu.%03luZ worker=%02lu req=%08lx %-140s",
+                (unsigned long)(pos / LineSize % 60), (unsigned long)(pos % 1000), (unsigned long)(pos % 32),
+                (unsigned long)(pos * 2654435761u), "connection reset by peer, reconnecting");
+        text[pos + LineSize - 1] = '\n';
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/dbench.log", directory);
+    // Whole lines, ending on a partial block so close() has a tail to truncate.
+    size_t total = mebibytes * 1024 * 1024 / LineSize * LineSize;
+    printf("%lu MiB of %lu-byte lines to %s, 256 KiB writer buffer\n", (unsigned long)mebibytes,
+            (unsigned long)LineSize, path);
+    bool ok = runBuffered(path, total, sync);
+    ok = runDirect(path, total, sync) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,11 @@
+/****************************************************************************
+ *   FILENAME: DoubleBufferedFileWriter.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Buffered file writes that do not block the writing thread on FS_FWrite().
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       See .h file.
+ ****************************************************************************/
+
+#include "DoubleBufferedFileWriter.h"
+
+template class BasicDoubleBufferedFileWriter<4096, 2, 2048, EmFileBackend>;
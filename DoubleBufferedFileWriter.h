@@ -0,0 +1,24 @@
+/****************************************************************************
+ *   FILENAME: DoubleBufferedFileWriter.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Buffered file writes that do not block the writing thread on FS_FWrite().
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       See BasicDoubleBufferedFileWriter.h.
+ *
+ *       DoubleBufferedFileWriter is BasicDoubleBufferedFileWriter writing through Segger
+ *       emFile, with two 4096 byte write buffers (printf lines up to 4095 characters).  It is
+ *       instantiated once, in DoubleBufferedFileWriter.cpp.
+ *
+ ****************************************************************************/
+
+#ifndef DOUBLE_BUFFERED_FILE_WRITER_H
+#define DOUBLE_BUFFERED_FILE_WRITER_H
+
+#include "BasicDoubleBufferedFileWriter.h"
+#include "EmFileBackend.h"
+
+typedef BasicDoubleBufferedFileWriter<4096, 2, 2048, EmFileBackend> DoubleBufferedFileWriter;
+
+extern template class BasicDoubleBufferedFileWriter<4096, 2, 2048, EmFileBackend>;
+
+#endif //ndef DOUBLE_BUFFERED_FILE_WRITER_H
@@ -0,0 +1,83 @@
+/****************************************************************************
+ *   FILENAME: EmFileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: BasicBufferedFileWriter backend for Segger emFile.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Writes with FS_FWrite(); the return code is FS_FWrite()'s.
+ *       Debug output 4 is set for the duration of each FS_FWrite(), for timing on a scope.
+ *       Supports open / close / remove (FS_FOpen(name, "wb"), FS_FClose(), FS_Remove()).
+ *       Supports sync with FS_SyncFile():  writes the file's directory entry and the
+ *       allocation table without the FS_FClose() / FS_FOpen() round trip.
+ *       Supports reserve / trim with FS_SetFileSize():  FAT has no allocation past the end of
+ *       file, so reserve sets the file size beyond the data (clusters allocated once, not on
+ *       every write) and trim sets it back to the write position.  Until trimmed, the file
+ *       reads past the data into whatever the reserved clusters held; trim before closing.
+ *
+ ****************************************************************************/
+
+#ifndef EMFILE_BACKEND_H
+#define EMFILE_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "FileBackend.h"
+#include "debugIO.h"
+#include "FS.h"
+
+struct EmFileBackend : public FileBackendDefaults
+{
+    typedef FS_FILE * Handle;
+
+    static const bool SupportsOpen = true;
+    static const bool SupportsSync = true;
+    static const bool SupportsReserve = true;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    static Handle open(const char *name)
+    {
+        return FS_FOpen(name, "wb");
+    }
+
+    static void close(Handle file)
+    {
+        FS_FClose(file);
+    }
+
+    static bool remove(const char *name)
+    {
+        return 0 == FS_Remove(name);
+    }
+
+    static bool sync(Handle file)
+    {
+        return 0 == FS_SyncFile(file);
+    }
+
+    static bool reserve(Handle file, size_t nBytes)
+    {
+        I32 position = FS_FTell(file);
+        return (position >= 0) && (0 == FS_SetFileSize(file, (U32)position + (U32)nBytes));
+    }
+
+    static bool trim(Handle file)
+    {
+        I32 position = FS_FTell(file);
+        return (position >= 0) && (0 == FS_SetFileSize(file, (U32)position));
+    }
+
+    // Returns FS_FWrite() return code.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        uint32_t retval;
+        setDebug4(true);
+        retval = FS_FWrite(data, nChars, 1, file);
+        setDebug4(false);
+        return retval;
+    }
+};
+
+#endif //ndef EMFILE_BACKEND_H
@@ -0,0 +1,152 @@
+/****************************************************************************
+ *   FILENAME: FileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Common definitions for the storage backends of the buffered file writers.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       A backend is a struct of static functions (see BasicBufferedFileWriter.h).  Besides
+ *       the required Handle, noFile() and write(), a backend may offer optional capabilities.
+ *       Backends derive from FileBackendDefaults, which declares every capability as absent;
+ *       a backend that has one hides the default with its own declaration.
+ *
+ *       Optional capabilities:
+ *           SupportsGather:  backend has
+ *               static uint32_t writev(Handle file, const WriteSegment *segments, size_t count);
+ *           which writes all segments, in order, in one operation.
+ *           SupportsOpen:  backend can create and delete files by name:
+ *               static Handle open(const char *name);   // Create / truncate for write;
+ *                                                       // noFile() on failure
+ *               static void close(Handle file);
+ *               static bool remove(const char *name);   // true if deleted
+ *           (used by RotatingFileWriter).
+ *           SupportsSync:  backend has
+ *               static bool sync(Handle file);          // true once all data written so far
+ *                                                       // is on the media
+ *           which is cheaper than a close / re-open (used by FileCheckpointer).
+ *           SupportsReserve:  backend can allocate file space ahead of the data:
+ *               static bool reserve(Handle file, size_t nBytes);    // nBytes from the write
+ *                                                                   // position on
+ *               static bool trim(Handle file);          // release space past the write
+ *                                                       // position
+ *           (used by the writers' setPreallocation()).
+ *           BufferAlignment:  alignment (power of two) the writers give their buffers, for
+ *           backends that write straight from them under address constraints (1 = none;
+ *           PosixDirectFileBackend:  O_DIRECT block size).
+ *
+ *       BackendGather<Backend>::write() does a gathered write on any backend:  writev() when
+ *       the backend supports it, otherwise one write() per segment.
+ *       BackendSync<Backend>::sync() is Backend::sync(), or false on backends without it.
+ *       BackendReserve<Backend>::reserve() / trim() likewise, false without SupportsReserve.
+ *
+ ****************************************************************************/
+
+#ifndef FILE_BACKEND_H
+#define FILE_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// One piece of a gathered (vectored) write.
+struct WriteSegment
+{
+    const char * data;
+    size_t      length;
+};
+
+struct FileBackendDefaults
+{
+    static const bool SupportsGather = false;
+    static const bool SupportsOpen = false;
+    static const bool SupportsSync = false;
+    static const bool SupportsReserve = false;
+    static const size_t BufferAlignment = 1;
+};
+
+// Gathered write through Backend::writev().
+template <class Backend, bool Gather = Backend::SupportsGather>
+struct BackendGather
+{
+    // Returns Backend::writev() return code.
+    static uint32_t write(typename Backend::Handle file, const WriteSegment *segments, size_t count)
+    {
+        return Backend::writev(file, segments, count);
+    }
+};
+
+// Gathered write emulated with one Backend::write() per non-empty segment.
+template <class Backend>
+struct BackendGather<Backend, false>
+{
+    // Returns Backend::write() return code of the last segment written, 0 if none.
+    static uint32_t write(typename Backend::Handle file, const WriteSegment *segments, size_t count)
+    {
+        uint32_t retval = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (segments[i].length > 0) {
+                retval = Backend::write(file, segments[i].data, segments[i].length);
+            }
+        }
+        return retval;
+    }
+};
+
+// Make written data durable through Backend::sync().
+template <class Backend, bool Sync = Backend::SupportsSync>
+struct BackendSync
+{
+    // Returns Backend::sync() result.
+    static bool sync(typename Backend::Handle file)
+    {
+        return Backend::sync(file);
+    }
+};
+
+// No sync primitive:  the caller must fall back to closing and re-opening the file.
+template <class Backend>
+struct BackendSync<Backend, false>
+{
+    // Returns false (nothing done).
+    static bool sync(typename Backend::Handle file)
+    {
+        (void)file;
+        return false;
+    }
+};
+
+// Allocate file space through Backend::reserve() / trim().
+template <class Backend, bool Reserve = Backend::SupportsReserve>
+struct BackendReserve
+{
+    // Returns Backend::reserve() result.
+    static bool reserve(typename Backend::Handle file, size_t nBytes)
+    {
+        return Backend::reserve(file, nBytes);
+    }
+
+    // Returns Backend::trim() result.
+    static bool trim(typename Backend::Handle file)
+    {
+        return Backend::trim(file);
+    }
+};
+
+// No preallocation:  the file grows with each write.
+template <class Backend>
+struct BackendReserve<Backend, false>
+{
+    // Returns false (nothing done).
+    static bool reserve(typename Backend::Handle file, size_t nBytes)
+    {
+        (void)file;
+        (void)nBytes;
+        return false;
+    }
+
+    // Returns false (nothing done).
+    static bool trim(typename Backend::Handle file)
+    {
+        (void)file;
+        return false;
+    }
+};
+
+#endif //ndef FILE_BACKEND_H
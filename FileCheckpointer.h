@@ -0,0 +1,213 @@
+/****************************************************************************
+ *   FILENAME: FileCheckpointer.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Periodic durability checkpoints for a (Double)BufferedFileWriter.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       BasicBufferedFileWriter.h describes closing and re-opening the same logfile so that
+ *       the data and the directory entry reach the media.  That is a full FS_FClose() /
+ *       FS_FOpen() round trip each time, and each call site decides on its own when to do it.
+ *
+ *       A FileCheckpointer makes that decision and uses the cheapest primitive the backend
+ *       has:  Backend::sync() (fdatasync(2), FS_SyncFile(); SupportsSync, see FileBackend.h)
+ *       after flushing the writer.  Only on a backend without sync does it close and re-open
+ *       the file, through a caller-supplied ReopenFunction (the caller knows the name and
+ *       open mode); without one, a checkpoint only flushes and is not durable.
+ *
+ *       Policy, checked by poll() after each record:
+ *        - everyBytes:         bytes written since the last checkpoint (0 = off),
+ *        - everyMilliseconds:  time since the last checkpoint (0 = off),
+ *        - severityThreshold:  a record with severity >= threshold is checkpointed at once.
+ *       There is no timer thread:  the time limit is only checked when poll() is called.
+ *
+ *       getDurableOffset() is the writer's getBytesWrittenTotal() as of the last successful
+ *       checkpoint:  bytes before it are known to be on the media.  A checkpoint fails, and
+ *       the offset stays, once a write to the file has come up short (Writer::writeFailed()):
+ *       the file is missing bytes below the writer's count, whatever the sync returns.  getStats() gives
+ *       checkpoint count, failures and latency (flush + sync), for tuning the policy.
+ *
+ *       Calls the writer, so it must be used on the thread that writes.
+ *
+ ****************************************************************************/
+
+#ifndef FILE_CHECKPOINTER_H
+#define FILE_CHECKPOINTER_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include "FileBackend.h"
+
+template <class Writer, class Backend>
+class FileCheckpointer
+{
+public:
+    typedef typename Backend::Handle Handle;
+    // Close file and open it again for append; returns the new handle (Backend::noFile() on
+    // failure).
+    typedef Handle (*ReopenFunction)(Handle file, void *context);
+
+    // Checkpoint latency and counts since construction or the last resetStats().
+    struct Stats
+    {
+        uint32_t    count;              // Successful checkpoints
+        uint32_t    failures;           // Checkpoints that did not make the data durable
+        uint32_t    lastMicroseconds;   // Latency of the last checkpoint
+        uint32_t    maxMicroseconds;    // Longest latency
+        uint64_t    totalMicroseconds;  // Sum of latencies (mean = total / (count + failures))
+    };
+
+    // A 0 limit turns that trigger off; severityThreshold INT_MAX turns severity off.
+    FileCheckpointer(Writer &_writer, size_t _everyBytes, uint32_t _everyMilliseconds,
+            int _severityThreshold = INT_MAX);
+
+    // Connect writer and checkpointer to ((re-)opened for write) file:  calls writer.setFile().
+    // Everything written so far counts as durable.  For a new file, call after
+    // writer.resetBytesWrittenTotal().
+    void setFile(Handle _file);
+
+    // Fallback for backends without sync (ignored on backends with it).
+    void setReopen(ReopenFunction _reopen, void *_reopenContext);
+
+    // Call after each record with the record's severity.  Checkpoints if the policy says so.
+    // Returns true if a checkpoint was made and succeeded.
+    bool poll(int severity = 0);
+
+    // Flush the writer and make the file durable now.  Returns true on success:  the flush
+    // and every write since setFile() were complete, and the sync (or re-open) succeeded.
+    bool checkpoint(void);
+
+    // Return the writer's byte count as of the last successful checkpoint.
+    size_t getDurableOffset(void);
+
+    Stats getStats(void);
+
+    void resetStats(void);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Block copy-ctor, assignment operator.
+    FileCheckpointer(const FileCheckpointer &obj);
+    FileCheckpointer& operator=(const FileCheckpointer& obj);
+
+    Writer &    writer;
+    size_t      everyBytes;
+    Clock::duration everyInterval;
+    int         severityThreshold;
+    Handle      file;
+    ReopenFunction reopen;
+    void *      reopenContext;
+    // Writer's byte count at the last successful checkpoint
+    size_t      durableOffset;
+    // Time of the last checkpoint attempt
+    Clock::time_point lastCheckpoint;
+    Stats       stats;
+};
+
+
+template <class Writer, class Backend>
+FileCheckpointer<Writer, Backend>::FileCheckpointer(Writer &_writer, size_t _everyBytes,
+        uint32_t _everyMilliseconds, int _severityThreshold)
+    : writer(_writer), everyBytes(_everyBytes),
+      everyInterval(std::chrono::milliseconds(_everyMilliseconds)),
+      severityThreshold(_severityThreshold), file(Backend::noFile()), reopen(NULL),
+      reopenContext(NULL), durableOffset(0), lastCheckpoint(Clock::now())
+{
+    resetStats();
+}
+
+template <class Writer, class Backend>
+void FileCheckpointer<Writer, Backend>::setFile(Handle _file)
+{
+    writer.setFile(_file);
+    file = _file;
+    durableOffset = writer.getBytesWrittenTotal();
+    lastCheckpoint = Clock::now();
+}
+
+template <class Writer, class Backend>
+void FileCheckpointer<Writer, Backend>::setReopen(ReopenFunction _reopen, void *_reopenContext)
+{
+    reopen = _reopen;
+    reopenContext = _reopenContext;
+}
+
+// Severity and byte triggers first; the clock is only read when the time trigger is on.
+template <class Writer, class Backend>
+bool FileCheckpointer<Writer, Backend>::poll(int severity)
+{
+    bool due = (severity >= severityThreshold);
+    if (!due && (0 != everyBytes)) {
+        size_t total = writer.getBytesWrittenTotal();
+        // A byte count reset without setFile() leaves everything pending.
+        size_t pending = (total >= durableOffset) ? (total - durableOffset) : total;
+        due = (pending >= everyBytes);
+    }
+    if (!due && (Clock::duration::zero() != everyInterval)) {
+        due = (Clock::now() - lastCheckpoint >= everyInterval);
+    }
+    return due && checkpoint();
+}
+
+// Flush, then sync; on a backend without sync, close / re-open through the caller's function.
+// Nothing is synced after a short write:  the data it lost would be counted as durable.
+template <class Writer, class Backend>
+bool FileCheckpointer<Writer, Backend>::checkpoint(void)
+{
+    bool durable = false;
+    if (Backend::noFile() != file) {
+        Clock::time_point start = Clock::now();
+        writer.flush();
+        bool complete = !writer.writeFailed();
+        if (complete && Backend::SupportsSync) {
+            durable = BackendSync<Backend>::sync(file);
+        } else if (complete && (NULL != reopen)) {
+            // Reserved space (setPreallocation()) would otherwise be appended after.
+            writer.trimPreallocation();
+            file = reopen(file, reopenContext);
+            writer.setFile(file);
+            durable = (Backend::noFile() != file);
+        }
+        lastCheckpoint = Clock::now();
+
+        uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                lastCheckpoint - start).count();
+        stats.lastMicroseconds = (micros < UINT32_MAX) ? (uint32_t)micros : UINT32_MAX;
+        if (stats.lastMicroseconds > stats.maxMicroseconds) {
+            stats.maxMicroseconds = stats.lastMicroseconds;
+        }
+        stats.totalMicroseconds += micros;
+        if (durable) {
+            ++stats.count;
+            durableOffset = writer.getBytesWrittenTotal();
+        } else {
+            ++stats.failures;
+        }
+    }
+    return durable;
+}
+
+template <class Writer, class Backend>
+size_t FileCheckpointer<Writer, Backend>::getDurableOffset(void)
+{
+    return durableOffset;
+}
+
+template <class Writer, class Backend>
+typename FileCheckpointer<Writer, Backend>::Stats FileCheckpointer<Writer, Backend>::getStats(void)
+{
+    return stats;
+}
+
+template <class Writer, class Backend>
+void FileCheckpointer<Writer, Backend>::resetStats(void)
+{
+    stats.count = 0;
+    stats.failures = 0;
+    stats.lastMicroseconds = 0;
+    stats.maxMicroseconds = 0;
+    stats.totalMicroseconds = 0;
+}
+
+#endif //ndef FILE_CHECKPOINTER_H
@@ -0,0 +1,160 @@
+/****************************************************************************
+ *   FILENAME: FramedLogRecover.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  check a file written through CrcFramedBackend, cut it back to its
+ *            last valid block.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  FramedLogRecover [-t] [-x <data output>] <framed log>
+ *           -t                  truncate the file after the last valid block
+ *           -x <data output>    write the data of the valid blocks (the log text) to a file
+ *
+ *       Blocks are checked from the start (see CrcFramedBackend.h):  magic number, length
+ *       within the file, CRC-32C, and a sequence number one above the previous block's.  The
+ *       valid part of the file ends at the first block failing any check.  Everything from
+ *       there on is reported (and cut with -t), including any blocks further on that check
+ *       out by themselves:  their count is reported, since after a torn block in the middle
+ *       they are lost by truncating.  The next sequence number is reported for appending
+ *       (CrcFramedFile::attach()).
+ *
+ *       Exit code 0 if the whole file is valid, 1 if something was damaged or incomplete.
+ *
+ *       Builds for the host only (uses malloc(), stdio, truncate()); not part of the target
+ *       image.  Link with Crc32c.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "CrcFramedBackend.h"
+
+// Read whole file into a malloc()'d buffer.  Returns NULL on failure.
+static char *readFile(const char *path, size_t *size)
+{
+    char *data = NULL;
+    FILE *file = fopen(path, "rb");
+    if (NULL != file) {
+        if ((0 == fseek(file, 0, SEEK_END)) && (ftell(file) >= 0)) {
+            *size = (size_t)ftell(file);
+            rewind(file);
+            data = (char *)malloc(*size + 1);
+            if ((NULL != data) && (fread(data, 1, *size, file) != *size)) {
+                free(data);
+                data = NULL;
+            }
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+// Block at pos fits in the file and its CRC checks out.
+static bool blockAt(const char *data, size_t size, size_t pos, CrcBlockHeader &header)
+{
+    return (size - pos >= CrcBlockHeader::Size) && header.load(data + pos)
+            && (size - pos - CrcBlockHeader::Size >= header.length)
+            && header.check(data + pos, data + pos + CrcBlockHeader::Size);
+}
+
+int main(int argc, char *argv[])
+{
+    bool truncateFile = false;
+    const char *extractPath = NULL;
+    int arg = 1;
+    for (; (arg < argc) && ('-' == argv[arg][0]); ++arg) {
+        if (0 == strcmp(argv[arg], "-t")) {
+            truncateFile = true;
+        } else if ((0 == strcmp(argv[arg], "-x")) && (arg + 1 < argc)) {
+            extractPath = argv[++arg];
+        } else {
+            break;
+        }
+    }
+    if (argc - arg != 1) {
+        fprintf(stderr, "usage: %s [-t] [-x <data output>] <framed log>\n", argv[0]);
+        return 2;
+    }
+    const char *path = argv[arg];
+    size_t size = 0;
+    char *data = readFile(path, &size);
+    if (NULL == data) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 2;
+    }
+    FILE *out = NULL;
+    if (NULL != extractPath) {
+        out = fopen(extractPath, "wb");
+        if (NULL == out) {
+            fprintf(stderr, "cannot create %s\n", extractPath);
+            free(data);
+            return 2;
+        }
+    }
+
+    // Valid part:  consecutive blocks from the start.
+    size_t pos = 0;
+    uint64_t blocks = 0;
+    uint64_t dataBytes = 0;
+    uint32_t firstSequence = 0;
+    uint32_t nextSequence = 0;
+    CrcBlockHeader header;
+    while (blockAt(data, size, pos, header) && ((0 == blocks) || (header.sequence == nextSequence))) {
+        if (0 == blocks) {
+            firstSequence = header.sequence;
+        }
+        if (NULL != out) {
+            fwrite(data + pos + CrcBlockHeader::Size, 1, header.length, out);
+        }
+        nextSequence = header.sequence + 1;
+        ++blocks;
+        dataBytes += header.length;
+        pos += CrcBlockHeader::Size + header.length;
+    }
+    size_t validEnd = pos;
+    printf("%s:  %llu valid blocks", path, (unsigned long long)blocks);
+    if (blocks > 0) {
+        printf(" (sequence %lu to %lu)", (unsigned long)firstSequence, (unsigned long)(nextSequence - 1));
+    }
+    printf(", %llu data bytes, valid to offset %lu of %lu; next sequence %lu\n", (unsigned long long)dataBytes,
+            (unsigned long)validEnd, (unsigned long)size, (unsigned long)nextSequence);
+
+    int retval = 0;
+    if (validEnd < size) {
+        retval = 1;
+        // Blocks past the damage that check out by themselves.
+        uint64_t later = 0;
+        size_t laterStart = 0;
+        for (size_t scan = validEnd; scan < size; ) {
+            if (blockAt(data, size, scan, header)) {
+                if (0 == later) {
+                    laterStart = scan;
+                }
+                ++later;
+                scan += CrcBlockHeader::Size + header.length;
+            } else {
+                ++scan;
+            }
+        }
+        fprintf(stderr, "damaged or incomplete block at offset %lu; %lu bytes from there on are not valid\n",
+                (unsigned long)validEnd, (unsigned long)(size - validEnd));
+        if (later > 0) {
+            fprintf(stderr, "%llu blocks past the damage check out by themselves (first at offset %lu); "
+                    "truncating drops them\n", (unsigned long long)later, (unsigned long)laterStart);
+        }
+        if (truncateFile) {
+            if (0 == truncate(path, (off_t)validEnd)) {
+                printf("truncated to %lu bytes\n", (unsigned long)validEnd);
+            } else {
+                fprintf(stderr, "cannot truncate %s\n", path);
+                retval = 2;
+            }
+        }
+    }
+    if (NULL != out) {
+        fclose(out);
+    }
+    free(data);
+    return retval;
+}
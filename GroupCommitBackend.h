@@ -0,0 +1,302 @@
+/****************************************************************************
+ *   FILENAME: GroupCommitBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Group commit of buffer flushes from many writers sharing one storage device.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       A dozen static writers (one per subsystem log) on the same SD card each flush when
+ *       their own buffer fills, so the card sees small writes to different files in random
+ *       interleaving, each possibly followed by its own sync.
+ *
+ *       GroupCommitBackend<Backend> is a backend for the writers whose handle is a file
+ *       attached to a GroupCommitDevice.  Its write() queues the writer's buffer (no copy;
+ *       the writing thread waits until its data is written) and the device commits queued
+ *       writes in groups:
+ *        - The first writer to queue while no group is being written becomes the leader.
+ *          It waits up to windowMicroseconds for the other attached files to queue (not at
+ *          all once every attached file has a write queued), then takes the whole queue.
+ *        - The leader writes the group in orderKey order (e.g. the files' first clusters,
+ *          or attach order), so the device sees the same file order every group rather than
+ *          arrival order.
+ *        - Then one device sync for the whole group (the caller's SyncFunction, e.g.
+ *          FS_Sync() on the volume, or syncfs(2)); none if no SyncFunction was given.
+ *        - Writers that queue while a group is being written form the next group; one of
+ *          them leads it once the current group is done.
+ *       The default window (DefaultWindowMicroseconds, 1 ms) lets writers that flush at
+ *       about the same time meet in one group; the leader stops waiting as soon as all of
+ *       them have queued, so busy writers rarely wait the whole window.  Attached files that
+ *       are idle make every leader wait it out:  detach them, or shorten the window.  With
+ *       windowMicroseconds 0, groups form only from the writes that queue while the previous
+ *       group is written.  GroupCommitBench.cpp measures the windows against a sync per
+ *       writer on the target's card.
+ *
+ *       Writers whose flush must not wait for a group should be DoubleBufferedFileWriters:
+ *       the wait is then on their flusher thread.  Writers on one thread gain nothing.
+ *
+ *       getStats() gives group sizes and the write latency (queue to written and synced) for
+ *       tuning the window.
+ *
+ *       Files are static slots (MaxFiles), in keeping with static allocation.
+ *
+ ****************************************************************************/
+
+#ifndef GROUP_COMMIT_BACKEND_H
+#define GROUP_COMMIT_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "FileBackend.h"
+
+template <class Backend, size_t MaxFiles>
+class GroupCommitDevice;
+
+// A file attached to a GroupCommitDevice; the Handle of GroupCommitBackend.
+template <class Backend, size_t MaxFiles>
+struct GroupCommitFile
+{
+    GroupCommitDevice<Backend, MaxFiles> * device;
+    typename Backend::Handle file;
+    uint32_t    orderKey;
+    bool        attached;
+    // Queued write, guarded by the device lock
+    const char * data;
+    size_t      length;
+    uint32_t    result;             // Backend::write() return code, once done
+    bool        done;
+};
+
+template <class Backend, size_t MaxFiles = 16>
+struct GroupCommitBackend : public FileBackendDefaults
+{
+    typedef GroupCommitFile<Backend, MaxFiles> * Handle;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Waits until the group holding this write is written.  Returns Backend::write() return code.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return file->device->write(file, data, nChars);
+    }
+};
+
+template <class Backend, size_t MaxFiles = 16>
+class GroupCommitDevice
+{
+public:
+    typedef GroupCommitFile<Backend, MaxFiles> File;
+    // Make everything written to the device durable.  Returns true on success.
+    typedef bool (*SyncFunction)(void *context);
+
+    // Group counts and write latency since construction or the last resetStats().
+    struct Stats
+    {
+        uint64_t    groups;             // Groups written
+        uint64_t    writes;             // Writes (writer flushes) in those groups
+        uint64_t    bytes;
+        uint32_t    maxGroupSize;       // Most writes in one group
+        uint32_t    syncFailures;       // SyncFunction returned false
+        uint32_t    maxLatencyMicroseconds;     // Longest write(), queue to done
+        uint64_t    totalLatencyMicroseconds;   // Sum over writes (mean = total / writes)
+    };
+
+    // Default window:  long enough for a dozen writers filling their buffers at about the
+    // same rate to meet in one group (see GroupCommitBench.cpp).
+    static const uint32_t DefaultWindowMicroseconds = 1000;
+
+    // windowMicroseconds:  longest time a leader waits for other files to queue.
+    explicit GroupCommitDevice(uint32_t windowMicroseconds = DefaultWindowMicroseconds, SyncFunction _sync = NULL,
+            void *_syncContext = NULL);
+
+    // Attach an open file; pass the result to the writer's setFile().
+    // Returns NULL if MaxFiles files are attached.
+    File *attach(typename Backend::Handle file, uint32_t orderKey);
+
+    // Detach a file attached by attach() (its writer must be flushed and not in use).
+    void detach(File *file);
+
+    // GroupCommitBackend::write():  queue data and wait until its group is written.
+    uint32_t write(File *file, const char *data, size_t nChars);
+
+    Stats getStats(void);
+
+    void resetStats(void);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    // Block copy-ctor, assignment operator.
+    GroupCommitDevice(const GroupCommitDevice &obj);
+    GroupCommitDevice& operator=(const GroupCommitDevice& obj);
+
+    // Lead one group:  wait for the window, write the queue in orderKey order, sync.
+    // Called and returns with guard locked; unlocked during I/O.
+    void commitGroup(std::unique_lock<std::mutex> &guard);
+
+    Clock::duration window;
+    SyncFunction sync;
+    void *      syncContext;
+
+    std::mutex  lock;
+    // Leader waits on arrived for the window; writers wait on completed for their group.
+    std::condition_variable arrived;
+    std::condition_variable completed;
+    File        files[MaxFiles];
+    size_t      attachedCount;
+    // Writes queued for the next group
+    File *      queue[MaxFiles];
+    size_t      queuedCount;
+    // A group is being formed or written
+    bool        leaderActive;
+    Stats       stats;
+};
+
+
+template <class Backend, size_t MaxFiles>
+GroupCommitDevice<Backend, MaxFiles>::GroupCommitDevice(uint32_t windowMicroseconds, SyncFunction _sync,
+        void *_syncContext)
+    : window(std::chrono::microseconds(windowMicroseconds)), sync(_sync), syncContext(_syncContext),
+      attachedCount(0), queuedCount(0), leaderActive(false)
+{
+    for (size_t i = 0; i < MaxFiles; ++i) {
+        files[i].device = this;
+        files[i].file = Backend::noFile();
+        files[i].attached = false;
+    }
+    resetStats();
+}
+
+template <class Backend, size_t MaxFiles>
+typename GroupCommitDevice<Backend, MaxFiles>::File *GroupCommitDevice<Backend, MaxFiles>::attach(
+        typename Backend::Handle file, uint32_t orderKey)
+{
+    File *retval = NULL;
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; (i < MaxFiles) && (NULL == retval); ++i) {
+        if (!files[i].attached) {
+            retval = &files[i];
+            retval->file = file;
+            retval->orderKey = orderKey;
+            retval->attached = true;
+            retval->done = true;
+            ++attachedCount;
+        }
+    }
+    return retval;
+}
+
+template <class Backend, size_t MaxFiles>
+void GroupCommitDevice<Backend, MaxFiles>::detach(File *file)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if ((NULL != file) && file->attached) {
+        file->attached = false;
+        file->file = Backend::noFile();
+        --attachedCount;
+    }
+}
+
+// Each file has at most one write queued (its writer waits in here), so the queue never
+// holds more than MaxFiles writes.
+template <class Backend, size_t MaxFiles>
+uint32_t GroupCommitDevice<Backend, MaxFiles>::write(File *file, const char *data, size_t nChars)
+{
+    Clock::time_point start = Clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    file->data = data;
+    file->length = nChars;
+    file->done = false;
+    queue[queuedCount++] = file;
+    arrived.notify_one();
+    while (!file->done) {
+        if (!leaderActive) {
+            commitGroup(guard);
+        } else {
+            completed.wait(guard);
+        }
+    }
+
+    uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start).count();
+    uint32_t latency = (micros < UINT32_MAX) ? (uint32_t)micros : UINT32_MAX;
+    if (latency > stats.maxLatencyMicroseconds) {
+        stats.maxLatencyMicroseconds = latency;
+    }
+    stats.totalLatencyMicroseconds += micros;
+    return file->result;
+}
+
+template <class Backend, size_t MaxFiles>
+void GroupCommitDevice<Backend, MaxFiles>::commitGroup(std::unique_lock<std::mutex> &guard)
+{
+    leaderActive = true;
+    if (Clock::duration::zero() != window) {
+        arrived.wait_until(guard, Clock::now() + window, [this] { return queuedCount >= attachedCount; });
+    }
+    File *group[MaxFiles];
+    size_t groupSize = queuedCount;
+    for (size_t i = 0; i < groupSize; ++i) {
+        group[i] = queue[i];
+    }
+    queuedCount = 0;
+    guard.unlock();
+
+    // Insertion sort:  at most MaxFiles entries.
+    for (size_t i = 1; i < groupSize; ++i) {
+        File *entry = group[i];
+        size_t j = i;
+        while ((j > 0) && (group[j - 1]->orderKey > entry->orderKey)) {
+            group[j] = group[j - 1];
+            --j;
+        }
+        group[j] = entry;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < groupSize; ++i) {
+        group[i]->result = Backend::write(group[i]->file, group[i]->data, group[i]->length);
+        bytes += group[i]->length;
+    }
+    bool synced = (NULL == sync) || sync(syncContext);
+
+    guard.lock();
+    for (size_t i = 0; i < groupSize; ++i) {
+        group[i]->done = true;
+    }
+    ++stats.groups;
+    stats.writes += groupSize;
+    stats.bytes += bytes;
+    if (groupSize > stats.maxGroupSize) {
+        stats.maxGroupSize = (uint32_t)groupSize;
+    }
+    if (!synced) {
+        ++stats.syncFailures;
+    }
+    leaderActive = false;
+    completed.notify_all();
+}
+
+template <class Backend, size_t MaxFiles>
+typename GroupCommitDevice<Backend, MaxFiles>::Stats GroupCommitDevice<Backend, MaxFiles>::getStats(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+template <class Backend, size_t MaxFiles>
+void GroupCommitDevice<Backend, MaxFiles>::resetStats(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stats.groups = 0;
+    stats.writes = 0;
+    stats.bytes = 0;
+    stats.maxGroupSize = 0;
+    stats.syncFailures = 0;
+    stats.maxLatencyMicroseconds = 0;
+    stats.totalLatencyMicroseconds = 0;
+}
+
+#endif //ndef GROUP_COMMIT_BACKEND_H
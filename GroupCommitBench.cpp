@@ -0,0 +1,231 @@
+/****************************************************************************
+ *   FILENAME: GroupCommitBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  benchmark GroupCommitBackend against a sync per writer flush.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  GroupCommitBench [-d <directory>] [-n <writers>] [-k <KB per writer>]
+ *                                [-w <window microseconds>]...
+ *       Defaults:  current directory, 12 writers, 840 KB each, windows 0, 250, 500,
+ *       GroupCommitDevice's default and 5000.  Run it on the device under test (e.g. the SD card
+ *       mounted on a Linux board); the files (gcbench00.log ...) are deleted afterwards.
+ *
+ *       Each writer is a thread with its own BasicBufferedFileWriter<4096> and file, writing
+ *       log lines until its share is done.  Runs:
+ *           per-writer sync:  every flush is write() then fdatasync() of that file
+ *           group, window W:  GroupCommitBackend on one GroupCommitDevice, one syncfs() of the
+ *                             directory's file system per group
+ *       Reported per run:  aggregate MB/s, flush latency (writer's Backend::write() call,
+ *       including its wait for the group) p50 / p99 / max, and syncs issued.
+ *
+ *       Builds for Linux hosts only (syncfs(), threads, <chrono>); not part of the target
+ *       image.
+ *
+ ****************************************************************************/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE             // syncfs()
+#endif
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "BasicBufferedFileWriter.h"
+#include "GroupCommitBackend.h"
+#include "PosixFileBackend.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t MaxWriters = 16;
+static const size_t MaxWindows = 8;
+
+// Flush latencies (microseconds) of all writers, and syncs issued by the baseline.
+static std::mutex latencyLock;
+static std::vector<uint32_t> latencies;
+static std::atomic<uint64_t> baselineSyncs(0);
+
+// Time every Backend::write() (one writer flush) of Inner.
+template <class Inner>
+struct TimedBackend : public Inner
+{
+    static uint32_t write(typename Inner::Handle file, const char *data, size_t nChars)
+    {
+        Clock::time_point start = Clock::now();
+        uint32_t retval = Inner::write(file, data, nChars);
+        uint64_t micros = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        std::lock_guard<std::mutex> guard(latencyLock);
+        latencies.push_back((micros < UINT32_MAX) ? (uint32_t)micros : UINT32_MAX);
+        return retval;
+    }
+};
+
+// Baseline:  each flush written and made durable on its own.
+struct SyncEachBackend : public PosixFileBackend
+{
+    static const bool SupportsGather = false;
+
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        uint32_t retval = PosixFileBackend::write(file, data, nChars);
+        ::fdatasync(file);
+        ++baselineSyncs;
+        return retval;
+    }
+};
+
+typedef GroupCommitDevice<PosixFileBackend, MaxWriters> Device;
+typedef TimedBackend<SyncEachBackend> BaselineBackend;
+typedef TimedBackend<GroupCommitBackend<PosixFileBackend, MaxWriters> > GroupBackend;
+
+static bool syncDirectory(void *context)
+{
+    return 0 == ::syncfs(*(int *)context);
+}
+
+// Writer thread body:  log lines until nBytes are written, then flush.
+template <class Writer>
+static void writeLines(Writer &writer, unsigned id, size_t nBytes)
+{
+    char line[128];
+    size_t written = 0;
+    for (unsigned long n = 0; written < nBytes; ++n) {
+        int length = snprintf(line, sizeof(line), "subsystem %02u record %8lu value=%ld state=%s\n", id, n,
+                (long)(n * 2654435761u % 100000) - 50000, (0 == n % 7) ? "DEGRADED" : "OK");
+        writer.write(line, (size_t)length);
+        written += (size_t)length;
+    }
+    writer.flush();
+}
+
+static void makeName(char *name, size_t size, const char *directory, unsigned id)
+{
+    snprintf(name, size, "%s/gcbench%02u.log", directory, id);
+}
+
+static void report(const char *label, double seconds, size_t totalBytes, uint64_t syncs)
+{
+    std::sort(latencies.begin(), latencies.end());
+    size_t count = latencies.size();
+    uint32_t p50 = (count > 0) ? latencies[count / 2] : 0;
+    uint32_t p99 = (count > 0) ? latencies[(count * 99) / 100] : 0;
+    uint32_t max = (count > 0) ? latencies[count - 1] : 0;
+    printf("%-24s %7.1f MB/s  flush p50 %6u us  p99 %6u us  max %6u us  %6llu syncs\n", label,
+            totalBytes / seconds / 1e6, (unsigned)p50, (unsigned)p99, (unsigned)max, (unsigned long long)syncs);
+    latencies.clear();
+}
+
+static void runBaseline(const char *directory, unsigned nWriters, size_t nBytes)
+{
+    static BasicBufferedFileWriter<4096, 256, BaselineBackend> writers[MaxWriters];
+    int files[MaxWriters];
+    char name[256];
+    for (unsigned i = 0; i < nWriters; ++i) {
+        makeName(name, sizeof(name), directory, i);
+        files[i] = PosixFileBackend::open(name);
+        writers[i].setFile(files[i]);
+    }
+    baselineSyncs = 0;
+    Clock::time_point start = Clock::now();
+    std::thread threads[MaxWriters];
+    for (unsigned i = 0; i < nWriters; ++i) {
+        threads[i] = std::thread([=] { writeLines(writers[i], i, nBytes); });
+    }
+    for (unsigned i = 0; i < nWriters; ++i) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (unsigned i = 0; i < nWriters; ++i) {
+        writers[i].setFile(PosixFileBackend::noFile());
+        PosixFileBackend::close(files[i]);
+    }
+    report("per-writer sync", seconds, nWriters * nBytes, baselineSyncs);
+}
+
+static void runGroup(const char *directory, unsigned nWriters, size_t nBytes, uint32_t windowMicroseconds)
+{
+    static BasicBufferedFileWriter<4096, 256, GroupBackend> writers[MaxWriters];
+    int directoryFd = ::open(directory, O_RDONLY | O_DIRECTORY);
+    Device device(windowMicroseconds, syncDirectory, &directoryFd);
+    int files[MaxWriters];
+    Device::File *attached[MaxWriters];
+    char name[256];
+    for (unsigned i = 0; i < nWriters; ++i) {
+        makeName(name, sizeof(name), directory, i);
+        files[i] = PosixFileBackend::open(name);
+        attached[i] = device.attach(files[i], i);
+        writers[i].setFile(attached[i]);
+    }
+    Clock::time_point start = Clock::now();
+    std::thread threads[MaxWriters];
+    for (unsigned i = 0; i < nWriters; ++i) {
+        threads[i] = std::thread([=] { writeLines(writers[i], i, nBytes); });
+    }
+    for (unsigned i = 0; i < nWriters; ++i) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (unsigned i = 0; i < nWriters; ++i) {
+        writers[i].setFile(NULL);
+        device.detach(attached[i]);
+        PosixFileBackend::close(files[i]);
+    }
+    ::close(directoryFd);
+    Device::Stats stats = device.getStats();
+    char label[64];
+    snprintf(label, sizeof(label), "group, %u us window", (unsigned)windowMicroseconds);
+    report(label, seconds, nWriters * nBytes, stats.groups);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = ".";
+    unsigned nWriters = 12;
+    size_t kilobytes = 840;
+    uint32_t windows[MaxWindows];
+    size_t nWindows = 0;
+    for (int arg = 1; arg < argc; ++arg) {
+        if ((0 == strcmp(argv[arg], "-d")) && (arg + 1 < argc)) {
+            directory = argv[++arg];
+        } else if ((0 == strcmp(argv[arg], "-n")) && (arg + 1 < argc)) {
+            nWriters = (unsigned)strtoul(argv[++arg], NULL, 0);
+        } else if ((0 == strcmp(argv[arg], "-k")) && (arg + 1 < argc)) {
+            kilobytes = strtoul(argv[++arg], NULL, 0);
+        } else if ((0 == strcmp(argv[arg], "-w")) && (arg + 1 < argc) && (nWindows < MaxWindows)) {
+            windows[nWindows++] = (uint32_t)strtoul(argv[++arg], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-d <directory>] [-n <writers>] [-k <KB per writer>] "
+                    "[-w <window microseconds>]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if ((0 == nWriters) || (nWriters > MaxWriters)) {
+        fprintf(stderr, "writers:  1 to %u\n", (unsigned)MaxWriters);
+        return 2;
+    }
+    if (0 == nWindows) {
+        static const uint32_t defaults[] = { 0, 250, 500, Device::DefaultWindowMicroseconds, 5000 };
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) {
+            windows[nWindows++] = defaults[i];
+        }
+    }
+    printf("%u writers x %lu KB in %s\n", nWriters, (unsigned long)kilobytes, directory);
+    size_t nBytes = kilobytes * 1000;
+    runBaseline(directory, nWriters, nBytes);
+    for (size_t i = 0; i < nWindows; ++i) {
+        runGroup(directory, nWriters, nBytes, windows[i]);
+    }
+    char name[256];
+    for (unsigned i = 0; i < nWriters; ++i) {
+        makeName(name, sizeof(name), directory, i);
+        PosixFileBackend::remove(name);
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+/****************************************************************************
+ *   FILENAME: Lz4Block.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: LZ4 block compression and decompression kernels for the compressed log files.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       See .h file.
+ *
+ *       Block format rules kept by compress():  the last 5 bytes are always literals, and no
+ *       match starts within the last 12 bytes, so a decoder may copy in 8-byte steps; offsets
+ *       are at most 65535.  Unaligned loads go through memcpy(), which compiles to a single
+ *       load on x86 and ARMv7+.  Little-endian targets only (the match extension counts
+ *       trailing zero bits).
+ ****************************************************************************/
+
+#include <string.h>
+#include "Lz4Block.h"
+
+static const size_t MinMatch = 4;
+static const size_t LastLiterals = 5;
+static const size_t MatchFindLimit = 12;
+static const size_t MaxOffset = 65535;
+// Skip faster through data without matches:  step grows by 1 every 2^SkipShift misses.
+static const unsigned SkipShift = 6;
+
+static inline uint32_t load32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t load64(const uint8_t *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static const unsigned HashBits = 12;
+static_assert((1u << HashBits) == Lz4Block::HashSize, "HashBits must match HashSize");
+
+// Fibonacci hashing of 4 bytes down to HashBits bits.
+static inline uint32_t hash4(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HashBits);
+}
+
+// Bytes equal at a and b, up to limit (end of the data b may read).
+static inline size_t matchLength(const uint8_t *a, const uint8_t *b, const uint8_t *limit)
+{
+    const uint8_t *start = b;
+    while (b + 8 <= limit) {
+        uint64_t diff = load64(a) ^ load64(b);
+        if (0 != diff) {
+            return (size_t)(b - start) + ((unsigned)__builtin_ctzll(diff) >> 3);
+        }
+        a += 8;
+        b += 8;
+    }
+    while ((b < limit) && (*a == *b)) {
+        ++a;
+        ++b;
+    }
+    return (size_t)(b - start);
+}
+
+// Length field continuation:  255 per byte, then the remainder.
+static inline uint8_t *writeLength(uint8_t *op, size_t length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+// One sequence:  literals [anchor, ip), then (unless last) a match of matchLen at offset.
+// Returns the new output position, or NULL if it would pass oend.
+static uint8_t *writeSequence(uint8_t *op, uint8_t *oend, const uint8_t *anchor, size_t literals,
+        size_t offset, size_t matchLen, bool last)
+{
+    // Worst case:  token, literal length bytes, literals, offset, match length bytes.
+    size_t worst = 1 + literals / 255 + 1 + literals + 2 + matchLen / 255 + 1;
+    if ((size_t)(oend - op) < worst) {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)(((literals >= 15) ? 15 : literals) << 4);
+    if (literals >= 15) {
+        op = writeLength(op, literals - 15);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+    if (!last) {
+        *op++ = (uint8_t)(offset & 0xff);
+        *op++ = (uint8_t)(offset >> 8);
+        size_t code = matchLen - MinMatch;
+        *token |= (uint8_t)((code >= 15) ? 15 : code);
+        if (code >= 15) {
+            op = writeLength(op, code - 15);
+        }
+    }
+    return op;
+}
+
+size_t Lz4Block::compress(const char *src, size_t nBytes, char *dest, size_t capacity, uint32_t *table)
+{
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *end = base + nBytes;
+    const uint8_t *anchor = base;
+    uint8_t *op = (uint8_t *)dest;
+    uint8_t *oend = op + capacity;
+
+    if (nBytes > MatchFindLimit) {
+        const uint8_t *matchLimit = end - LastLiterals;
+        const uint8_t *findLimit = end - MatchFindLimit;
+        const uint8_t *ip = base;
+        while (ip < findLimit) {
+            uint32_t sequence = load32(ip);
+            uint32_t h = hash4(sequence);
+            size_t candidate = table[h];
+            size_t position = (size_t)(ip - base);
+            table[h] = (uint32_t)position;
+            if ((candidate < position) && (position - candidate <= MaxOffset)
+                    && (load32(base + candidate) == sequence)) {
+                const uint8_t *match = base + candidate;
+                // Extend backwards over literals that also match.
+                while ((ip > anchor) && (match > base) && (ip[-1] == match[-1])) {
+                    --ip;
+                    --match;
+                }
+                size_t length = MinMatch + matchLength(match + MinMatch, ip + MinMatch, matchLimit);
+                op = writeSequence(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - match), length, false);
+                if (NULL == op) {
+                    return 0;
+                }
+                ip += length;
+                anchor = ip;
+                // Index a position inside the match, for the next search.
+                if (ip < findLimit) {
+                    table[hash4(load32(ip - 2))] = (uint32_t)(ip - 2 - base);
+                }
+            } else {
+                ip += 1 + ((size_t)(ip - anchor) >> SkipShift);
+            }
+        }
+    }
+    op = writeSequence(op, oend, anchor, (size_t)(end - anchor), 0, 0, true);
+    return (NULL != op) ? (size_t)(op - (uint8_t *)dest) : 0;
+}
+
+bool Lz4Block::decompress(const char *src, size_t nBytes, char *dest, size_t rawSize)
+{
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + nBytes;
+    uint8_t *base = (uint8_t *)dest;
+    uint8_t *op = base;
+    uint8_t *oend = base + rawSize;
+
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (15 == literals) {
+            unsigned byte;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                byte = *ip++;
+                literals += byte;
+            } while (255 == byte);
+        }
+        if (((size_t)(iend - ip) < literals) || ((size_t)(oend - op) < literals)) {
+            return false;
+        }
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip == iend) {
+            break;              // Last sequence:  literals only
+        }
+
+        if ((size_t)(iend - ip) < 2) {
+            return false;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        size_t length = (token & 15);
+        if (15 == length) {
+            unsigned byte;
+            do {
+                if (ip >= iend) {
+                    return false;
+                }
+                byte = *ip++;
+                length += byte;
+            } while (255 == byte);
+        }
+        length += MinMatch;
+        if ((0 == offset) || (offset > (size_t)(op - base)) || ((size_t)(oend - op) < length)) {
+            return false;
+        }
+        const uint8_t *match = op - offset;
+        if (offset >= length) {
+            memcpy(op, match, length);
+            op += length;
+        } else {
+            // Overlapping:  the match repeats its last offset bytes.
+            for (size_t i = 0; i < length; ++i) {
+                *op++ = *match++;
+            }
+        }
+    }
+    return op == oend;
+}
@@ -0,0 +1,53 @@
+/****************************************************************************
+ *   FILENAME: Lz4Block.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: LZ4 block compression and decompression kernels for the compressed log files.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Our logs are highly repetitive text and the SD card's write bandwidth, not the CPU,
+ *       limits how much we can log.  LZ4 is the cheapest compressor that still removes most
+ *       of that repetition.  The target has no LZ4 library, so this is a small, self-contained
+ *       implementation of the LZ4 *block* format (sequences of token, literals, 16-bit match
+ *       offset, match length; see the LZ4 block format description), without the LZ4 frame
+ *       format around it:  the framing is ours (CompressingBackend.h).  Blocks are
+ *       decodable by liblz4's LZ4_decompress_safe().
+ *
+ *       compress() is the greedy single-pass LZ4 "fast" scheme:  a hash of the next 4 bytes
+ *       looks up the last position with the same hash; a verified match is extended forward
+ *       8 bytes at a time.  Incompressible stretches are skipped faster the longer they run.
+ *       It needs the caller's HashSize table (no allocation); the table need not be cleared
+ *       between blocks, because every candidate is verified against the data.
+ *
+ *       decompress() checks every length and offset against the buffers, so corrupt input
+ *       fails instead of overrunning.
+ *
+ ****************************************************************************/
+
+#ifndef LZ4_BLOCK_H
+#define LZ4_BLOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Lz4Block
+{
+public:
+    // Entries in the caller's hash table for compress().
+    static const size_t HashSize = 4096;
+
+    // Largest compressed size of nBytes of input (incompressible data grows slightly).
+    static size_t bound(size_t nBytes)
+    {
+        return nBytes + nBytes / 255 + 16;
+    }
+
+    // Compress nBytes of src into dest (capacity bytes).  table:  HashSize entries, contents
+    // irrelevant.  Returns compressed size, or 0 if it would exceed capacity.
+    // Defined in Lz4Block.cpp.
+    static size_t compress(const char *src, size_t nBytes, char *dest, size_t capacity, uint32_t *table);
+
+    // Decompress nBytes of src into exactly rawSize bytes at dest.  Returns false if src is not
+    // a valid block of that size.  Defined in Lz4Block.cpp.
+    static bool decompress(const char *src, size_t nBytes, char *dest, size_t rawSize);
+};
+
+#endif //ndef LZ4_BLOCK_H
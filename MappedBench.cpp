@@ -0,0 +1,165 @@
+/****************************************************************************
+ *   FILENAME: MappedBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  system calls per GiB and throughput of MappedFileBackend against
+ *            PosixFileBackend (write(2) per flush).
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  MappedBench [-d <directory>] [-m <MiB>]
+ *       Defaults:  current directory, 2048 MiB per run.  The output file (mbench.log) is
+ *       deleted after each run.
+ *
+ *       200-byte log lines go through a BasicBufferedFileWriter<65536> on each backend; the
+ *       mapped one has the default 16 MiB window and 64 MiB extend.  Reported per run:  MiB/s
+ *       (open to close, no sync), system calls per GiB (write(2) per flush; for the mapping
+ *       MappedFile::getStats():  mmap / munmap / madvise, fallocate, msync), and minor page
+ *       faults per GiB (getrusage(2)), which is where the mapping pays instead.  Exit code 1
+ *       if a file's content is wrong (size, and first and last line).
+ *
+ *       Builds for Linux hosts only (mmap(), getrusage()); not part of the target image.
+ *       Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "MappedFileBackend.h"
+#include "PosixFileBackend.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef MappedFileBackend<> MappedBackend;
+
+static const size_t LineSize = 200;
+static const size_t TextSize = 328 * LineSize;      // About 64 KiB of lines, repeated
+
+// PosixFileBackend, one write(2) per flush, counted.
+struct CountingPosixBackend : public PosixFileBackend
+{
+    static const bool SupportsGather = false;
+    static size_t calls;
+
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        ++calls;
+        return PosixFileBackend::write(file, data, nChars);
+    }
+};
+size_t CountingPosixBackend::calls = 0;
+
+// Statics:  the writers' buffers and the MappedFile do not belong on the stack.
+static BasicBufferedFileWriter<65536, 256, CountingPosixBackend> posixWriter;
+static BasicBufferedFileWriter<65536, 256, MappedBackend> mappedWriter;
+static MappedFile<> mappedFile;
+static char text[TextSize];
+
+static long minorFaults(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+template <class Writer>
+static void writeLines(Writer &writer, size_t total)
+{
+    for (size_t pos = 0; pos < total; pos += LineSize) {
+        writer.write(text + pos % TextSize, LineSize);
+    }
+    writer.flush();
+}
+
+// Check the file's size and its first and last line; print the result line.
+static bool report(const char *label, const char *path, size_t total, double seconds, size_t calls, long faults)
+{
+    bool retval = false;
+    char line[LineSize];
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if ((fd >= 0) && (0 == fstat(fd, &status)) && ((size_t)status.st_size == total)) {
+        retval = (pread(fd, line, LineSize, 0) == (ssize_t)LineSize) && (0 == memcmp(line, text, LineSize));
+        size_t last = total - LineSize;
+        retval = retval && (pread(fd, line, LineSize, (off_t)last) == (ssize_t)LineSize)
+                && (0 == memcmp(line, text + last % TextSize, LineSize));
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    double gibibytes = (double)total / (1024.0 * 1024.0 * 1024.0);
+    printf("%-8s %8.0f MiB/s %12.0f syscalls/GiB %12.0f faults/GiB%s\n", label,
+            (double)total / seconds / (1024.0 * 1024.0), (double)calls / gibibytes, (double)faults / gibibytes,
+            retval ? "" : "  FILE CONTENT MISMATCH");
+    unlink(path);
+    return retval;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = ".";
+    size_t mebibytes = 2048;
+    for (int arg = 1; arg < argc; ++arg) {
+        if ((0 == strcmp(argv[arg], "-d")) && (arg + 1 < argc)) {
+            directory = argv[++arg];
+        } else if ((0 == strcmp(argv[arg], "-m")) && (arg + 1 < argc)) {
+            mebibytes = strtoul(argv[++arg], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-d <directory>] [-m <MiB>]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (0 == mebibytes) {
+        fprintf(stderr, "usage: %s [-d <directory>] [-m <MiB>]\n", argv[0]);
+        return 2;
+    }
+    for (size_t pos = 0; pos < TextSize; pos += LineSize) {
+        snprintf(text + pos, LineSize, "2020-06-30T14:05:%02lu.%03luZ worker=%02lu req=%08lx %-140s",
+                (unsigned long)(pos / LineSize % 60), (unsigned long)(pos % 1000), (unsigned long)(pos % 32),
+                (unsigned long)(pos * 2654435761u), "cache miss, fetching from origin");
+        text[pos + LineSize - 1] = '\n';
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/mbench.log", directory);
+    size_t total = mebibytes * 1024 * 1024 / LineSize * LineSize;
+    printf("%lu MiB of %lu-byte lines to %s, 64 KiB writer buffer\n", (unsigned long)mebibytes,
+            (unsigned long)LineSize, path);
+
+    long faults = minorFaults();
+    Clock::time_point start = Clock::now();
+    int fd = PosixFileBackend::open(path);
+    if (fd < 0) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return 2;
+    }
+    CountingPosixBackend::calls = 0;
+    posixWriter.setFile(fd);
+    writeLines(posixWriter, total);
+    posixWriter.setFile(PosixFileBackend::noFile());
+    PosixFileBackend::close(fd);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    // open + close
+    bool ok = report("write()", path, total, seconds, CountingPosixBackend::calls + 2, minorFaults() - faults);
+
+    faults = minorFaults();
+    start = Clock::now();
+    if (!mappedFile.open(path)) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return 2;
+    }
+    mappedFile.resetStats();
+    mappedWriter.setFile(&mappedFile);
+    writeLines(mappedWriter, total);
+    mappedWriter.setFile(NULL);
+    MappedFile<>::Stats stats = mappedFile.getStats();
+    mappedFile.close();
+    seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    // open + close (with its unmap and ftruncate)
+    size_t calls = (size_t)stats.maps + stats.extends + stats.syncs + 4;
+    ok = report("mmap", path, total, seconds, calls, minorFaults() - faults) && ok;
+    return ok ? 0 : 1;
+}
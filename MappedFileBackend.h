@@ -0,0 +1,303 @@
+/****************************************************************************
+ *   FILENAME: MappedFileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: BasicBufferedFileWriter backend writing into a memory-mapped window of the file.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Each flush through PosixFileBackend is a write(2):  a system call plus the kernel's
+ *       copy into the page cache.  The handle of this backend is a MappedFile, which keeps a
+ *       WindowSize window of the file mapped (MAP_SHARED) and copies flushed data straight
+ *       into it:  the same one copy into page cache pages, but no system call.  System calls
+ *       are only made when the window moves on:
+ *        - the file is extended ahead of the data in ExtendSize chunks with fallocate(2), so
+ *          blocks are allocated before they are touched (a store to a page the file system
+ *          cannot back would be SIGBUS, not an error return); file systems without
+ *          fallocate() are extended with ftruncate(2) instead, and then full media is SIGBUS.
+ *        - the full window is unmapped and the next one mapped and populated writable
+ *          (madvise(MADV_POPULATE_WRITE); MAP_POPULATE alone only maps the pages read-only, so
+ *          every first store would still fault), so its pages do not fault one by one.
+ *       close() truncates the file to its true length.  Until then the file size is the
+ *       allocated size:  after a crash, the data is followed by zeros up to a chunk boundary.
+ *
+ *       Durability:  sync() (SupportsSync, used by FileCheckpointer) is msync(MS_SYNC) of the
+ *       part of the window written since the last sync, plus fdatasync(2) if earlier windows
+ *       were written since then.
+ *
+ *       The writers copy into the mapping from their own buffer; letting them format straight
+ *       into the mapping would make their fixed buffer a moving pointer (and does not fit the
+ *       buffer ring of BasicDoubleBufferedFileWriter).  Use a large writer buffer (64k or more)
+ *       so flushes, not the copies, stay rare.
+ *
+ *       getStats() counts the system calls made, for comparison with PosixFileBackend (one
+ *       write(2) per flush).  64-bit Linux (the address space for the window).
+ *
+ ****************************************************************************/
+
+#ifndef MAPPED_FILE_BACKEND_H
+#define MAPPED_FILE_BACKEND_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // fallocate()
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "FileBackend.h"
+
+template <size_t WindowSize = (16u << 20), size_t ExtendSize = (64u << 20)>
+class MappedFile
+{
+public:
+    static_assert((WindowSize % 65536) == 0, "WindowSize must be a multiple of 64k");
+    static_assert((ExtendSize % WindowSize) == 0, "ExtendSize must be a multiple of WindowSize");
+
+    // System calls since open() or the last resetStats().
+    struct Stats
+    {
+        uint32_t    maps;               // mmap(2) + munmap(2) + madvise(2)
+        uint32_t    extends;            // fallocate(2) / ftruncate(2)
+        uint32_t    syncs;              // msync(2) + fdatasync(2)
+    };
+
+    MappedFile(void);
+
+    // close()s if open.
+    ~MappedFile(void);
+
+    // Open name for write, creating it; truncate it unless append.  Returns false on error.
+    bool open(const char *name, bool append = false);
+
+    // Unmap, truncate to the true length and close.  Returns false on error (the file is
+    // closed).
+    bool close(void);
+
+    bool isOpen(void) { return fd >= 0; }
+
+    // Bytes written by write(), plus the length at open() with append.
+    uint64_t getLength(void) { return length; }
+
+    // Backend write:  returns nChars, or on error (the window could not be moved on) the
+    // bytes copied before it.
+    uint32_t write(const char *data, size_t nChars);
+
+    // msync(2) / fdatasync(2) everything written.  Returns true on success.
+    bool sync(void);
+
+    Stats getStats(void) { return stats; }
+
+    void resetStats(void);
+
+private:
+    // Block copy-ctor, assignment operator.
+    MappedFile(const MappedFile &obj);
+    MappedFile& operator=(const MappedFile& obj);
+
+    // Map the window holding length, extending the file first if needed.  Returns false on
+    // error.
+    bool moveWindow(void);
+
+    // Release the window.
+    void unmap(void);
+
+    int         fd;
+    // True length of the file
+    uint64_t    length;
+    // File size:  allocated up to here
+    uint64_t    allocated;
+    // Mapped window, NULL if none
+    char *      window;
+    uint64_t    windowStart;
+    // Data up to here is durable (sync())
+    uint64_t    synced;
+    Stats       stats;
+};
+
+template <size_t WindowSize = (16u << 20), size_t ExtendSize = (64u << 20)>
+struct MappedFileBackend : public FileBackendDefaults
+{
+    typedef MappedFile<WindowSize, ExtendSize> * Handle;
+
+    static const bool SupportsSync = true;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Returns number of bytes written.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return file->write(data, nChars);
+    }
+
+    static bool sync(Handle file)
+    {
+        return file->sync();
+    }
+};
+
+
+template <size_t WindowSize, size_t ExtendSize>
+MappedFile<WindowSize, ExtendSize>::MappedFile(void)
+    : fd(-1), length(0), allocated(0), window(NULL), windowStart(0), synced(0)
+{
+    resetStats();
+}
+
+template <size_t WindowSize, size_t ExtendSize>
+MappedFile<WindowSize, ExtendSize>::~MappedFile(void)
+{
+    if (fd >= 0) {
+        close();
+    }
+}
+
+// The window is mapped by the first write().
+template <size_t WindowSize, size_t ExtendSize>
+bool MappedFile<WindowSize, ExtendSize>::open(const char *name, bool append)
+{
+    bool retval = false;
+    if (fd < 0) {
+        // O_RDWR:  a shared writable mapping needs a descriptor open for reading.
+        fd = ::open(name, O_RDWR | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+        if (fd >= 0) {
+            struct stat status;
+            retval = (0 == fstat(fd, &status));
+            length = retval ? (uint64_t)status.st_size : 0;
+            allocated = length;
+            synced = length;
+            resetStats();
+            if (!retval) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+    return retval;
+}
+
+template <size_t WindowSize, size_t ExtendSize>
+bool MappedFile<WindowSize, ExtendSize>::close(void)
+{
+    bool retval = false;
+    if (fd >= 0) {
+        unmap();
+        retval = (0 == ftruncate(fd, (off_t)length));
+        retval = (0 == ::close(fd)) && retval;
+        fd = -1;
+    }
+    return retval;
+}
+
+template <size_t WindowSize, size_t ExtendSize>
+uint32_t MappedFile<WindowSize, ExtendSize>::write(const char *data, size_t nChars)
+{
+    size_t written = 0;
+    bool ok = (fd >= 0);
+    while (ok && (written < nChars)) {
+        if ((NULL == window) || (length >= windowStart + WindowSize)) {
+            ok = moveWindow();
+        }
+        if (ok) {
+            size_t room = (size_t)(windowStart + WindowSize - length);
+            size_t chunk = ((nChars - written) < room) ? (nChars - written) : room;
+            memcpy(window + (length - windowStart), data + written, chunk);
+            written += chunk;
+            length += chunk;
+        }
+    }
+    // A failed window move leaves the bytes already copied written (and counted in length).
+    return (uint32_t)written;
+}
+
+// msync() only reaches the current window; earlier windows are still dirty in the page cache
+// after munmap(), and fdatasync() writes them.
+template <size_t WindowSize, size_t ExtendSize>
+bool MappedFile<WindowSize, ExtendSize>::sync(void)
+{
+    bool retval = (fd >= 0);
+    if (retval && (length > synced)) {
+        if (synced < windowStart) {
+            retval = (0 == fdatasync(fd));
+            ++stats.syncs;
+        }
+        if (retval && (NULL != window) && (length > windowStart)) {
+            uint64_t from = (synced > windowStart) ? synced : windowStart;
+            // msync() wants a page-aligned start.
+            from -= (from - windowStart) % (uint64_t)sysconf(_SC_PAGESIZE);
+            retval = (0 == msync(window + (from - windowStart), (size_t)(length - from), MS_SYNC));
+            ++stats.syncs;
+        }
+        if (retval) {
+            synced = length;
+        }
+    }
+    return retval;
+}
+
+template <size_t WindowSize, size_t ExtendSize>
+void MappedFile<WindowSize, ExtendSize>::resetStats(void)
+{
+    stats.maps = 0;
+    stats.extends = 0;
+    stats.syncs = 0;
+}
+
+// Windows start at multiples of WindowSize, so with append the first window may begin before
+// the old end of file.
+template <size_t WindowSize, size_t ExtendSize>
+bool MappedFile<WindowSize, ExtendSize>::moveWindow(void)
+{
+    unmap();
+    uint64_t start = length - (length % WindowSize);
+    bool retval = true;
+    if (allocated < start + WindowSize) {
+        uint64_t size = start + ExtendSize;
+        int result = fallocate(fd, 0, (off_t)allocated, (off_t)(size - allocated));
+        if ((0 != result) && (EOPNOTSUPP == errno)) {
+            result = ftruncate(fd, (off_t)size);
+        }
+        ++stats.extends;
+        retval = (0 == result);
+        if (retval) {
+            allocated = size;
+        }
+    }
+    if (retval) {
+#ifdef MADV_POPULATE_WRITE
+        void *map = mmap(NULL, WindowSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)start);
+#else
+        void *map = mmap(NULL, WindowSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                (off_t)start);
+#endif
+        ++stats.maps;
+        retval = (MAP_FAILED != map);
+        if (retval) {
+#ifdef MADV_POPULATE_WRITE
+            // Kernels before 5.14 refuse it and fault page by page.
+            madvise(map, WindowSize, MADV_POPULATE_WRITE);
+            ++stats.maps;
+#endif
+            window = (char *)map;
+            windowStart = start;
+        }
+    }
+    return retval;
+}
+
+template <size_t WindowSize, size_t ExtendSize>
+void MappedFile<WindowSize, ExtendSize>::unmap(void)
+{
+    if (NULL != window) {
+        munmap(window, WindowSize);
+        ++stats.maps;
+        window = NULL;
+    }
+}
+
+#endif //ndef MAPPED_FILE_BACKEND_H
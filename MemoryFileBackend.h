@@ -0,0 +1,74 @@
+/****************************************************************************
+ *   FILENAME: MemoryFileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: In-memory BasicBufferedFileWriter backends, for tests and benchmarks.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       MemoryFileBackend appends to a caller-supplied array described by a MemorySink;
+ *       bytes beyond the array's capacity are dropped.  Returns the number of bytes stored.
+ *
+ *       NullFileBackend discards data and only counts bytes and calls in a NullSink, so that
+ *       benchmarks measure the buffering layer's own overhead without any I/O.
+ *
+ ****************************************************************************/
+
+#ifndef MEMORY_FILE_BACKEND_H
+#define MEMORY_FILE_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "FileBackend.h"
+
+struct MemorySink
+{
+    char *      data;           // Caller's storage
+    size_t      capacity;       // Size of data
+    size_t      size;           // Bytes stored
+};
+
+struct MemoryFileBackend : public FileBackendDefaults
+{
+    typedef MemorySink * Handle;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Returns number of bytes stored.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        size_t space = file->capacity - file->size;
+        size_t count = (nChars < space) ? nChars : space;
+        memcpy(file->data + file->size, data, count);
+        file->size += count;
+        return (uint32_t)count;
+    }
+};
+
+struct NullSink
+{
+    size_t      bytes;          // Bytes written
+    size_t      writes;         // Number of write() calls
+};
+
+struct NullFileBackend : public FileBackendDefaults
+{
+    typedef NullSink * Handle;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Returns nChars.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        (void)data;
+        file->bytes += nChars;
+        ++file->writes;
+        return (uint32_t)nChars;
+    }
+};
+
+#endif //ndef MEMORY_FILE_BACKEND_H
@@ -0,0 +1,158 @@
+/****************************************************************************
+ *   FILENAME: MultiProducerBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  contention benchmark of MultiProducerFileWriter against a writer
+ *            shared under a mutex, for 1 to 32 producer threads.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  MultiProducerBench [-r <records per run>] [-t <threads>]...
+ *       Defaults:  2000000 records per run, split between the threads; 1, 2, 4, 8, 16 and 32
+ *       threads.
+ *
+ *       Every producer writes log lines by vprintf() (about 80 bytes each):
+ *           mutex:  all producers lock one std::mutex around the writer's vprintf()
+ *           ring:   MultiProducerFileWriter; one consumer thread drain()s it into the writer
+ *       The writer is a BasicBufferedFileWriter<65536> on NullFileBackend, so the file
+ *       system is not timed.  Reported per thread count:  records/s for each, and the byte
+ *       totals must match (exit code 1 if not).
+ *
+ *       Scaling needs as many cores as threads; on fewer cores the producers time-share.
+ *
+ *       Builds for the host only (threads, <chrono>); not part of the target image.
+ *       Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "BasicBufferedFileWriter.h"
+#include "MemoryFileBackend.h"
+#include "MultiProducerFileWriter.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef BasicBufferedFileWriter<65536, 2048, NullFileBackend> Writer;
+
+static const size_t MaxRuns = 8;
+static const size_t MaxThreads = 32;
+
+static Writer writer;
+static std::mutex writerLock;
+static MultiProducerFileWriter<Writer> ring(writer);
+
+// The mutex-wrapped writer, as shared writers are used without the ring.
+static int lockedPrintf(const char *fmt, ...)
+{
+    va_list arglist;
+    va_start(arglist, fmt);
+    std::lock_guard<std::mutex> guard(writerLock);
+    int retval = writer.vprintf(fmt, arglist);
+    va_end(arglist);
+    return retval;
+}
+
+static int ringPrintf(const char *fmt, ...)
+{
+    va_list arglist;
+    va_start(arglist, fmt);
+    int retval = ring.vprintf(fmt, arglist);
+    va_end(arglist);
+    return retval;
+}
+
+template <class Print>
+static void produce(unsigned id, size_t records, Print print)
+{
+    for (size_t i = 0; i < records; ++i) {
+        print("thread %02u seq %8lu temperature=%d.%02d state=%s\n", id, (unsigned long)i,
+                (int)(i % 90), (int)(i % 100), (0 == i % 16) ? "WARN" : "OK");
+    }
+}
+
+// Run threads producers of records / threads lines each; returns records per second and
+// the bytes that reached the writer.
+template <class Print>
+static double recordsPerSecond(unsigned threads, size_t records, Print print, bool useRing, size_t *bytes)
+{
+    NullSink sink = { 0, 0 };
+    writer.setFile(&sink);
+    writer.resetBytesWrittenTotal();
+    size_t perThread = records / threads;
+    std::atomic<bool> producing(true);
+    std::thread consumer;
+    Clock::time_point start = Clock::now();
+    if (useRing) {
+        consumer = std::thread([&producing] {
+            while (producing.load(std::memory_order_acquire)) {
+                if (0 == ring.drain()) {
+                    std::this_thread::yield();
+                }
+            }
+            ring.flush();
+        });
+    }
+    std::thread producers[MaxThreads];
+    for (unsigned i = 0; i < threads; ++i) {
+        producers[i] = std::thread([=] { produce(i, perThread, print); });
+    }
+    for (unsigned i = 0; i < threads; ++i) {
+        producers[i].join();
+    }
+    producing.store(false, std::memory_order_release);
+    if (useRing) {
+        consumer.join();
+    } else {
+        writer.flush();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    *bytes = sink.bytes;
+    writer.setFile(NULL);
+    return (double)(perThread * threads) / seconds;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t records = 2000000;
+    unsigned threadCounts[MaxRuns];
+    size_t nRuns = 0;
+    for (int arg = 1; arg < argc; ++arg) {
+        if ((0 == strcmp(argv[arg], "-r")) && (arg + 1 < argc)) {
+            records = strtoul(argv[++arg], NULL, 0);
+        } else if ((0 == strcmp(argv[arg], "-t")) && (arg + 1 < argc) && (nRuns < MaxRuns)) {
+            threadCounts[nRuns++] = (unsigned)strtoul(argv[++arg], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-r <records per run>] [-t <threads>]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (0 == nRuns) {
+        static const unsigned defaults[] = { 1, 2, 4, 8, 16, 32 };
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) {
+            threadCounts[nRuns++] = defaults[i];
+        }
+    }
+    int retval = 0;
+    printf("threads     mutex records/s     ring records/s\n");
+    for (size_t run = 0; run < nRuns; ++run) {
+        unsigned threads = threadCounts[run];
+        if ((0 == threads) || (threads > MaxThreads)) {
+            fprintf(stderr, "threads:  1 to %u\n", (unsigned)MaxThreads);
+            return 2;
+        }
+        size_t mutexBytes = 0;
+        size_t ringBytes = 0;
+        double mutexRate = recordsPerSecond(threads, records, lockedPrintf, false, &mutexBytes);
+        double ringRate = recordsPerSecond(threads, records, ringPrintf, true, &ringBytes);
+        printf("%7u %19.0f %18.0f%s\n", threads, mutexRate, ringRate,
+                (mutexBytes == ringBytes) ? "" : "  BYTE COUNT MISMATCH");
+        if (mutexBytes != ringBytes) {
+            retval = 1;
+        }
+    }
+    return retval;
+}
@@ -0,0 +1,269 @@
+/****************************************************************************
+ *   FILENAME: MultiProducerFileWriter.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Lock-free multi-producer front end for BufferedFileWriter.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       BufferedFileWriter (and DoubleBufferedFileWriter) have no synchronization; sharing
+ *       one between threads otherwise needs a mutex that every logging thread contends on.
+ *
+ *       This front end is a staging ring shared by any number of producer threads and
+ *       drained by a single consumer thread into the wrapped writer:
+ *        - A producer reserves a contiguous region with one atomic fetch-add on the ring
+ *          head, formats (or copies) its record into the region, then commits it.
+ *        - The consumer calls drain() (or flush()), which passes committed records to
+ *          Writer::write() in reservation order and releases their ring space.
+ *       Records are never interleaved:  each committed record reaches the file intact.
+ *
+ *       Each record is preceded by an 8-byte header and padded to a multiple of 8 bytes.
+ *       A reservation that would straddle the end of the ring is turned into a padding
+ *       record and the producer reserves again, so regions are always contiguous.
+ *
+ *       vprintf() reserves LineReserveSize bytes (enough for a typical log line) and formats
+ *       into them; a longer line turns that region into padding and is formatted a second
+ *       time into a LineBuffSize region.  The ring holds as many lines in flight as fit at
+ *       their reserved size, so reserving LineBuffSize per line would leave room for only a
+ *       few and make producers wait on the consumer.
+ *
+ *       When the ring is full, producers spin (yielding) until the consumer frees space, so
+ *       the consumer must run on a thread that never waits on a producer.
+ *
+ *       The wrapped writer must only be used by the consumer thread.
+ *
+ *       RingSize must be a power of two.  Records larger than MaxRecordSize are rejected.
+ *
+ ****************************************************************************/
+
+#ifndef MULTI_PRODUCER_FILE_WRITER_H
+#define MULTI_PRODUCER_FILE_WRITER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#ifndef _ATTRIBUTE
+#define _ATTRIBUTE(attrs) __attribute__ (attrs)
+#endif
+
+template <class Writer, size_t RingSize = 16384>
+class MultiProducerFileWriter
+{
+public:
+    enum WriteResult {
+        WriteTooLarge = UINT32_MAX - 1  // Record larger than MaxRecordSize; nothing written
+    };
+
+    // Size of the per-record header in the ring.
+    static const size_t HeaderSize = 8;
+    // Largest record (payload) accepted by reserve() / write().
+    static const size_t MaxRecordSize = RingSize / 2 - HeaderSize;
+    // Longest line produced by vprintf().
+    static const size_t LineBuffSize = Writer::LineBuffSize;
+    // Region vprintf() reserves first; longer lines are formatted again (see file header).
+    static const size_t LineReserveSize = (LineBuffSize + 1 < 256) ? (LineBuffSize + 1) : 256;
+
+    explicit MultiProducerFileWriter(Writer &_writer);
+
+    // Producer:  reserve a contiguous region of nChars bytes.  Spins while the ring is full.
+    // Returns NULL if nChars > MaxRecordSize.  Every non-NULL reservation must be committed.
+    char *reserve(size_t nChars);
+
+    // Producer:  commit a region returned by reserve(), of which the first used bytes
+    // (used <= reserved size) are to be written.
+    void commit(char *region, size_t used);
+
+    // Producer:  copy (binary) data into the ring as one record.
+    // Returns 0, or WriteTooLarge if nChars > MaxRecordSize.
+    uint32_t write(const char *source, size_t nChars);
+
+    // Producer:  write string as one record, length from strlen().  Writes 0 bytes for NULL string.
+    // Return code as for write().
+    uint32_t writeStr(const char *string);
+
+    // Producer:  vprintf formatting directly into a reserved region, as one record.
+    // Lines longer than LineReserveSize - 1 are formatted twice.
+    // Lines are truncated to LineBuffSize characters.  Returns number of bytes written.
+    int vprintf(const char * fmt, va_list arglist)
+            _ATTRIBUTE ((__format__ (__printf__, 2, 0)));
+
+    // Consumer:  pass every committed record, up to the first uncommitted one, to the writer.
+    // Returns number of payload bytes passed to the writer.
+    size_t drain(void);
+
+    // Consumer:  drain(), then flush the writer.  Returns Writer::flush() return code.
+    uint32_t flush(void);
+
+private:
+    // Block copy-ctor, assignment operator.
+    MultiProducerFileWriter(const MultiProducerFileWriter &obj);
+    MultiProducerFileWriter& operator=(const MultiProducerFileWriter& obj);
+
+    // Header word 0:  0 until committed, then CommittedFlag | payload length, or PaddingFlag.
+    // Header word 1:  size of the record in the ring, header and padding included.
+    static const uint32_t CommittedFlag = 0x80000000u;
+    static const uint32_t PaddingFlag = 0x40000000u;
+    static const uint32_t LengthMask = 0x3fffffffu;
+    static const size_t RingMask = RingSize - 1;
+
+    static_assert((RingSize & RingMask) == 0, "RingSize must be a power of two");
+    static_assert(RingSize >= 4 * HeaderSize, "RingSize too small");
+
+    uint32_t *headerAt(size_t offset) { return reinterpret_cast<uint32_t *>(ring + offset); }
+
+    // Zero ring bytes [offset, offset + count), wrapping at the end of the ring.
+    void zeroRing(size_t offset, size_t count);
+
+    Writer &    writer;
+    // Staging ring; zero except for live records.
+    alignas(64) char ring[RingSize];
+    // Ring position of the next reservation; producers only.
+    alignas(64) std::atomic<uint64_t> head;
+    // Ring position up to which space has been released; written by the consumer only.
+    alignas(64) std::atomic<uint64_t> tail;
+};
+
+
+template <class Writer, size_t RingSize>
+MultiProducerFileWriter<Writer, RingSize>::MultiProducerFileWriter(Writer &_writer)
+    : writer(_writer), head(0), tail(0)
+{
+    memset(ring, 0, sizeof(ring));
+}
+
+// Reserve with fetch-add; wait for the consumer to free the space; if the region straddles
+// the end of the ring, mark it as padding and reserve again.
+template <class Writer, size_t RingSize>
+char *MultiProducerFileWriter<Writer, RingSize>::reserve(size_t nChars)
+{
+    char *region = NULL;
+    if (nChars <= MaxRecordSize) {
+        size_t recordSize = HeaderSize + ((nChars + 7) & ~(size_t)7);
+        while (NULL == region) {
+            uint64_t pos = head.fetch_add(recordSize, std::memory_order_relaxed);
+            while (pos + recordSize - tail.load(std::memory_order_acquire) > RingSize) {
+                std::this_thread::yield();
+            }
+            size_t offset = (size_t)(pos & RingMask);
+            uint32_t *header = headerAt(offset);
+            header[1] = (uint32_t)recordSize;
+            if (offset + recordSize <= RingSize) {
+                region = ring + offset + HeaderSize;
+            } else {
+                __atomic_store_n(&header[0], PaddingFlag, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    return region;
+}
+
+template <class Writer, size_t RingSize>
+void MultiProducerFileWriter<Writer, RingSize>::commit(char *region, size_t used)
+{
+    uint32_t *header = reinterpret_cast<uint32_t *>(region - HeaderSize);
+    __atomic_store_n(&header[0], CommittedFlag | (uint32_t)used, __ATOMIC_RELEASE);
+}
+
+template <class Writer, size_t RingSize>
+uint32_t MultiProducerFileWriter<Writer, RingSize>::write(const char *source, size_t nChars)
+{
+    uint32_t retval = 0;
+    char *region = reserve(nChars);
+    if (NULL == region) {
+        retval = WriteTooLarge;
+    } else {
+        memcpy(region, source, nChars);
+        commit(region, nChars);
+    }
+    return retval;
+}
+
+template <class Writer, size_t RingSize>
+uint32_t MultiProducerFileWriter<Writer, RingSize>::writeStr(const char *string)
+{
+    uint32_t retval = 0;
+    if (NULL != string) {
+        retval = write(string, strlen(string));
+    }
+    return retval;
+}
+
+// Formats straight into a LineReserveSize region (one byte extra for vsnprintf()'s
+// terminator) and commits only the characters produced.  If the line does not fit, the region
+// becomes padding (the consumer zeroes it) and the line is formatted again into a region for
+// the longest line.
+template <class Writer, size_t RingSize>
+int MultiProducerFileWriter<Writer, RingSize>::vprintf(const char *fmt, va_list arglist)
+{
+    static_assert(LineBuffSize + 1 <= MaxRecordSize, "RingSize too small for LineBuffSize");
+    int retval = 0;
+    if (NULL != fmt) {
+        va_list retryArgs;
+        va_copy(retryArgs, arglist);
+        char *region = reserve(LineReserveSize);
+        int nChars = vsnprintf(region, LineReserveSize, fmt, arglist);
+        if ((nChars >= 0) && ((size_t)nChars >= LineReserveSize)) {
+            uint32_t *header = reinterpret_cast<uint32_t *>(region - HeaderSize);
+            __atomic_store_n(&header[0], PaddingFlag, __ATOMIC_RELEASE);
+            region = reserve(LineBuffSize + 1);
+            nChars = vsnprintf(region, LineBuffSize + 1, fmt, retryArgs);
+        }
+        va_end(retryArgs);
+        if (nChars < 0) {
+            nChars = 0;
+        } else if ((size_t)nChars > LineBuffSize) {
+            nChars = (int)LineBuffSize;
+        }
+        commit(region, (size_t)nChars);
+        retval = nChars;
+    }
+    return retval;
+}
+
+// Records are consumed in ring order; each is zeroed before its space is released so that
+// stale bytes are never mistaken for a committed header.
+template <class Writer, size_t RingSize>
+size_t MultiProducerFileWriter<Writer, RingSize>::drain(void)
+{
+    size_t drained = 0;
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+        size_t offset = (size_t)(pos & RingMask);
+        uint32_t *header = headerAt(offset);
+        uint32_t state = __atomic_load_n(&header[0], __ATOMIC_ACQUIRE);
+        if (0 == state) {
+            break;
+        }
+        size_t recordSize = header[1];
+        if (0 != (state & CommittedFlag)) {
+            size_t length = state & LengthMask;
+            writer.write(ring + offset + HeaderSize, length);
+            drained += length;
+        }
+        zeroRing(offset, recordSize);
+        pos += recordSize;
+        tail.store(pos, std::memory_order_release);
+    }
+    return drained;
+}
+
+template <class Writer, size_t RingSize>
+uint32_t MultiProducerFileWriter<Writer, RingSize>::flush(void)
+{
+    drain();
+    return writer.flush();
+}
+
+template <class Writer, size_t RingSize>
+void MultiProducerFileWriter<Writer, RingSize>::zeroRing(size_t offset, size_t count)
+{
+    if (offset + count <= RingSize) {
+        memset(ring + offset, 0, count);
+    } else {
+        memset(ring + offset, 0, RingSize - offset);
+        memset(ring, 0, offset + count - RingSize);
+    }
+}
+
+#endif //ndef MULTI_PRODUCER_FILE_WRITER_H
@@ -0,0 +1,414 @@
+/****************************************************************************
+ *   FILENAME: NumberFormat.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Fast number-to-text conversion kernels for the file writers.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       See .h file.
+ *
+ *       formatDouble() is Grisu3 with the 64-bit "DiyFp" arithmetic of the paper:  the
+ *       double's boundaries are scaled by a cached power of ten into a fixed window, digits
+ *       are generated from the upper boundary until inside the rounding interval, and the
+ *       last digit is nudged toward the exact value.  64x64-bit products are built from
+ *       32-bit halves, so no 128-bit type is needed.  The scaled boundaries are each off by
+ *       up to one unit; Grisu3 widens the interval by that unit and rejects any result the
+ *       error could make wrong or not shortest (about 0.5% of doubles).  Those are converted
+ *       exactly by snprintf() "%.*e", shortest precision first, checked with strtod().
+ *
+ *       formatHexDumpLine() with SSE2 converts a full line's 16 bytes to hex digits in one
+ *       register (nibble + '0', plus 39 where the nibble is above 9), interleaves the digit
+ *       pairs with spaces into 4-byte lanes, and stores the lanes 3 bytes apart so that each
+ *       store's trailing space is overwritten by the next pair.  The ASCII column is one
+ *       compare-and-select.  AVX2 would not help:  a line is only 16 bytes, and the cost
+ *       left is the 16 lane stores, not the conversion.
+ *
+ *       The cached powers 10^k (k = -348, -340, ..., 340) were generated exactly (Python,
+ *       integer arithmetic) as 64-bit normalized significands rounded to nearest, with their
+ *       binary exponents.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "NumberFormat.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Do-it-yourself floating point:  f * 2^e, no implicit bit, no sign.
+struct DiyFp
+{
+    uint64_t    f;
+    int         e;
+};
+
+static const uint64_t SignificandMask = 0x000fffffffffffffULL;
+static const uint64_t HiddenBit = 0x0010000000000000ULL;
+static const int ExponentBias = 0x3ff + 52;
+
+static const uint64_t cachedPowersF[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+    0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t cachedPowersE[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927, -901, -874, -847, -821,
+    -794, -768, -741, -715, -688, -661, -635, -608, -582, -555, -529, -502, -475, -449, -422, -396,
+    -369, -343, -316, -289, -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348, 375, 402, 428, 455,
+    481, 508, 534, 561, 588, 614, 641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+// Product, rounded, of two DiyFps; keeps the upper 64 bits.
+static DiyFp multiply(const DiyFp &x, const DiyFp &y)
+{
+    const uint64_t mask32 = 0xffffffffULL;
+    uint64_t a = x.f >> 32;
+    uint64_t b = x.f & mask32;
+    uint64_t c = y.f >> 32;
+    uint64_t d = y.f & mask32;
+    uint64_t ac = a * c;
+    uint64_t bc = b * c;
+    uint64_t ad = a * d;
+    uint64_t bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & mask32) + (bc & mask32) + (1ULL << 31);
+    DiyFp product;
+    product.f = ac + (ad >> 32) + (bc >> 32) + (middle >> 32);
+    product.e = x.e + y.e + 64;
+    return product;
+}
+
+// Shift left until the top bit is set.
+static DiyFp normalize(DiyFp x)
+{
+    while (0 == (x.f & (1ULL << 63))) {
+        x.f <<= 1;
+        --x.e;
+    }
+    return x;
+}
+
+// Value (finite, positive) and the midpoints to its neighbours, normalized to a common exponent.
+static void boundaries(double value, DiyFp &v, DiyFp &minus, DiyFp &plus)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biasedExponent = (int)((bits >> 52) & 0x7ff);
+    uint64_t significand = bits & SignificandMask;
+    if (0 != biasedExponent) {
+        v.f = significand + HiddenBit;
+        v.e = biasedExponent - ExponentBias;
+    } else {
+        v.f = significand;
+        v.e = 1 - ExponentBias;
+    }
+    plus.f = (v.f << 1) + 1;
+    plus.e = v.e - 1;
+    plus = normalize(plus);
+    // The gap below is half as large when v is an exact power of two (and not the smallest).
+    if ((HiddenBit == v.f) && (biasedExponent > 1)) {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    } else {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    v = normalize(v);
+}
+
+// Cached power c = 10^-K such that e + c.e lands in [-60, -32].
+static DiyFp cachedPower(int e, int &K)
+{
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0) {
+        ++k;
+    }
+    unsigned index = (unsigned)((k >> 3) + 1);
+    K = -(-348 + (int)(index << 3));
+    DiyFp power;
+    power.f = cachedPowersF[index];
+    power.e = cachedPowersE[index];
+    return power;
+}
+
+// Move the last digit down while that brings the digits closer to the exact value and keeps
+// them inside the unsafe interval; then check that the unit of error cannot change the result
+// (Grisu3 "round_weed").  distance is from the upper bound of the unsafe interval to the
+// scaled value.  Returns false if the digits may not be the closest shortest ones.
+static bool grisuRound(char *digits, size_t nDigits, uint64_t distance, uint64_t unsafeInterval,
+        uint64_t rest, uint64_t tenKappa, uint64_t unit)
+{
+    uint64_t smallDistance = distance - unit;
+    uint64_t bigDistance = distance + unit;
+    while ((rest < smallDistance) && (unsafeInterval - rest >= tenKappa)
+            && ((rest + tenKappa < smallDistance) || (smallDistance - rest >= rest + tenKappa - smallDistance))) {
+        --digits[nDigits - 1];
+        rest += tenKappa;
+    }
+    // Would the exact value be closer to the next lower digit?  Then the error decides.
+    if ((rest < bigDistance) && (unsafeInterval - rest >= tenKappa)
+            && ((rest + tenKappa < bigDistance) || (bigDistance - rest > rest + tenKappa - bigDistance))) {
+        return false;
+    }
+    // The digits must be safely inside the interval, error included.
+    return (2 * unit <= rest) && (rest <= unsafeInterval - 4 * unit);
+}
+
+// Generate the digits of the upper bound of the unsafe interval (high plus one unit) until
+// within the interval.  Adds the decimal exponent of the last digit to K.  Returns false if
+// the result is uncertain (see grisuRound()).
+static bool digitGen(const DiyFp &low, const DiyFp &W, const DiyFp &high, char *digits, size_t &nDigits, int &K)
+{
+    const int shift = -W.e;
+    const uint64_t one = 1ULL << shift;
+    uint64_t unit = 1;
+    const uint64_t tooHigh = high.f + unit;
+    uint64_t unsafeInterval = tooHigh - (low.f - unit);
+    const uint64_t distance = tooHigh - W.f;
+    uint32_t integral = (uint32_t)(tooHigh >> shift);
+    uint64_t fraction = tooHigh & (one - 1);
+    int kappa = (int)NumberFormat::decDigits(integral);
+    nDigits = 0;
+
+    while (kappa > 0) {
+        uint32_t divisor = (uint32_t)NumberFormat::powerOf10((unsigned)kappa - 1);
+        digits[nDigits++] = (char)('0' + integral / divisor);
+        integral %= divisor;
+        --kappa;
+        uint64_t rest = ((uint64_t)integral << shift) + fraction;
+        if (rest < unsafeInterval) {
+            K += kappa;
+            return grisuRound(digits, nDigits, distance, unsafeInterval, rest, (uint64_t)divisor << shift, unit);
+        }
+    }
+
+    for (;;) {
+        fraction *= 10;
+        unit *= 10;
+        unsafeInterval *= 10;
+        digits[nDigits++] = (char)('0' + (fraction >> shift));
+        fraction &= one - 1;
+        --kappa;
+        if (fraction < unsafeInterval) {
+            K += kappa;
+            return grisuRound(digits, nDigits, distance * unit, unsafeInterval, fraction, one, unit);
+        }
+    }
+}
+
+// Exact fallback:  the shortest correctly rounded %e that reads back as value (finite,
+// positive).  Returns number of digits, and their decimal exponent in K.
+static size_t exactDigits(double value, char *digits, int &K)
+{
+    char text[32];
+    for (int precision = 0; precision < 17; ++precision) {
+        snprintf(text, sizeof(text), "%.*e", precision, value);
+        if (strtod(text, NULL) == value) {
+            break;
+        }
+    }
+    // text is "d.ddde+XX" (no '.' for one digit).
+    size_t nDigits = 0;
+    const char *pos = text;
+    for (; 'e' != *pos; ++pos) {
+        if ('.' != *pos) {
+            digits[nDigits++] = *pos;
+        }
+    }
+    K = atoi(pos + 1) - (int)(nDigits - 1);
+    return nDigits;
+}
+
+// Write exponent as printf():  sign and at least two digits.
+static size_t writeExponent(char *dest, int exponent)
+{
+    size_t nChars = 0;
+    dest[nChars++] = 'e';
+    if (exponent < 0) {
+        dest[nChars++] = '-';
+        exponent = -exponent;
+    } else {
+        dest[nChars++] = '+';
+    }
+    if (exponent < 10) {
+        dest[nChars++] = '0';
+    }
+    return nChars + NumberFormat::formatDec(dest + nChars, exponent);
+}
+
+// Lay out digits * 10^K as %g would:  decimal point placement, or exponent form.
+static size_t layout(char *dest, const char *digits, size_t nDigits, int K)
+{
+    int exponent = (int)nDigits + K - 1;      // Decimal exponent of the first digit
+    size_t nChars = 0;
+    if ((exponent < -4) || (exponent >= 17)) {
+        dest[nChars++] = digits[0];
+        if (nDigits > 1) {
+            dest[nChars++] = '.';
+            memcpy(dest + nChars, digits + 1, nDigits - 1);
+            nChars += nDigits - 1;
+        }
+        nChars += writeExponent(dest + nChars, exponent);
+    } else if (exponent < 0) {
+        dest[nChars++] = '0';
+        dest[nChars++] = '.';
+        for (int i = -1; i > exponent; --i) {
+            dest[nChars++] = '0';
+        }
+        memcpy(dest + nChars, digits, nDigits);
+        nChars += nDigits;
+    } else if ((size_t)exponent + 1 >= nDigits) {
+        memcpy(dest, digits, nDigits);
+        nChars = nDigits;
+        while (nChars < (size_t)exponent + 1) {
+            dest[nChars++] = '0';
+        }
+    } else {
+        memcpy(dest, digits, (size_t)exponent + 1);
+        nChars = (size_t)exponent + 1;
+        dest[nChars++] = '.';
+        memcpy(dest + nChars, digits + exponent + 1, nDigits - (size_t)exponent - 1);
+        nChars += nDigits - (size_t)exponent - 1;
+    }
+    return nChars;
+}
+
+size_t NumberFormat::formatDouble(char *dest, double value)
+{
+    size_t nChars = 0;
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (0 != (bits >> 63)) {
+        dest[nChars++] = '-';
+        bits &= ~(1ULL << 63);
+        memcpy(&value, &bits, sizeof(value));
+    }
+    if (((bits >> 52) & 0x7ff) == 0x7ff) {
+        memcpy(dest + nChars, (0 != (bits & SignificandMask)) ? "nan" : "inf", 3);
+        nChars += 3;
+    } else if (0 == bits) {
+        dest[nChars++] = '0';
+    } else {
+        DiyFp v;
+        DiyFp minus;
+        DiyFp plus;
+        boundaries(value, v, minus, plus);
+        int K;
+        DiyFp power = cachedPower(plus.e, K);
+        DiyFp W = multiply(v, power);
+        DiyFp Wp = multiply(plus, power);
+        DiyFp Wm = multiply(minus, power);
+        char digits[20];
+        size_t nDigits;
+        if (!digitGen(Wm, W, Wp, digits, nDigits, K)) {
+            nDigits = exactDigits(value, digits, K);
+        }
+        nChars += layout(dest + nChars, digits, nDigits, K);
+    }
+    return nChars;
+}
+
+// Hex dump line layout, relative to the end of the offset:  two spaces, 16 "xx " groups with
+// one more space after the 8th, " |", ASCII, "|\n".
+static const size_t HexStart = 2;
+static const size_t HexWidth = 16 * 3 + 1;
+static const size_t AsciiStart = HexStart + HexWidth + 2;
+
+static inline size_t hexPosition(size_t i)
+{
+    return HexStart + (3 * i) + ((i >= 8) ? 1 : 0);
+}
+
+// Any line length; byte at a time.
+static void hexDumpBytes(char *line, const uint8_t *data, size_t nBytes)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    memset(line + HexStart, ' ', HexWidth + 1);
+    for (size_t i = 0; i < nBytes; ++i) {
+        char *pair = line + hexPosition(i);
+        pair[0] = hexDigits[data[i] >> 4];
+        pair[1] = hexDigits[data[i] & 0xf];
+        line[AsciiStart + i] = ((data[i] >= 0x20) && (data[i] < 0x7f)) ? (char)data[i] : '.';
+    }
+}
+
+#if defined(__SSE2__)
+// Full line (16 bytes), 16 bytes at a time.
+static void hexDumpLine16(char *line, const uint8_t *data)
+{
+    const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+    const __m128i bytes = _mm_loadu_si128((const __m128i *)data);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask);
+    __m128i low = _mm_and_si128(bytes, nibbleMask);
+    high = _mm_add_epi8(_mm_add_epi8(high, _mm_set1_epi8('0')),
+            _mm_and_si128(_mm_cmpgt_epi8(high, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10)));
+    low = _mm_add_epi8(_mm_add_epi8(low, _mm_set1_epi8('0')),
+            _mm_and_si128(_mm_cmpgt_epi8(low, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10)));
+
+    // Lane i (4 bytes) = high digit, low digit, space, space.
+    const __m128i spaces = _mm_set1_epi8(' ');
+    __m128i pairs0 = _mm_unpacklo_epi8(high, low);
+    __m128i pairs1 = _mm_unpackhi_epi8(high, low);
+    uint32_t lanes[16];
+    _mm_storeu_si128((__m128i *)&lanes[0], _mm_unpacklo_epi16(pairs0, spaces));
+    _mm_storeu_si128((__m128i *)&lanes[4], _mm_unpackhi_epi16(pairs0, spaces));
+    _mm_storeu_si128((__m128i *)&lanes[8], _mm_unpacklo_epi16(pairs1, spaces));
+    _mm_storeu_si128((__m128i *)&lanes[12], _mm_unpackhi_epi16(pairs1, spaces));
+    for (size_t i = 0; i < 16; ++i) {
+        memcpy(line + hexPosition(i), &lanes[i], sizeof(lanes[i]));
+    }
+
+    // Printable is 0x20..0x7e; bytes 0x80 and up compare as negative.
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(0x1f)),
+            _mm_cmplt_epi8(bytes, _mm_set1_epi8(0x7f)));
+    __m128i ascii = _mm_or_si128(_mm_and_si128(printable, bytes), _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+    _mm_storeu_si128((__m128i *)(line + AsciiStart), ascii);
+}
+#endif
+
+size_t NumberFormat::formatHexDumpLine(char *dest, uint64_t offset, const uint8_t *data, size_t nBytes)
+{
+    if (nBytes > HexDumpLineBytes) {
+        nBytes = HexDumpLineBytes;
+    }
+    char *line = dest + formatHex(dest, offset, 8);
+    line[0] = ' ';
+    line[1] = ' ';
+#if defined(__SSE2__)
+    if (HexDumpLineBytes == nBytes) {
+        hexDumpLine16(line, data);
+    } else {
+        hexDumpBytes(line, data, nBytes);
+    }
+#else
+    hexDumpBytes(line, data, nBytes);
+#endif
+    line[HexStart + HexWidth + 1] = '|';
+    line[AsciiStart + nBytes] = '|';
+    line[AsciiStart + nBytes + 1] = '\n';
+    return (size_t)(line - dest) + AsciiStart + nBytes + 2;
+}
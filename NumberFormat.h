@@ -0,0 +1,215 @@
+/****************************************************************************
+ *   FILENAME: NumberFormat.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Fast number-to-text conversion kernels for the file writers.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Numbers are most of the bytes in our logs, and the printf() family converts them
+ *       through generic, locale-aware code.  These kernels each do one conversion into a
+ *       caller's buffer (normally straight into a writer's buffer, see appendDec() etc.) and
+ *       return the number of characters written.  No NUL terminator is written.
+ *
+ *       Decimal conversion is table driven, two digits per step, dividing in 32 bits once the
+ *       value fits (64-bit division is a library call on 32-bit targets).  Hex uses shifts.
+ *
+ *       formatFixed() is for scaled integers (e.g. millivolts as volts):  exact, no floating
+ *       point.
+ *
+ *       formatDouble() writes the shortest digit string that reads back (strtod()) as the
+ *       same double, by the Grisu3 algorithm (Florian Loitsch, "Printing Floating-Point Numbers
+ *       Quickly and Accurately with Integers", PLDI 2010), in NumberFormat.cpp.  Grisu3 detects
+ *       the values (about 0.5%) it cannot prove shortest; those fall back to snprintf() and
+ *       strtod(), several times slower.  Layout follows %g:
+ *       plain decimal for decimal exponents -5 < exp < 17, otherwise d.ddde+XX; "nan", "inf",
+ *       "-inf" as printf().
+ *
+ *       formatHexDumpLine() writes one line of a hexdump -C style dump (offset, 16 bytes in
+ *       hex, printable ASCII).  Full lines are converted 16 bytes at a time with SSE2 where
+ *       the compiler targets it (all x86-64), otherwise a byte at a time; see NumberFormat.cpp.
+ *
+ *       Output never exceeds the Max...Chars constants, so a caller can format in place once
+ *       that much space is available.
+ *
+ ****************************************************************************/
+
+#ifndef NUMBER_FORMAT_H
+#define NUMBER_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+class NumberFormat
+{
+public:
+    // Longest output of each kernel.
+    static const size_t MaxDecChars = 20;       // "-9223372036854775808", "18446744073709551615"
+    static const size_t MaxHexChars = 16;
+    static const size_t MaxFixedChars = 22;     // Sign, "0.", 19 decimals (decimals clamped to 19)
+    static const size_t MaxDoubleChars = 24;    // "-2.2250738585072014e-308"
+    static const size_t MaxChars = 24;          // Longest of the above
+
+    static const size_t HexDumpLineBytes = 16;  // Data bytes per hex dump line
+    static const size_t MaxHexDumpLineChars = 87;   // 16-digit offset, 16 bytes, ASCII, '\n'
+
+    // Integer (any integral type) in decimal, with '-' if negative.
+    template <class T>
+    static size_t formatDec(char *dest, T value);
+
+    // Unsigned value in lower case hex, zero-padded to at least minDigits (at most 16) digits.
+    static size_t formatHex(char *dest, uint64_t value, size_t minDigits = 1);
+
+    // Scaled integer value / 10^decimals, with exactly decimals (at most 19) decimal places.
+    static size_t formatFixed(char *dest, int64_t value, unsigned decimals);
+
+    // Shortest round-trip representation of value.  Defined in NumberFormat.cpp.
+    static size_t formatDouble(char *dest, double value);
+
+    // One hex dump line for nBytes (at most HexDumpLineBytes) of data, offset being the
+    // position of data[0] in the dump, e.g.
+    // "00000010  48 65 6c 6c 6f 2c 20 77  6f 72 6c 64 21 0a 00 ff  |Hello, world!...|\n"
+    // A short last line is padded so its ASCII column lines up.  Defined in NumberFormat.cpp.
+    static size_t formatHexDumpLine(char *dest, uint64_t offset, const uint8_t *data, size_t nBytes);
+
+    // Write value's decimal digits so that they end just before end.  Returns first digit.
+    static char *writeDecBackward(char *end, uint64_t value);
+
+    // Number of decimal digits in value (1 for 0).
+    static size_t decDigits(uint64_t value);
+
+    // 10^n, n <= 19.
+    static uint64_t powerOf10(unsigned n)
+    {
+        static const uint64_t powers[] = {
+            1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+            100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+            10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+            100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+        };
+        return powers[n];
+    }
+
+private:
+    // "00" "01" ... "99"
+    static const char *digitPairs(void)
+    {
+        static const char pairs[] =
+                "00010203040506070809" "10111213141516171819" "20212223242526272829"
+                "30313233343536373839" "40414243444546474849" "50515253545556575859"
+                "60616263646566676869" "70717273747576777879" "80818283848586878889"
+                "90919293949596979899";
+        return pairs;
+    }
+
+    static size_t formatUnsigned(char *dest, uint64_t value)
+    {
+        size_t nChars = decDigits(value);
+        writeDecBackward(dest + nChars, value);
+        return nChars;
+    }
+
+    static size_t formatSigned(char *dest, int64_t value)
+    {
+        size_t nChars = 0;
+        uint64_t magnitude = (uint64_t)value;
+        if (value < 0) {
+            dest[nChars++] = '-';
+            magnitude = 0 - magnitude;
+        }
+        return nChars + formatUnsigned(dest + nChars, magnitude);
+    }
+};
+
+
+template <class T>
+size_t NumberFormat::formatDec(char *dest, T value)
+{
+    static_assert(std::is_integral<T>::value, "formatDec() takes an integer");
+    return std::is_signed<T>::value ? formatSigned(dest, (int64_t)value) : formatUnsigned(dest, (uint64_t)value);
+}
+
+// Estimate from the bit length (log10(2) ~ 1233 / 4096), then correct by one comparison.
+// value | 1 has the same digit count as value (10^k - 1 is odd) and is never 0.
+inline size_t NumberFormat::decDigits(uint64_t value)
+{
+    value |= 1;
+    unsigned bits = 64 - (unsigned)__builtin_clzll(value);
+    unsigned estimate = (bits * 1233) >> 12;
+    return estimate + 1 - ((value < powerOf10(estimate)) ? 1 : 0);
+}
+
+// 64-bit steps only while the value needs them; then 32-bit, two digits per step.
+inline char *NumberFormat::writeDecBackward(char *end, uint64_t value)
+{
+    const char *pairs = digitPairs();
+    while (value > UINT32_MAX) {
+        unsigned pair = (unsigned)(value % 100);
+        value /= 100;
+        end -= 2;
+        end[0] = pairs[2 * pair];
+        end[1] = pairs[2 * pair + 1];
+    }
+    uint32_t low = (uint32_t)value;
+    while (low >= 100) {
+        unsigned pair = low % 100;
+        low /= 100;
+        end -= 2;
+        end[0] = pairs[2 * pair];
+        end[1] = pairs[2 * pair + 1];
+    }
+    if (low >= 10) {
+        end -= 2;
+        end[0] = pairs[2 * low];
+        end[1] = pairs[2 * low + 1];
+    } else {
+        *--end = (char)('0' + low);
+    }
+    return end;
+}
+
+inline size_t NumberFormat::formatHex(char *dest, uint64_t value, size_t minDigits)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    size_t nChars = (64 - (size_t)__builtin_clzll(value | 1) + 3) / 4;
+    if (minDigits > 16) {
+        minDigits = 16;
+    }
+    if (nChars < minDigits) {
+        nChars = minDigits;
+    }
+    for (size_t i = nChars; i > 0; --i) {
+        dest[i - 1] = hexDigits[value & 0xf];
+        value >>= 4;
+    }
+    return nChars;
+}
+
+inline size_t NumberFormat::formatFixed(char *dest, int64_t value, unsigned decimals)
+{
+    size_t nChars = 0;
+    uint64_t magnitude = (uint64_t)value;
+    if (value < 0) {
+        dest[nChars++] = '-';
+        magnitude = 0 - magnitude;
+    }
+    if (decimals > 19) {
+        decimals = 19;
+    }
+    if (0 == decimals) {
+        nChars += formatUnsigned(dest + nChars, magnitude);
+    } else {
+        uint64_t whole = magnitude / powerOf10(decimals);
+        uint64_t fraction = magnitude % powerOf10(decimals);
+        nChars += formatUnsigned(dest + nChars, whole);
+        dest[nChars++] = '.';
+        // Fraction digits, zero-filled on the left to exactly decimals places.
+        char *fractionEnd = dest + nChars + decimals;
+        char *first = writeDecBackward(fractionEnd, fraction);
+        while (first > dest + nChars) {
+            *--first = '0';
+        }
+        nChars += decimals;
+    }
+    return nChars;
+}
+
+#endif //ndef NUMBER_FORMAT_H
@@ -0,0 +1,297 @@
+/****************************************************************************
+ *   FILENAME: NumberFormatTest.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  check the NumberFormat kernels against printf(), and time each one
+ *            against the writers' vprintf() path.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  NumberFormatTest [<random values> [<iterations>]]
+ *       Checks (edge values, then random values, default 1000000 of each kind):
+ *           formatDec()         == snprintf() %d / %u / %lld / %llu, for 8 to 64-bit types
+ *           formatHex()         == snprintf() %0*llx
+ *           formatFixed()       == snprintf() of the integer and fraction parts
+ *           formatDouble()      reads back (strtod()) as the same double, and is no longer
+ *                               than the shortest %.<n>g that does; "nan", "inf" as printf()
+ *           formatHexDumpLine() == a line assembled with snprintf() (hexdump -C layout)
+ *       Failures are printed; exit code 1 if any.
+ *
+ *       Benchmark:  iterations (default 2000000) values per type through a
+ *       BasicBufferedFileWriter on NullFileBackend, by appendDec() etc. and by vprintf().
+ *
+ *       Builds for the host only (uses stdio, strtod(), <chrono>); not part of the target
+ *       image.  Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "MemoryFileBackend.h"
+#include "NumberFormat.h"
+
+static unsigned failures = 0;
+
+static uint64_t randomState = 0x9e3779b97f4a7c15ULL;
+
+// xorshift64*
+static uint64_t random64(void)
+{
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState * 2685821657736338717ULL;
+}
+
+// Random value with a random number of significant bits, so every digit count is covered.
+static uint64_t randomBits(void)
+{
+    unsigned bits = (unsigned)(random64() % 65);
+    return (64 == bits) ? random64() : (random64() & ((1ULL << bits) - 1));
+}
+
+static void compare(const char *what, const char *actual, size_t actualLength, const char *expected)
+{
+    if ((actualLength != strlen(expected)) || (0 != memcmp(actual, expected, actualLength))) {
+        ++failures;
+        if (failures <= 20) {
+            fprintf(stderr, "FAIL %s:  \"%.*s\", expected \"%s\"\n", what, (int)actualLength, actual, expected);
+        }
+    }
+}
+
+template <class T>
+static void checkDec(T value)
+{
+    char actual[NumberFormat::MaxDecChars + 1];
+    char expected[32];
+    if (std::is_signed<T>::value) {
+        snprintf(expected, sizeof(expected), "%lld", (long long)value);
+    } else {
+        snprintf(expected, sizeof(expected), "%llu", (unsigned long long)value);
+    }
+    compare("formatDec", actual, NumberFormat::formatDec(actual, value), expected);
+}
+
+static void checkHex(uint64_t value, size_t minDigits)
+{
+    char actual[NumberFormat::MaxHexChars + 1];
+    char expected[32];
+    snprintf(expected, sizeof(expected), "%0*llx", (int)minDigits, (unsigned long long)value);
+    compare("formatHex", actual, NumberFormat::formatHex(actual, value, minDigits), expected);
+}
+
+static void checkFixed(int64_t value, unsigned decimals)
+{
+    char actual[NumberFormat::MaxFixedChars + 1];
+    char expected[48];
+    uint64_t magnitude = (value < 0) ? (0 - (uint64_t)value) : (uint64_t)value;
+    uint64_t scale = NumberFormat::powerOf10(decimals);
+    if (0 == decimals) {
+        snprintf(expected, sizeof(expected), "%s%llu", (value < 0) ? "-" : "", (unsigned long long)magnitude);
+    } else {
+        snprintf(expected, sizeof(expected), "%s%llu.%0*llu", (value < 0) ? "-" : "",
+                (unsigned long long)(magnitude / scale), (int)decimals, (unsigned long long)(magnitude % scale));
+    }
+    compare("formatFixed", actual, NumberFormat::formatFixed(actual, value, decimals), expected);
+}
+
+// Significant digits of a decimal or d.ddde+XX string:  leading and trailing zeros dropped.
+static size_t significantDigits(const char *text)
+{
+    char digits[40];
+    size_t count = 0;
+    for (const char *p = text; ('\0' != *p) && ('e' != *p); ++p) {
+        if ((*p >= '0') && (*p <= '9') && ((0 != count) || ('0' != *p))) {
+            digits[count++] = *p;
+        }
+    }
+    while ((count > 0) && ('0' == digits[count - 1])) {
+        --count;
+    }
+    return count;
+}
+
+static void checkDouble(double value)
+{
+    char actual[NumberFormat::MaxDoubleChars + 1];
+    size_t length = NumberFormat::formatDouble(actual, value);
+    actual[length] = '\0';
+    if (isnan(value) || isinf(value)) {
+        char expected[16];
+        snprintf(expected, sizeof(expected), "%g", value);
+        compare("formatDouble", actual, length, expected);
+        return;
+    }
+    if (strtod(actual, NULL) != value) {
+        ++failures;
+        if (failures <= 20) {
+            fprintf(stderr, "FAIL formatDouble:  \"%s\" does not read back as %.17g\n", actual, value);
+        }
+        return;
+    }
+    // Shortest %g precision that reads back, against our significant digit count.
+    char shortest[40];
+    for (int precision = 1; precision <= 17; ++precision) {
+        snprintf(shortest, sizeof(shortest), "%.*g", precision, value);
+        if (strtod(shortest, NULL) == value) {
+            if (significantDigits(actual) > (size_t)precision) {
+                ++failures;
+                if (failures <= 20) {
+                    fprintf(stderr, "FAIL formatDouble:  \"%s\" longer than \"%s\"\n", actual, shortest);
+                }
+            }
+            break;
+        }
+    }
+}
+
+static void checkHexDump(uint64_t offset, const uint8_t *data, size_t nBytes)
+{
+    char actual[NumberFormat::MaxHexDumpLineChars + 1];
+    char expected[128];
+    size_t pos = (size_t)snprintf(expected, sizeof(expected), "%08llx  ", (unsigned long long)offset);
+    for (size_t i = 0; i < NumberFormat::HexDumpLineBytes; ++i) {
+        if (i < nBytes) {
+            pos += (size_t)snprintf(expected + pos, sizeof(expected) - pos, "%02x ", data[i]);
+        } else {
+            pos += (size_t)snprintf(expected + pos, sizeof(expected) - pos, "   ");
+        }
+        if (7 == i) {
+            expected[pos++] = ' ';
+        }
+    }
+    expected[pos++] = ' ';
+    expected[pos++] = '|';
+    for (size_t i = 0; i < nBytes; ++i) {
+        expected[pos++] = ((data[i] >= 0x20) && (data[i] < 0x7f)) ? (char)data[i] : '.';
+    }
+    expected[pos++] = '|';
+    expected[pos++] = '\n';
+    expected[pos] = '\0';
+    compare("formatHexDumpLine", actual, NumberFormat::formatHexDumpLine(actual, offset, data, nBytes), expected);
+}
+
+static void checkAll(unsigned long count)
+{
+    static const int64_t edges[] = {
+        0, 1, -1, 9, 10, 99, 100, 999, 1000, 99999, 100000, 4294967295LL, 4294967296LL,
+        999999999999999999LL, 1000000000000000000LL, INT32_MIN, INT32_MAX, INT64_MIN, INT64_MAX
+    };
+    for (size_t i = 0; i < sizeof(edges) / sizeof(edges[0]); ++i) {
+        checkDec(edges[i]);
+        checkDec((uint64_t)edges[i]);
+        checkDec((int32_t)edges[i]);
+        checkHex((uint64_t)edges[i], 1);
+        for (unsigned decimals = 0; decimals <= 19; ++decimals) {
+            checkFixed(edges[i], decimals);
+        }
+    }
+    checkDec((int8_t)-128);
+    checkDec((uint8_t)255);
+    checkDec((int16_t)-32768);
+    checkDec((uint16_t)65535);
+
+    static const double doubles[] = {
+        0.0, -0.0, 1.0, -1.0, 0.1, 0.3, 1.0 / 3.0, 123456.789, 1e16, 1e17, 1e-5, 1e-4, 5e-324,
+        2.2250738585072014e-308, 1.7976931348623157e308, 9007199254740993.0, NAN, INFINITY, -INFINITY
+    };
+    for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); ++i) {
+        checkDouble(doubles[i]);
+    }
+
+    uint8_t bytes[NumberFormat::HexDumpLineBytes];
+    for (unsigned long i = 0; i < count; ++i) {
+        uint64_t bits = randomBits();
+        checkDec((int64_t)bits);
+        checkDec(bits);
+        checkDec((int32_t)bits);
+        checkDec((uint32_t)bits);
+        checkHex(bits, (size_t)(random64() % 17));
+        checkFixed((int64_t)bits, (unsigned)(random64() % 20));
+        uint64_t doubleBits = random64();
+        double value;
+        memcpy(&value, &doubleBits, sizeof(value));
+        checkDouble(value);
+        checkDouble((double)(int64_t)bits / (double)NumberFormat::powerOf10((unsigned)(random64() % 8)));
+        if (0 == i % 16) {
+            size_t nBytes = (size_t)(random64() % (NumberFormat::HexDumpLineBytes + 1));
+            for (size_t j = 0; j < nBytes; ++j) {
+                bytes[j] = (uint8_t)random64();
+            }
+            checkHexDump(bits & 0xffffffffULL, bytes, nBytes);
+        }
+    }
+}
+
+// Benchmark:  one writer, NullFileBackend, each kernel against the vprintf() equivalent.
+static BasicBufferedFileWriter<4096, 2048, NullFileBackend> writer;
+
+static int viaVprintf(const char *fmt, ...)
+{
+    va_list arglist;
+    va_start(arglist, fmt);
+    int retval = writer.vprintf(fmt, arglist);
+    va_end(arglist);
+    return retval;
+}
+
+template <class Function>
+static double nanosecondsPerValue(unsigned long iterations, Function function)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; ++i) {
+        function(i);
+    }
+    writer.flush();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+template <class Kernel, class Printf>
+static void bench(const char *name, unsigned long iterations, Kernel kernel, Printf printf)
+{
+    double kernelTime = nanosecondsPerValue(iterations, kernel);
+    double printfTime = nanosecondsPerValue(iterations, printf);
+    ::printf("%-14s kernel %6.1f ns/value, vprintf %6.1f ns/value (%.1fx)\n", name, kernelTime, printfTime,
+            printfTime / kernelTime);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+    unsigned long iterations = (argc > 2) ? strtoul(argv[2], NULL, 0) : 2000000;
+    checkAll(count);
+    printf("%u check failures\n", failures);
+
+    NullSink sink = { 0, 0 };
+    writer.setFile(&sink);
+    bench("appendDec", iterations,
+            [](unsigned long i) { writer.appendDec((int64_t)(i * 2654435761u) - 1000000000); },
+            [](unsigned long i) { viaVprintf("%lld", (long long)(i * 2654435761u) - 1000000000); });
+    bench("appendHex", iterations,
+            [](unsigned long i) { writer.appendHex(i * 2654435761u, 8); },
+            [](unsigned long i) { viaVprintf("%08lx", i * 2654435761u); });
+    bench("appendFixed", iterations,
+            [](unsigned long i) { writer.appendFixed((int64_t)(i * 7919) - 5000000, 3); },
+            [](unsigned long i) { viaVprintf("%.3f", ((int64_t)(i * 7919) - 5000000) / 1000.0); });
+    bench("appendDouble", iterations,
+            [](unsigned long i) { writer.appendDouble(i * 0.0173); },
+            [](unsigned long i) { viaVprintf("%.17g", i * 0.0173); });
+    static uint8_t line[NumberFormat::HexDumpLineBytes];
+    for (size_t j = 0; j < sizeof(line); ++j) {
+        line[j] = (uint8_t)(j * 37);
+    }
+    bench("appendHexDump", iterations / 4,
+            [](unsigned long i) { writer.appendHexDump(line, sizeof(line), i * 16); },
+            [](unsigned long i) {
+                viaVprintf("%08lx  %02x %02x %02x %02x %02x %02x %02x %02x  %02x %02x %02x %02x %02x %02x %02x %02x"
+                        "  |%.16s|\n", i * 16, line[0], line[1], line[2], line[3], line[4], line[5], line[6],
+                        line[7], line[8], line[9], line[10], line[11], line[12], line[13], line[14], line[15],
+                        "................");
+            });
+    writer.setFile(NULL);
+    return (0 == failures) ? 0 : 1;
+}
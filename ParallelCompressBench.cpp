@@ -0,0 +1,185 @@
+/****************************************************************************
+ *   FILENAME: ParallelCompressBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  scaling benchmark of ParallelCompressor over its worker count.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  ParallelCompressBench [-d <directory>] [-m <MiB>] [-w <workers>]...
+ *       Defaults:  current directory, 512 MiB, workers 1, 2, 4, 8.  Run it on the server
+ *       build's disks; the output file (pcbench.lz4) is deleted afterwards.
+ *
+ *       Synthetic log text (generated once, before timing) is written through a
+ *       BasicBufferedFileWriter<65536> on PosixFileBackend:  first through CompressingBackend
+ *       (compression on the writing thread), then through ParallelCompressingBackend with
+ *       each worker count.  Reported per run:  MiB/s of log text, compression ratio, and the
+ *       pipeline's waits (write() found every slot in flight; sequencer waited for the next
+ *       frame).  Every run's file is decoded and compared with the input; exit code 1 if one
+ *       differs.
+ *
+ *       Builds for the host only (threads, <chrono>, malloc()); not part of the target image.
+ *       Link with Lz4Block.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "CompressingBackend.h"
+#include "Lz4Block.h"
+#include "ParallelCompressingBackend.h"
+#include "PosixFileBackend.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef CompressingBackend<PosixFileBackend> SerialBackend;
+typedef ParallelCompressor<PosixFileBackend> Compressor;
+typedef ParallelCompressingBackend<Compressor> ParallelBackend;
+
+static const size_t MaxRuns = 8;
+static const size_t WriteSize = 200;    // Bytes per writer write(), about a few log lines
+
+static char *text;
+static size_t textSize;
+
+// Log lines with some variety (timestamps, counters, a few message forms).
+static void makeText(size_t nBytes)
+{
+    static const char *const messages[] = {
+        "request served", "cache miss, fetching from origin", "connection reset by peer",
+        "queue depth above threshold", "checkpoint complete"
+    };
+    text = (char *)malloc(nBytes + 256);
+    textSize = 0;
+    uint32_t random = 2463534242u;
+    for (unsigned long n = 0; textSize < nBytes; ++n) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        textSize += (size_t)snprintf(text + textSize, 256, "2020-06-01T12:%02lu:%02lu.%06lu worker=%02u req=%08x %s (%u ms)\n",
+                (n / 600000) % 60, (n / 10000) % 60, (n * 97) % 1000000, (unsigned)(random % 32), (unsigned)random,
+                messages[random % 5], (unsigned)(random % 5000));
+    }
+    textSize = nBytes;
+}
+
+// Write the text through writer; returns seconds, including the final flush.
+template <class Writer, class Finish>
+static double writeText(Writer &writer, Finish finish)
+{
+    Clock::time_point start = Clock::now();
+    for (size_t pos = 0; pos < textSize; pos += WriteSize) {
+        writer.write(text + pos, (textSize - pos < WriteSize) ? (textSize - pos) : WriteSize);
+    }
+    writer.flush();
+    finish();
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Decode the file at path (frames as in CompressingBackend.h) and compare with the text.
+static bool decodesToText(const char *path, size_t *storedSize)
+{
+    bool retval = false;
+    FILE *file = fopen(path, "rb");
+    if (NULL != file) {
+        static char frame[CompressedFrameHeader::Size + 65536];
+        static char raw[65536];
+        size_t pos = 0;
+        CompressedFrameHeader header;
+        *storedSize = 0;
+        retval = true;
+        while (retval && (fread(frame, 1, CompressedFrameHeader::Size, file) == CompressedFrameHeader::Size)) {
+            retval = header.load(frame) && (header.offset == pos) && (header.rawSize <= sizeof(raw))
+                    && (header.storedSize <= sizeof(frame) - CompressedFrameHeader::Size)
+                    && (fread(frame, 1, header.storedSize, file) == header.storedSize);
+            if (retval && (0 != (header.flags & CompressedFrameHeader::FrameStored))) {
+                retval = (header.storedSize == header.rawSize) && (0 == memcmp(frame, text + pos, header.rawSize));
+            } else if (retval) {
+                retval = Lz4Block::decompress(frame, header.storedSize, raw, header.rawSize)
+                        && (0 == memcmp(raw, text + pos, header.rawSize));
+            }
+            pos += header.rawSize;
+            *storedSize += CompressedFrameHeader::Size + header.storedSize;
+        }
+        retval = retval && (pos == textSize);
+        fclose(file);
+    }
+    return retval;
+}
+
+static bool report(const char *label, const char *path, double seconds, uint64_t producerWaits, uint64_t sequencerWaits)
+{
+    size_t stored = 0;
+    bool retval = decodesToText(path, &stored);
+    printf("%-22s %8.1f MiB/s  ratio %.3f  slot waits %8llu  sequencer waits %8llu%s\n", label,
+            textSize / seconds / (1024.0 * 1024.0), (double)stored / textSize, (unsigned long long)producerWaits,
+            (unsigned long long)sequencerWaits, retval ? "" : "  DECODE MISMATCH");
+    return retval;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = ".";
+    size_t mebibytes = 512;
+    size_t workerCounts[MaxRuns];
+    size_t nRuns = 0;
+    for (int arg = 1; arg < argc; ++arg) {
+        if ((0 == strcmp(argv[arg], "-d")) && (arg + 1 < argc)) {
+            directory = argv[++arg];
+        } else if ((0 == strcmp(argv[arg], "-m")) && (arg + 1 < argc)) {
+            mebibytes = strtoul(argv[++arg], NULL, 0);
+        } else if ((0 == strcmp(argv[arg], "-w")) && (arg + 1 < argc) && (nRuns < MaxRuns)) {
+            workerCounts[nRuns++] = strtoul(argv[++arg], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [-d <directory>] [-m <MiB>] [-w <workers>]...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (0 == nRuns) {
+        static const size_t defaults[] = { 1, 2, 4, 8 };
+        for (size_t i = 0; i < sizeof(defaults) / sizeof(defaults[0]); ++i) {
+            workerCounts[nRuns++] = defaults[i];
+        }
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/pcbench.lz4", directory);
+    makeText(mebibytes * 1024 * 1024);
+    printf("%lu MiB of log text to %s\n", (unsigned long)mebibytes, path);
+    int retval = 0;
+
+    static BasicBufferedFileWriter<65536, 256, SerialBackend> serialWriter;
+    SerialBackend::Handle serialFile = SerialBackend::open(path);
+    if (SerialBackend::noFile() == serialFile) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return 2;
+    }
+    serialWriter.setFile(serialFile);
+    double seconds = writeText(serialWriter, [] { });
+    serialWriter.setFile(SerialBackend::noFile());
+    SerialBackend::close(serialFile);
+    if (!report("serial (writer thread)", path, seconds, 0, 0)) {
+        retval = 1;
+    }
+
+    static BasicBufferedFileWriter<65536, 256, ParallelBackend> parallelWriter;
+    for (size_t run = 0; run < nRuns; ++run) {
+        // On the heap:  the compressor's slots are a few MiB.
+        Compressor *compressor = new Compressor(workerCounts[run]);
+        int fd = PosixFileBackend::open(path);
+        Compressor::File *file = compressor->attach(fd);
+        parallelWriter.setFile(file);
+        seconds = writeText(parallelWriter, [file] { file->compressor->drain(file); });
+        parallelWriter.setFile(NULL);
+        PosixFileBackend::close(compressor->detach(file));
+        Compressor::Stats stats = compressor->getStats();
+        char label[32];
+        snprintf(label, sizeof(label), "%lu workers", (unsigned long)workerCounts[run]);
+        if (!report(label, path, seconds, stats.producerWaits, stats.sequencerWaits)) {
+            retval = 1;
+        }
+        delete compressor;
+    }
+    PosixFileBackend::remove(path);
+    free(text);
+    return retval;
+}
@@ -0,0 +1,464 @@
+/****************************************************************************
+ *   FILENAME: ParallelCompressingBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Compression stage spread over a pool of worker threads (server build).
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       One thread running Lz4Block (CompressingBackend) compresses a few hundred MB/s,
+ *       below what the server's disks take.  ParallelCompressor compresses frames on up to
+ *       MaxWorkers threads and a sequencing thread writes them in the original order.  The
+ *       file format is CompressingBackend's (CompressedFrameHeader frames, same decoder,
+ *       CompressedLogDecoder.cpp); compressed bytes may differ slightly, since each worker
+ *       keeps its own hash table.
+ *
+ *       Pipeline, all stages in the order the data was written:
+ *        - write() (the writer's flush) copies each frame's input, at most FrameSize bytes,
+ *          into a free slot and queues it.  There are SlotCount slots; when all are in
+ *          flight, write() waits (backpressure), so memory stays bounded and the writer
+ *          slows to the speed of the disk rather than queueing without limit.
+ *        - A worker takes the oldest queued slot and compresses it with its own hash table.
+ *        - The sequencer writes slots with Backend::write() strictly in slot order, waiting
+ *          for a slow frame even when later ones are done, then frees them.
+ *       Use SlotCount >= 2 * workers, so workers do not stall behind the sequencer.
+ *
+ *       Files are attached to a compressor (attach(), static slots, MaxFiles) and given to the
+ *       writer's setFile() as the ParallelCompressingBackend handle; writers of several files
+ *       can share one compressor, each file's frames keep their own order and logical
+ *       offsets.  The first frame of a file whose Backend::write() comes up short marks the
+ *       file failed until the next attach():  later write()s queue nothing and return 0 (so
+ *       the error shows up one or more flushes late, as with a DoubleBufferedFileWriter),
+ *       and sync() and trim() return false.  The writer's flush() only hands its buffer to
+ *       the pipeline; sync() (and detach()) wait until the file's frames are written first.
+ *       No open / close:  open files with Backend and attach them.
+ *
+ *       Threads start at the first attach() (not in the constructor, so static instances
+ *       are safe) and stop in stop() or the destructor, after the queued frames are written.
+ *       Memory:  SlotCount * (2 * FrameSize + header) plus 16k per worker; make it static.
+ *
+ ****************************************************************************/
+
+#ifndef PARALLEL_COMPRESSING_BACKEND_H
+#define PARALLEL_COMPRESSING_BACKEND_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "CompressingBackend.h"
+#include "FileBackend.h"
+#include "Lz4Block.h"
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+class ParallelCompressor;
+
+// A file attached to a ParallelCompressor; the Handle of ParallelCompressingBackend.
+// Counts and failed flag guarded by the compressor lock.
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+struct ParallelCompressedFile
+{
+    ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles> * compressor;
+    typename Backend::Handle file;
+    bool        attached;
+    uint64_t    logicalOffset;          // Of the next frame queued
+    uint64_t    logicalBytes;           // Queued since attach()
+    uint64_t    storedBytes;            // Written since attach(), headers included
+    size_t      inFlight;               // Frames queued, not yet written
+    bool        failed;                 // A frame write came up short since attach()
+};
+
+template <class Compressor>
+struct ParallelCompressingBackend : public FileBackendDefaults
+{
+    typedef typename Compressor::File * Handle;
+
+    static const bool SupportsSync = Compressor::SupportsSync;
+    static const bool SupportsReserve = Compressor::SupportsReserve;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Queues data; see ParallelCompressor::write().
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return file->compressor->write(file, data, nChars);
+    }
+
+    // Waits until the file's frames are written, then syncs.  false if a frame write failed.
+    static bool sync(Handle file)
+    {
+        bool written = file->compressor->drain(file);
+        return BackendSync<typename Compressor::FileBackend>::sync(file->file) && written;
+    }
+
+    // nBytes is logical; reserving that much physical space over-reserves, never under.
+    static bool reserve(Handle file, size_t nBytes)
+    {
+        return BackendReserve<typename Compressor::FileBackend>::reserve(file->file, nBytes);
+    }
+
+    static bool trim(Handle file)
+    {
+        bool written = file->compressor->drain(file);
+        return BackendReserve<typename Compressor::FileBackend>::trim(file->file) && written;
+    }
+};
+
+template <class Backend, size_t FrameSize = 65536, size_t SlotCount = 16, size_t MaxWorkers = 8, size_t MaxFiles = 4>
+class ParallelCompressor
+{
+public:
+    typedef Backend FileBackend;
+    typedef ParallelCompressedFile<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles> File;
+
+    static const bool SupportsSync = Backend::SupportsSync;
+    static const bool SupportsReserve = Backend::SupportsReserve;
+    // Largest frame written:  header plus FrameSize (stored) bytes.
+    static const size_t MaxFrameBytes = CompressedFrameHeader::Size + FrameSize;
+
+    // Pipeline counts since construction or the last resetStats().
+    struct Stats
+    {
+        uint64_t    frames;             // Frames written
+        uint64_t    logicalBytes;
+        uint64_t    storedBytes;        // Headers included
+        uint64_t    producerWaits;      // write() found every slot in flight
+        uint64_t    sequencerWaits;     // Next frame in order not compressed yet
+        uint32_t    maxInFlight;        // Most slots in flight at once
+    };
+
+    // _workers:  compression threads, 1 to MaxWorkers.
+    explicit ParallelCompressor(size_t _workers = 1);
+
+    // Stops the threads (see stop()).
+    ~ParallelCompressor(void);
+
+    // Attach an open file; pass the result to the writer's setFile().  logicalStart:  logical
+    // offset of the first byte (0 for a new file; the decoded length when appending).
+    // Starts the threads if not running.  Returns NULL if MaxFiles files are attached.
+    File *attach(typename Backend::Handle file, uint64_t logicalStart = 0);
+
+    // Wait until the file's frames are written, then detach it.  Returns the Backend file.
+    typename Backend::Handle detach(File *file);
+
+    // ParallelCompressingBackend::write():  queue data as frames.  Waits for free slots.
+    // Returns nChars (bytes queued), or 0 without queueing if the file has failed.
+    uint32_t write(File *file, const char *data, size_t nChars);
+
+    // Wait until every frame queued for file is written.  Returns false if the file has
+    // failed (a frame write came up short since attach()).
+    bool drain(File *file);
+
+    // Write everything queued, then end the threads.  attach() starts them again.
+    void stop(void);
+
+    // Bytes passed to Backend::write() for file since attach(), headers included.
+    uint64_t getStoredBytes(File *file);
+
+    Stats getStats(void);
+
+    void resetStats(void);
+
+private:
+    enum SlotState { SlotFree, SlotFilling, SlotQueued, SlotCompressing, SlotCompressed, SlotWriting };
+
+    struct Slot
+    {
+        File *      file;
+        size_t      rawSize;
+        size_t      frameBytes;         // Header and payload, once compressed
+        uint64_t    offset;
+        SlotState   state;
+        char        input[FrameSize];
+        alignas(Backend::BufferAlignment) char frame[MaxFrameBytes];
+    };
+
+    // Block copy-ctor, assignment operator.
+    ParallelCompressor(const ParallelCompressor &obj);
+    ParallelCompressor& operator=(const ParallelCompressor& obj);
+
+    // Compress slot's input into its frame (header included), stored if it does not shrink.
+    static void compressSlot(Slot &slot, uint32_t *table);
+
+    void workerMain(size_t index);
+    void sequencerMain(void);
+
+    size_t      workerCount;
+    std::mutex  lock;
+    std::condition_variable queued;     // Workers wait for input
+    std::condition_variable compressed; // Sequencer waits for the next frame in order
+    std::condition_variable written;    // write() waits for slots, drain() for its file
+    File        files[MaxFiles];
+    Slot        slots[SlotCount];
+    // Frame counters; slot index is counter % SlotCount.  written <= compress <= fill.
+    uint64_t    fillNext;
+    uint64_t    compressNext;
+    uint64_t    writeNext;
+    bool        running;
+    bool        stopping;
+    Stats       stats;
+    uint32_t    tables[MaxWorkers][Lz4Block::HashSize];
+    std::thread workers[MaxWorkers];
+    std::thread sequencer;
+};
+
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::ParallelCompressor(size_t _workers)
+    : workerCount((0 == _workers) ? 1 : ((_workers > MaxWorkers) ? MaxWorkers : _workers)),
+      fillNext(0), compressNext(0), writeNext(0), running(false), stopping(false)
+{
+    for (size_t i = 0; i < MaxFiles; ++i) {
+        files[i].compressor = this;
+        files[i].file = Backend::noFile();
+        files[i].attached = false;
+    }
+    for (size_t i = 0; i < SlotCount; ++i) {
+        slots[i].state = SlotFree;
+    }
+    memset(tables, 0, sizeof(tables));
+    resetStats();
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::~ParallelCompressor(void)
+{
+    stop();
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+typename ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::File *
+        ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::attach(
+        typename Backend::Handle file, uint64_t logicalStart)
+{
+    File *retval = NULL;
+    std::lock_guard<std::mutex> guard(lock);
+    for (size_t i = 0; (i < MaxFiles) && (NULL == retval); ++i) {
+        if (!files[i].attached) {
+            retval = &files[i];
+            retval->file = file;
+            retval->attached = true;
+            retval->logicalOffset = logicalStart;
+            retval->logicalBytes = 0;
+            retval->storedBytes = 0;
+            retval->inFlight = 0;
+            retval->failed = false;
+        }
+    }
+    if ((NULL != retval) && !running) {
+        running = true;
+        stopping = false;
+        for (size_t i = 0; i < workerCount; ++i) {
+            workers[i] = std::thread(&ParallelCompressor::workerMain, this, i);
+        }
+        sequencer = std::thread(&ParallelCompressor::sequencerMain, this);
+    }
+    return retval;
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+typename Backend::Handle ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::detach(File *file)
+{
+    typename Backend::Handle retval = Backend::noFile();
+    if (NULL != file) {
+        drain(file);
+        std::lock_guard<std::mutex> guard(lock);
+        retval = file->file;
+        file->file = Backend::noFile();
+        file->attached = false;
+    }
+    return retval;
+}
+
+// The slot is claimed under the lock (so frames keep write() order across files) and filled
+// outside it; workers take slots in counter order and wait for one still being filled.
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+uint32_t ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::write(File *file,
+        const char *data, size_t nChars)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    uint32_t retval = 0;
+    if (!file->failed) {
+        retval = (uint32_t)nChars;
+    } else {
+        nChars = 0;
+    }
+    while (nChars > 0) {
+        if (fillNext - writeNext >= SlotCount) {
+            ++stats.producerWaits;
+            do {
+                written.wait(guard);
+            } while (fillNext - writeNext >= SlotCount);
+        }
+        size_t chunk = (nChars < FrameSize) ? nChars : FrameSize;
+        Slot &slot = slots[fillNext % SlotCount];
+        ++fillNext;
+        slot.file = file;
+        slot.rawSize = chunk;
+        slot.offset = file->logicalOffset;
+        slot.state = SlotFilling;
+        file->logicalOffset += chunk;
+        file->logicalBytes += chunk;
+        ++file->inFlight;
+        if (fillNext - writeNext > stats.maxInFlight) {
+            stats.maxInFlight = (uint32_t)(fillNext - writeNext);
+        }
+        guard.unlock();
+
+        memcpy(slot.input, data, chunk);
+        data += chunk;
+        nChars -= chunk;
+
+        guard.lock();
+        slot.state = SlotQueued;
+        queued.notify_all();
+    }
+    return retval;
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+bool ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::drain(File *file)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while (file->inFlight > 0) {
+        written.wait(guard);
+    }
+    return !file->failed;
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+void ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::stop(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (running) {
+        while (writeNext != fillNext) {
+            written.wait(guard);
+        }
+        stopping = true;
+        queued.notify_all();
+        compressed.notify_all();
+        guard.unlock();
+        for (size_t i = 0; i < workerCount; ++i) {
+            workers[i].join();
+        }
+        sequencer.join();
+        guard.lock();
+        running = false;
+    }
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+uint64_t ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::getStoredBytes(File *file)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return file->storedBytes;
+}
+
+// Compress straight into the frame after the header space; as CompressedFile::write().
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+void ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::compressSlot(Slot &slot, uint32_t *table)
+{
+    char *payload = slot.frame + CompressedFrameHeader::Size;
+    CompressedFrameHeader header;
+    header.magic = CompressedFrameHeader::Magic;
+    header.rawSize = (uint32_t)slot.rawSize;
+    header.offset = slot.offset;
+    size_t size = Lz4Block::compress(slot.input, slot.rawSize, payload, slot.rawSize - 1, table);
+    if (0 != size) {
+        header.storedSize = (uint32_t)size;
+        header.flags = 0;
+    } else {
+        memcpy(payload, slot.input, slot.rawSize);
+        header.storedSize = (uint32_t)slot.rawSize;
+        header.flags = CompressedFrameHeader::FrameStored;
+    }
+    header.store(slot.frame);
+    slot.frameBytes = CompressedFrameHeader::Size + header.storedSize;
+}
+
+// Worker thread:  compress queued slots, oldest first.
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+void ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::workerMain(size_t index)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        while (!stopping && ((compressNext == fillNext) || (SlotQueued != slots[compressNext % SlotCount].state))) {
+            queued.wait(guard);
+        }
+        if (stopping) {
+            break;
+        }
+        Slot &slot = slots[compressNext % SlotCount];
+        ++compressNext;
+        slot.state = SlotCompressing;
+        guard.unlock();
+
+        compressSlot(slot, tables[index]);
+
+        guard.lock();
+        slot.state = SlotCompressed;
+        compressed.notify_one();
+    }
+}
+
+// Sequencer thread:  write compressed slots in order, free them.
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+void ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::sequencerMain(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        if (!stopping && (writeNext != fillNext) && (SlotCompressed != slots[writeNext % SlotCount].state)) {
+            ++stats.sequencerWaits;
+        }
+        while (!stopping && ((writeNext == fillNext) || (SlotCompressed != slots[writeNext % SlotCount].state))) {
+            compressed.wait(guard);
+        }
+        if (stopping) {
+            break;
+        }
+        Slot &slot = slots[writeNext % SlotCount];
+        slot.state = SlotWriting;
+        guard.unlock();
+
+        uint32_t result = Backend::write(slot.file->file, slot.frame, slot.frameBytes);
+
+        guard.lock();
+        File *file = slot.file;
+        if (result == slot.frameBytes) {
+            file->storedBytes += slot.frameBytes;
+        } else {
+            file->failed = true;
+        }
+        --file->inFlight;
+        ++stats.frames;
+        stats.logicalBytes += slot.rawSize;
+        stats.storedBytes += slot.frameBytes;
+        slot.state = SlotFree;
+        ++writeNext;
+        written.notify_all();
+    }
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+typename ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::Stats
+        ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::getStats(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+template <class Backend, size_t FrameSize, size_t SlotCount, size_t MaxWorkers, size_t MaxFiles>
+void ParallelCompressor<Backend, FrameSize, SlotCount, MaxWorkers, MaxFiles>::resetStats(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stats.frames = 0;
+    stats.logicalBytes = 0;
+    stats.storedBytes = 0;
+    stats.producerWaits = 0;
+    stats.sequencerWaits = 0;
+    stats.maxInFlight = 0;
+}
+
+#endif //ndef PARALLEL_COMPRESSING_BACKEND_H
@@ -0,0 +1,402 @@
+/****************************************************************************
+ *   FILENAME: PerThreadFileWriter.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Per-thread write buffers in front of BufferedFileWriter, merged in time order.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Alternative to MultiProducerFileWriter for many-core machines:  each writing thread
+ *       appends records to its own private buffer, so the write() hot path has no atomic
+ *       read-modify-write operations and touches no cache line written by another thread
+ *       (except once after each merge, to see that its buffer has been emptied).
+ *
+ *       Each record is stamped with a steady_clock timestamp.  flush() merges the records
+ *       published by all threads in timestamp order (ties broken by thread slot) and passes
+ *       them to Writer::write(), then flushes the writer.  A thread whose buffer is full calls
+ *       flush() itself.  Ordering is exact among the records merged by one flush(); a record
+ *       published just after a merge started goes out with the next merge.
+ *
+ *       A thread claims one of MaxThreads slots on its first write and keeps it until it calls
+ *       releaseThread().  Threads beyond MaxThreads get WriteNoSlot.
+ *
+ *       getBytesWrittenTotal() is the total across all threads, including bytes not yet
+ *       merged, since construction or the last resetBytesWrittenTotal().
+ *
+ *       The wrapped writer must only be used through this object while it is in use
+ *       (flush() serializes access to it).
+ *
+ *       Suggest using only static instances:  the slots hold MaxThreads * ThreadBufferSize
+ *       bytes.
+ *
+ ****************************************************************************/
+
+#ifndef PER_THREAD_FILE_WRITER_H
+#define PER_THREAD_FILE_WRITER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#ifndef _ATTRIBUTE
+#define _ATTRIBUTE(attrs) __attribute__ (attrs)
+#endif
+
+template <class Writer, size_t MaxThreads = 16, size_t ThreadBufferSize = 16384>
+class PerThreadFileWriter
+{
+public:
+    enum WriteResult {
+        WriteNoSlot = UINT32_MAX - 2,   // All MaxThreads slots are claimed by other threads
+        WriteTooLarge = UINT32_MAX - 1  // Record larger than MaxRecordSize; nothing written
+    };
+
+    // Size of the per-record header (timestamp and length) in a thread buffer.
+    static const size_t HeaderSize = 16;
+    // Largest record (payload) accepted by write().
+    static const size_t MaxRecordSize = ThreadBufferSize / 2 - HeaderSize;
+    // Longest line produced by vprintf().
+    static const size_t LineBuffSize = Writer::LineBuffSize;
+
+    explicit PerThreadFileWriter(Writer &_writer);
+
+    // Append (binary) data as one record to the calling thread's buffer.
+    // If the thread's buffer is full, flush() first.
+    // Returns 0 (or the flush() return code if flushed), WriteNoSlot, or WriteTooLarge.
+    uint32_t write(const char *source, size_t nChars);
+
+    // Write string as one record, length from strlen().  Writes 0 bytes for NULL string.
+    // Return code as for write().
+    uint32_t writeStr(const char *string);
+
+    // vprintf formatting directly into the calling thread's buffer, as one record.
+    // Lines are truncated to LineBuffSize characters.
+    // Returns number of bytes written, or -1 if no slot is available.
+    int vprintf(const char * fmt, va_list arglist)
+            _ATTRIBUTE ((__format__ (__printf__, 2, 0)));
+
+    // Merge all published records from all threads into the writer in timestamp order,
+    // then flush the writer.  May be called from any thread.
+    // Returns Writer::flush() return code.
+    uint32_t flush(void);
+
+    // Flush, then give up the calling thread's slot so another thread may claim it.
+    void releaseThread(void);
+
+    // Return bytes written by all threads (including those not yet merged) since
+    // initialization or last resetBytesWrittenTotal().
+    size_t getBytesWrittenTotal(void);
+
+    // Reset count of bytes written.
+    void resetBytesWrittenTotal(void);
+
+private:
+    // Block copy-ctor, assignment operator.
+    PerThreadFileWriter(const PerThreadFileWriter &obj);
+    PerThreadFileWriter& operator=(const PerThreadFileWriter& obj);
+
+    static const uint32_t PaddingLength = UINT32_MAX;
+    static const size_t BufferMask = ThreadBufferSize - 1;
+
+    static_assert((ThreadBufferSize & BufferMask) == 0, "ThreadBufferSize must be a power of two");
+    static_assert(LineBuffSize + 1 <= MaxRecordSize, "ThreadBufferSize too small for LineBuffSize");
+
+    struct RecordHeader {
+        uint64_t    timestamp;
+        uint32_t    length;         // Payload length, or PaddingLength
+        uint32_t    size;           // Size of the record in the buffer, header included
+    };
+
+    // One writing thread's buffer:  single-producer / single-consumer ring.
+    struct Slot {
+        // Written by the owning thread only.
+        alignas(64) std::atomic<uint64_t> published;    // Ring position of end of last record
+        std::atomic<size_t> bytesWritten;               // Payload bytes ever written
+        uint64_t    writePos;           // Ring position of next record
+        uint64_t    consumedSeen;       // Last value read from consumed
+        // Written under mergeLock only.
+        alignas(64) std::atomic<uint64_t> consumed;     // Ring position up to which merged
+        bool        claimed;
+        std::thread::id owner;
+        alignas(64) char data[ThreadBufferSize];
+    };
+
+    // Per-thread cache of the slot used with the most recently used instance.
+    struct SlotCache {
+        const PerThreadFileWriter *instance;
+        Slot *      slot;
+    };
+
+    // Return the calling thread's slot, claiming one if necessary; NULL if none is free.
+    Slot *threadSlot(void);
+
+    // Reserve space for a record of nChars payload bytes in slot, flushing if the buffer is
+    // full.  Returns pointer to the payload area.  *flushResult is set if flush() was called.
+    char *reserve(Slot *slot, size_t nChars, uint32_t *flushResult);
+
+    // Publish the record most recently reserved in slot, with used payload bytes; it takes
+    // only the space used, not all that was reserved.
+    void commit(Slot *slot, char *payload, size_t used);
+
+    // Size in the buffer of a record of nChars payload bytes, header included.
+    static size_t recordSizeOf(size_t nChars)
+    {
+        return HeaderSize + ((nChars + HeaderSize - 1) & ~(HeaderSize - 1));
+    }
+
+    // Merge published records into the writer; mergeLock must be held.
+    void merge(void);
+
+    RecordHeader *headerAt(Slot *slot, uint64_t pos)
+    {
+        return reinterpret_cast<RecordHeader *>(slot->data + (size_t)(pos & BufferMask));
+    }
+
+    Writer &    writer;
+    Slot        slots[MaxThreads];
+    // Guards merging (and the wrapped writer) and slot claiming.
+    std::mutex  mergeLock;
+    // getBytesWrittenTotal() value subtracted by the last resetBytesWrittenTotal().
+    std::atomic<size_t> bytesWrittenBase;
+
+    static thread_local SlotCache slotCache;
+};
+
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+thread_local typename PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::SlotCache
+        PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::slotCache = { NULL, NULL };
+
+
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::PerThreadFileWriter(Writer &_writer)
+    : writer(_writer), bytesWrittenBase(0)
+{
+    for (size_t i = 0; i < MaxThreads; ++i) {
+        slots[i].published.store(0, std::memory_order_relaxed);
+        slots[i].bytesWritten.store(0, std::memory_order_relaxed);
+        slots[i].writePos = 0;
+        slots[i].consumedSeen = 0;
+        slots[i].consumed.store(0, std::memory_order_relaxed);
+        slots[i].claimed = false;
+    }
+}
+
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+uint32_t PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::write(const char *source,
+        size_t nChars)
+{
+    uint32_t retval = 0;
+    Slot *slot = threadSlot();
+    if (NULL == slot) {
+        retval = WriteNoSlot;
+    } else if (nChars > MaxRecordSize) {
+        retval = WriteTooLarge;
+    } else {
+        char *payload = reserve(slot, nChars, &retval);
+        memcpy(payload, source, nChars);
+        commit(slot, payload, nChars);
+    }
+    return retval;
+}
+
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+uint32_t PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::writeStr(const char *string)
+{
+    uint32_t retval = 0;
+    if (NULL != string) {
+        retval = write(string, strlen(string));
+    }
+    return retval;
+}
+
+// Formats straight into the thread's buffer (one byte extra for vsnprintf()'s terminator),
+// then publishes only the characters produced.
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+int PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::vprintf(const char *fmt,
+        va_list arglist)
+{
+    int retval = 0;
+    Slot *slot = threadSlot();
+    if (NULL == slot) {
+        retval = -1;
+    } else if (NULL != fmt) {
+        uint32_t flushResult;
+        char *payload = reserve(slot, LineBuffSize + 1, &flushResult);
+        int nChars = vsnprintf(payload, LineBuffSize + 1, fmt, arglist);
+        if (nChars < 0) {
+            nChars = 0;
+        } else if ((size_t)nChars > LineBuffSize) {
+            nChars = (int)LineBuffSize;
+        }
+        commit(slot, payload, (size_t)nChars);
+        retval = nChars;
+    }
+    return retval;
+}
+
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+uint32_t PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::flush(void)
+{
+    std::lock_guard<std::mutex> guard(mergeLock);
+    merge();
+    return writer.flush();
+}
+
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+void PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::releaseThread(void)
+{
+    std::lock_guard<std::mutex> guard(mergeLock);
+    merge();
+    writer.flush();
+    std::thread::id self = std::this_thread::get_id();
+    for (size_t i = 0; i < MaxThreads; ++i) {
+        if (slots[i].claimed && (slots[i].owner == self)) {
+            slots[i].claimed = false;
+            slots[i].owner = std::thread::id();
+        }
+    }
+    if (this == slotCache.instance) {
+        slotCache.instance = NULL;
+        slotCache.slot = NULL;
+    }
+}
+
+// Sum of the per-thread counters; each is written only by its own thread.
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+size_t PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::getBytesWrittenTotal(void)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < MaxThreads; ++i) {
+        total += slots[i].bytesWritten.load(std::memory_order_relaxed);
+    }
+    return total - bytesWrittenBase.load(std::memory_order_relaxed);
+}
+
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+void PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::resetBytesWrittenTotal(void)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < MaxThreads; ++i) {
+        total += slots[i].bytesWritten.load(std::memory_order_relaxed);
+    }
+    bytesWrittenBase.store(total, std::memory_order_relaxed);
+}
+
+// Fast path is the thread_local cache; searching and claiming happen once per thread.
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+typename PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::Slot *
+PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::threadSlot(void)
+{
+    if (this != slotCache.instance) {
+        std::lock_guard<std::mutex> guard(mergeLock);
+        std::thread::id self = std::this_thread::get_id();
+        Slot *found = NULL;
+        Slot *unclaimed = NULL;
+        for (size_t i = 0; (i < MaxThreads) && (NULL == found); ++i) {
+            if (!slots[i].claimed) {
+                if (NULL == unclaimed) {
+                    unclaimed = &slots[i];
+                }
+            } else if (slots[i].owner == self) {
+                found = &slots[i];
+            }
+        }
+        if ((NULL == found) && (NULL != unclaimed)) {
+            found = unclaimed;
+            found->claimed = true;
+            found->owner = self;
+        }
+        if (NULL == found) {
+            return NULL;
+        }
+        slotCache.instance = this;
+        slotCache.slot = found;
+    }
+    return slotCache.slot;
+}
+
+// Records never straddle the end of the ring:  the tail of the ring is filled with a padding
+// record instead.  Record sizes are multiples of HeaderSize so a padding header always fits.
+// The reserved size only decides where the record goes; commit() sets its real size.
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+char *PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::reserve(Slot *slot,
+        size_t nChars, uint32_t *flushResult)
+{
+    size_t recordSize = recordSizeOf(nChars);
+    size_t toEnd = ThreadBufferSize - (size_t)(slot->writePos & BufferMask);
+    size_t needed = (recordSize <= toEnd) ? recordSize : (toEnd + recordSize);
+
+    if (slot->writePos + needed - slot->consumedSeen > ThreadBufferSize) {
+        slot->consumedSeen = slot->consumed.load(std::memory_order_acquire);
+        if (slot->writePos + needed - slot->consumedSeen > ThreadBufferSize) {
+            *flushResult = flush();
+            slot->consumedSeen = slot->consumed.load(std::memory_order_acquire);
+        }
+    }
+    if (recordSize > toEnd) {
+        RecordHeader *padding = headerAt(slot, slot->writePos);
+        padding->length = PaddingLength;
+        padding->size = (uint32_t)toEnd;
+        slot->writePos += toEnd;
+    }
+    RecordHeader *header = headerAt(slot, slot->writePos);
+    header->timestamp = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    header->size = (uint32_t)recordSize;
+    return reinterpret_cast<char *>(header) + HeaderSize;
+}
+
+// The slot has one producer and the merge reads only up to published, so the record can
+// shrink to the space used:  a vprintf() line no longer holds LineBuffSize bytes.
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+void PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::commit(Slot *slot,
+        char *payload, size_t used)
+{
+    RecordHeader *header = reinterpret_cast<RecordHeader *>(payload - HeaderSize);
+    header->length = (uint32_t)used;
+    header->size = (uint32_t)recordSizeOf(used);
+    slot->writePos += header->size;
+    slot->bytesWritten.store(slot->bytesWritten.load(std::memory_order_relaxed) + used,
+            std::memory_order_relaxed);
+    slot->published.store(slot->writePos, std::memory_order_release);
+}
+
+// k-way merge over the slots' published records, smallest timestamp first.
+template <class Writer, size_t MaxThreads, size_t ThreadBufferSize>
+void PerThreadFileWriter<Writer, MaxThreads, ThreadBufferSize>::merge(void)
+{
+    uint64_t pos[MaxThreads];
+    uint64_t end[MaxThreads];
+    for (size_t i = 0; i < MaxThreads; ++i) {
+        pos[i] = slots[i].consumed.load(std::memory_order_relaxed);
+        end[i] = slots[i].published.load(std::memory_order_acquire);
+    }
+    for (;;) {
+        size_t nextIndex = 0;
+        RecordHeader *nextHeader = NULL;
+        for (size_t i = 0; i < MaxThreads; ++i) {
+            while (pos[i] < end[i]) {
+                RecordHeader *header = headerAt(&slots[i], pos[i]);
+                if (PaddingLength != header->length) {
+                    if ((NULL == nextHeader) || (header->timestamp < nextHeader->timestamp)) {
+                        nextIndex = i;
+                        nextHeader = header;
+                    }
+                    break;
+                }
+                pos[i] += header->size;
+            }
+        }
+        if (NULL == nextHeader) {
+            break;
+        }
+        writer.write(reinterpret_cast<char *>(nextHeader) + HeaderSize, nextHeader->length);
+        pos[nextIndex] += nextHeader->size;
+    }
+    for (size_t i = 0; i < MaxThreads; ++i) {
+        slots[i].consumed.store(pos[i], std::memory_order_release);
+    }
+}
+
+#endif //ndef PER_THREAD_FILE_WRITER_H
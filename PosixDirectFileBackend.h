@@ -0,0 +1,301 @@
+/****************************************************************************
+ *   FILENAME: PosixDirectFileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: BasicBufferedFileWriter backend writing around the page cache (Linux O_DIRECT).
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       On Linux hosts, log data written through PosixFileBackend is held a second time in
+ *       the page cache, where it competes with the application for memory.  This backend
+ *       writes with O_DIRECT, which needs memory address, file offset and length all to be
+ *       multiples of the device's logical block size (BlockSize, a power of two).
+ *
+ *       The handle is a DirectFile (caller's storage, like the writers:  static instances
+ *       recommended), opened with DirectFile::open() and closed with DirectFile::close().
+ *       It keeps the partial last block of the file in an aligned tail buffer:
+ *        - Whole blocks of data are written straight from the caller's memory if it is
+ *          aligned, otherwise copied through an aligned bounce buffer (BounceSize bytes).
+ *        - The partial last block is written padded with zeros to BlockSize, so everything
+ *          passed to write() is on the media when it returns; the next write() rewrites that
+ *          block with the new bytes appended.
+ *        - close() truncates the file to its true length (until then the file size is
+ *          rounded up to a whole block).
+ *       BufferAlignment (see FileBackend.h) aligns the writers' buffers, and with
+ *       setFlushAlignment(BlockSize) every flush of a full buffer is whole aligned blocks
+ *       straight from the buffer:  no copy, no padding.  Only flush() pads, and the padded
+ *       block is rewritten once by the next flush.
+ *
+ *       File systems without O_DIRECT refuse it at open() (EINVAL); the file is then
+ *       opened without it and written the same way, through the page cache.
+ *
+ *       Supports sync with fdatasync(2).  No gathered writes (every iovec would have to be
+ *       aligned) and no open / close by name (the DirectFile holds the state).
+ *
+ ****************************************************************************/
+
+#ifndef POSIX_DIRECT_FILE_BACKEND_H
+#define POSIX_DIRECT_FILE_BACKEND_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // O_DIRECT
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "FileBackend.h"
+
+template <size_t BlockSize = 4096, size_t BounceSize = 65536>
+class DirectFile
+{
+public:
+    static_assert((BlockSize & (BlockSize - 1)) == 0, "BlockSize must be a power of two");
+    static_assert((BounceSize % BlockSize) == 0, "BounceSize must be a multiple of BlockSize");
+
+    DirectFile(void);
+
+    // close()s if open.
+    ~DirectFile(void);
+
+    // Open name for write, creating it; truncate it unless append.  Returns false on error.
+    bool open(const char *name, bool append = false);
+
+    // Truncate to the true length and close.  Returns false on error (the file is closed).
+    bool close(void);
+
+    bool isOpen(void) { return fd >= 0; }
+
+    // Opened with O_DIRECT (false if the file system refused it).
+    bool isDirect(void) { return direct; }
+
+    // Bytes accepted by write(), plus the length at open() with append.
+    uint64_t getLength(void) { return length; }
+
+    // Backend write:  returns nChars, or on error the bytes written before the first failed
+    // block (bytes after it are not counted in the length).
+    uint32_t write(const char *data, size_t nChars);
+
+    // fdatasync(2).  Returns true on success.
+    bool sync(void);
+
+private:
+    // Block copy-ctor, assignment operator.
+    DirectFile(const DirectFile &obj);
+    DirectFile& operator=(const DirectFile& obj);
+
+    // pwrite(2) all of data (aligned) at offset (aligned), retrying after EINTR and partial
+    // writes.  Returns false on error.
+    bool writeAt(const char *data, size_t nChars, uint64_t offset);
+
+    // Write whole blocks of data at length, through the bounce buffer if data is unaligned.
+    bool writeBlocks(const char *data, size_t nChars);
+
+    // Partial last block, zero beyond tailCount
+    alignas(BlockSize) char tail[BlockSize];
+    // Staging for unaligned data
+    alignas(BlockSize) char bounce[BounceSize];
+    int         fd;
+    bool        direct;
+    // True length of the file
+    uint64_t    length;
+    // Bytes of tail in use:  length % BlockSize
+    size_t      tailCount;
+};
+
+template <size_t BlockSize = 4096, size_t BounceSize = 65536>
+struct PosixDirectFileBackend : public FileBackendDefaults
+{
+    typedef DirectFile<BlockSize, BounceSize> * Handle;
+
+    static const size_t BufferAlignment = BlockSize;
+    static const bool SupportsSync = true;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Returns number of bytes written.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return file->write(data, nChars);
+    }
+
+    static bool sync(Handle file)
+    {
+        return file->sync();
+    }
+};
+
+
+template <size_t BlockSize, size_t BounceSize>
+DirectFile<BlockSize, BounceSize>::DirectFile(void)
+    : fd(-1), direct(false), length(0), tailCount(0)
+{
+    memset(tail, 0, sizeof(tail));
+}
+
+template <size_t BlockSize, size_t BounceSize>
+DirectFile<BlockSize, BounceSize>::~DirectFile(void)
+{
+    if (fd >= 0) {
+        close();
+    }
+}
+
+// With append, the partial last block is read back into tail so the next write can rewrite it.
+template <size_t BlockSize, size_t BounceSize>
+bool DirectFile<BlockSize, BounceSize>::open(const char *name, bool append)
+{
+    bool retval = false;
+    if (fd < 0) {
+        int flags = O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC);
+        // O_RDWR:  append reads the partial last block back.
+        if (append) {
+            flags = (flags & ~O_WRONLY) | O_RDWR;
+        }
+        fd = ::open(name, flags | O_DIRECT, 0644);
+        direct = (fd >= 0);
+        if ((fd < 0) && (EINVAL == errno)) {
+            fd = ::open(name, flags, 0644);
+        }
+        if (fd >= 0) {
+            struct stat status;
+            length = 0;
+            tailCount = 0;
+            memset(tail, 0, sizeof(tail));
+            retval = true;
+            if (append && (0 == fstat(fd, &status))) {
+                length = (uint64_t)status.st_size;
+                tailCount = (size_t)(length % BlockSize);
+                if (tailCount > 0) {
+                    retval = (pread(fd, tail, BlockSize, (off_t)(length - tailCount)) >= (ssize_t)tailCount);
+                    memset(tail + tailCount, 0, BlockSize - tailCount);
+                }
+            }
+            if (!retval) {
+                ::close(fd);
+                fd = -1;
+            }
+        }
+    }
+    return retval;
+}
+
+template <size_t BlockSize, size_t BounceSize>
+bool DirectFile<BlockSize, BounceSize>::close(void)
+{
+    bool retval = false;
+    if (fd >= 0) {
+        retval = (0 == ftruncate(fd, (off_t)length));
+        retval = (0 == ::close(fd)) && retval;
+        fd = -1;
+    }
+    return retval;
+}
+
+// Complete the tail block from data, write whole blocks, keep the rest as the new tail, and
+// write the tail padded.  length only counts bytes whose block was written:  a failed block
+// write leaves the tail as it was before this call, so close() never truncates to a length
+// that includes unwritten data.
+template <size_t BlockSize, size_t BounceSize>
+uint32_t DirectFile<BlockSize, BounceSize>::write(const char *data, size_t nChars)
+{
+    size_t accepted = 0;
+    // Bytes of this call held in the tail, rolled back if the padded tail write fails
+    size_t tailAdded = 0;
+    bool ok = true;
+    if (tailCount > 0) {
+        size_t fill = BlockSize - tailCount;
+        if (fill > nChars) {
+            fill = nChars;
+        }
+        memcpy(tail + tailCount, data, fill);
+        if (BlockSize == tailCount + fill) {
+            ok = writeAt(tail, BlockSize, length - tailCount);
+            if (ok) {
+                memset(tail, 0, sizeof(tail));
+                tailCount = 0;
+            } else {
+                memset(tail + tailCount, 0, fill);
+            }
+        } else {
+            tailCount += fill;
+            tailAdded = fill;
+        }
+        if (ok) {
+            accepted = fill;
+            length += fill;
+        }
+    }
+    size_t blocks = (nChars - accepted) & ~(BlockSize - 1);
+    if (ok && (blocks > 0)) {
+        ok = writeBlocks(data + accepted, blocks);
+        if (ok) {
+            accepted += blocks;
+            length += blocks;
+        }
+    }
+    if (ok && (accepted < nChars)) {
+        // Rest is less than a block, and the tail is empty here.
+        size_t rest = nChars - accepted;
+        memcpy(tail, data + accepted, rest);
+        tailCount = rest;
+        tailAdded = rest;
+        accepted += rest;
+        length += rest;
+    }
+    if (ok && (tailCount > 0)) {
+        ok = writeAt(tail, BlockSize, length - tailCount);
+        if (!ok) {
+            tailCount -= tailAdded;
+            memset(tail + tailCount, 0, tailAdded);
+            accepted -= tailAdded;
+            length -= tailAdded;
+        }
+    }
+    return (uint32_t)accepted;
+}
+
+template <size_t BlockSize, size_t BounceSize>
+bool DirectFile<BlockSize, BounceSize>::sync(void)
+{
+    return 0 == fdatasync(fd);
+}
+
+template <size_t BlockSize, size_t BounceSize>
+bool DirectFile<BlockSize, BounceSize>::writeAt(const char *data, size_t nChars, uint64_t offset)
+{
+    size_t written = 0;
+    while (written < nChars) {
+        ssize_t n = pwrite(fd, data + written, nChars - written, (off_t)(offset + written));
+        if (n > 0) {
+            written += (size_t)n;
+        } else if ((n < 0) && (EINTR == errno)) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    return written == nChars;
+}
+
+template <size_t BlockSize, size_t BounceSize>
+bool DirectFile<BlockSize, BounceSize>::writeBlocks(const char *data, size_t nChars)
+{
+    bool ok = true;
+    if (0 == ((uintptr_t)data & (BlockSize - 1))) {
+        ok = writeAt(data, nChars, length);
+    } else {
+        for (size_t done = 0; ok && (done < nChars); done += BounceSize) {
+            size_t chunk = ((nChars - done) < BounceSize) ? (nChars - done) : BounceSize;
+            memcpy(bounce, data + done, chunk);
+            ok = writeAt(bounce, chunk, length + done);
+        }
+    }
+    return ok;
+}
+
+#endif //ndef POSIX_DIRECT_FILE_BACKEND_H
@@ -0,0 +1,144 @@
+/****************************************************************************
+ *   FILENAME: PosixFileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: BasicBufferedFileWriter backend for POSIX file descriptors.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Writes with write(2), retrying after partial writes and EINTR.
+ *       Returns the number of bytes written; fewer than requested means an error (see errno).
+ *       Supports gathered writes with writev(2), GatherMax segments per call.
+ *       Supports open / close / remove (open(2) with mode 0644, close(2), unlink(2)).
+ *       Supports sync with fdatasync(2).
+ *       Supports reserve with fallocate(2) FALLOC_FL_KEEP_SIZE (Linux):  blocks are allocated
+ *       but the file size still ends at the data; trim is ftruncate(2) at the write position,
+ *       which releases them.
+ *
+ ****************************************************************************/
+
+#ifndef POSIX_FILE_BACKEND_H
+#define POSIX_FILE_BACKEND_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // fallocate()
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "FileBackend.h"
+
+struct PosixFileBackend : public FileBackendDefaults
+{
+    typedef int Handle;
+
+    static const bool SupportsGather = true;
+    static const bool SupportsOpen = true;
+    static const bool SupportsSync = true;
+    static const bool SupportsReserve = true;
+    // Segments passed to one writev(2) call.
+    static const size_t GatherMax = 16;
+
+    static Handle noFile(void)
+    {
+        return -1;
+    }
+
+    static Handle open(const char *name)
+    {
+        return ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+
+    static void close(Handle file)
+    {
+        ::close(file);
+    }
+
+    static bool remove(const char *name)
+    {
+        return 0 == ::unlink(name);
+    }
+
+    static bool sync(Handle file)
+    {
+        return 0 == ::fdatasync(file);
+    }
+
+    static bool reserve(Handle file, size_t nBytes)
+    {
+        off_t position = ::lseek(file, 0, SEEK_CUR);
+        return (position >= 0) && (0 == ::fallocate(file, FALLOC_FL_KEEP_SIZE, position, (off_t)nBytes));
+    }
+
+    static bool trim(Handle file)
+    {
+        off_t position = ::lseek(file, 0, SEEK_CUR);
+        return (position >= 0) && (0 == ::ftruncate(file, position));
+    }
+
+    // Returns number of bytes written.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        size_t written = 0;
+        while (written < nChars) {
+            ssize_t n = ::write(file, data + written, nChars - written);
+            if (n > 0) {
+                written += (size_t)n;
+            } else if ((n < 0) && (EINTR == errno)) {
+                continue;
+            } else {
+                break;
+            }
+        }
+        return (uint32_t)written;
+    }
+
+    // Returns number of bytes written.
+    static uint32_t writev(Handle file, const WriteSegment *segments, size_t count)
+    {
+        struct iovec iov[GatherMax];
+        size_t written = 0;
+        size_t index = 0;       // First segment not completely written
+        size_t offset = 0;      // Bytes of segments[index] already written
+        for (;;) {
+            while ((index < count) && (offset >= segments[index].length)) {
+                ++index;
+                offset = 0;
+            }
+            if (index >= count) {
+                break;
+            }
+            int nIov = 0;
+            for (size_t i = index; (i < count) && ((size_t)nIov < GatherMax); ++i) {
+                size_t skip = (i == index) ? offset : 0;
+                iov[nIov].iov_base = const_cast<char *>(segments[i].data + skip);
+                iov[nIov].iov_len = segments[i].length - skip;
+                ++nIov;
+            }
+            ssize_t n = ::writev(file, iov, nIov);
+            if (n > 0) {
+                written += (size_t)n;
+                // Advance past the bytes written; whole segments are skipped at the loop top.
+                size_t left = (size_t)n;
+                while (left > 0) {
+                    size_t remaining = segments[index].length - offset;
+                    size_t step = (left < remaining) ? left : remaining;
+                    offset += step;
+                    left -= step;
+                    if (offset >= segments[index].length) {
+                        ++index;
+                        offset = 0;
+                    }
+                }
+            } else if ((n < 0) && (EINTR == errno)) {
+                continue;
+            } else {
+                break;
+            }
+        }
+        return (uint32_t)written;
+    }
+};
+
+#endif //ndef POSIX_FILE_BACKEND_H
@@ -0,0 +1,173 @@
+/****************************************************************************
+ *   FILENAME: PreallocBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  flush latency distribution of BasicBufferedFileWriter with and
+ *            without file space preallocation (setPreallocation()).
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  PreallocBench [-d <directory>] [-m <MiB>] [-s]
+ *       Defaults:  current directory, 1024 MiB per run.  The output file (pabench.log) is
+ *       deleted after each run.
+ *
+ *       100-byte lines go through a BasicBufferedFileWriter<4096> on PosixFileBackend, with
+ *       no preallocation, 4 MiB chunks and 64 MiB chunks.  Every flush is timed, including
+ *       the fallocate(2) that reserves the next chunk ahead of it.  Reported per run:  p50,
+ *       p99, p99.9 and maximum flush latency in microseconds, and the MiB/s of the run.
+ *       With -s, an fdatasync(2) follows every MiB and its latency distribution is reported
+ *       too (in milliseconds).  Each file is trimmed and closed; exit code 1 if its size is
+ *       wrong.
+ *
+ *       ext4 and XFS already delay block allocation, so differences on a Linux host are
+ *       small; the target case is emFile, where each growing write updates the FAT and the
+ *       directory entry.
+ *
+ *       Builds for Linux hosts only (fallocate(), <chrono>, <vector>); not part of the target
+ *       image.  Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "BasicBufferedFileWriter.h"
+#include "PosixFileBackend.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t LineSize = 100;
+static const size_t TextSize = 656 * LineSize;      // About 64 KiB of lines, repeated
+static const size_t SyncEvery = 1024 * 1024;
+
+static std::vector<double> flushMicroseconds;
+
+// PosixFileBackend with every write timed; a reserve() is added to the write after it.
+struct TimedPosixBackend : public PosixFileBackend
+{
+    static const bool SupportsGather = false;
+    static double pendingMicroseconds;
+
+    static bool reserve(Handle file, size_t nBytes)
+    {
+        Clock::time_point start = Clock::now();
+        bool retval = PosixFileBackend::reserve(file, nBytes);
+        pendingMicroseconds += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+        return retval;
+    }
+
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        Clock::time_point start = Clock::now();
+        uint32_t retval = PosixFileBackend::write(file, data, nChars);
+        flushMicroseconds.push_back(pendingMicroseconds
+                + std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+        pendingMicroseconds = 0.0;
+        return retval;
+    }
+};
+double TimedPosixBackend::pendingMicroseconds = 0.0;
+
+static BasicBufferedFileWriter<4096, 256, TimedPosixBackend> writer;
+static char text[TextSize];
+
+// Value below which fraction of the sorted samples lie.
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    size_t index = (size_t)(fraction * (double)(sorted.size() - 1));
+    return sorted[index];
+}
+
+static bool run(const char *path, size_t total, size_t chunk, bool sync)
+{
+    int fd = PosixFileBackend::open(path);
+    if (fd < 0) {
+        fprintf(stderr, "cannot create %s\n", path);
+        return false;
+    }
+    std::vector<double> syncMilliseconds;
+    flushMicroseconds.clear();
+    flushMicroseconds.reserve(total / 4096 + 16);
+    TimedPosixBackend::pendingMicroseconds = 0.0;
+    writer.setPreallocation(chunk);
+    Clock::time_point start = Clock::now();
+    writer.setFile(fd);
+    size_t nextSync = SyncEvery;
+    for (size_t pos = 0; pos < total; pos += LineSize) {
+        writer.write(text + pos % TextSize, LineSize);
+        if (sync && (pos + LineSize >= nextSync)) {
+            writer.flush();
+            Clock::time_point syncStart = Clock::now();
+            PosixFileBackend::sync(fd);
+            syncMilliseconds.push_back(std::chrono::duration<double, std::milli>(Clock::now() - syncStart).count());
+            nextSync += SyncEvery;
+        }
+    }
+    writer.flush();
+    writer.trimPreallocation();
+    writer.setFile(PosixFileBackend::noFile());
+    PosixFileBackend::close(fd);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    struct stat status;
+    bool retval = (0 == stat(path, &status)) && ((size_t)status.st_size == total);
+    std::sort(flushMicroseconds.begin(), flushMicroseconds.end());
+    char label[32];
+    if (0 == chunk) {
+        snprintf(label, sizeof(label), "none");
+    } else {
+        snprintf(label, sizeof(label), "%lu MiB chunks", (unsigned long)(chunk >> 20));
+    }
+    printf("%-14s flush us p50 %6.1f  p99 %6.1f  p99.9 %7.1f  max %8.1f  %6.0f MiB/s%s\n", label,
+            percentile(flushMicroseconds, 0.5), percentile(flushMicroseconds, 0.99),
+            percentile(flushMicroseconds, 0.999), flushMicroseconds.back(),
+            (double)total / seconds / (1024.0 * 1024.0), retval ? "" : "  FILE SIZE MISMATCH");
+    if (!syncMilliseconds.empty()) {
+        std::sort(syncMilliseconds.begin(), syncMilliseconds.end());
+        printf("%-14s sync ms  p50 %6.1f  p99 %6.1f  max %8.1f\n", "", percentile(syncMilliseconds, 0.5),
+                percentile(syncMilliseconds, 0.99), syncMilliseconds.back());
+    }
+    PosixFileBackend::remove(path);
+    return retval;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *directory = ".";
+    size_t mebibytes = 1024;
+    bool sync = false;
+    for (int arg = 1; arg < argc; ++arg) {
+        if ((0 == strcmp(argv[arg], "-d")) && (arg + 1 < argc)) {
+            directory = argv[++arg];
+        } else if ((0 == strcmp(argv[arg], "-m")) && (arg + 1 < argc)) {
+            mebibytes = strtoul(argv[++arg], NULL, 0);
+        } else if (0 == strcmp(argv[arg], "-s")) {
+            sync = true;
+        } else {
+            fprintf(stderr, "usage: %s [-d <directory>] [-m <MiB>] [-s]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (0 == mebibytes) {
+        fprintf(stderr, "usage: %s [-d <directory>] [-m <MiB>] [-s]\n", argv[0]);
+        return 2;
+    }
+    for (size_t pos = 0; pos < TextSize; pos += LineSize) {
+        // 99 characters; the terminator is replaced by the newline.
+        snprintf(text + pos, LineSize, "14:05:%02lu.%03lu worker=%02lu req=%08lx %-63s",
+                (unsigned long)(pos / LineSize % 60), (unsigned long)(pos % 1000), (unsigned long)(pos % 32),
+                (unsigned long)(uint32_t)(pos * 2654435761u), "request served");
+        text[pos + LineSize - 1] = '\n';
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "%s/pabench.log", directory);
+    size_t total = mebibytes * 1024 * 1024 / LineSize * LineSize;
+    printf("%lu MiB of %lu-byte lines to %s, 4 KiB writer buffer%s\n", (unsigned long)mebibytes,
+            (unsigned long)LineSize, path, sync ? ", fdatasync every MiB" : "");
+    bool ok = run(path, total, 0, sync);
+    ok = run(path, total, 4u << 20, sync) && ok;
+    ok = run(path, total, 64u << 20, sync) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/****************************************************************************
+ *   FILENAME: PrintfBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  time the writers' vprintf() (formatting straight into the write
+ *            buffer) against the former line buffer path, on 80 to 200 byte log lines.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  PrintfBench [<lines>]
+ *       Default 2000000 lines per run.  The former path is vsnprintf() into a LineBuffSize
+ *       line buffer, then write() of the result, as vprintf() did before formatting moved
+ *       into the write buffer.  Each path runs on BasicBufferedFileWriter and on
+ *       BasicDoubleBufferedFileWriter (4096-byte buffers, NullFileBackend), so only
+ *       formatting and copying are timed.  Reported:  ns per line; exit code 1 if the
+ *       paths' byte counts differ.
+ *
+ *       Builds for the host only (threads, <chrono>); not part of the target image.
+ *       Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "BasicDoubleBufferedFileWriter.h"
+#include "MemoryFileBackend.h"
+
+typedef std::chrono::steady_clock Clock;
+typedef BasicBufferedFileWriter<4096, 2048, NullFileBackend> Writer;
+typedef BasicDoubleBufferedFileWriter<4096, 2, 2048, NullFileBackend> DoubleWriter;
+
+static Writer writer;
+static DoubleWriter doubleWriter;
+
+// The former vprintf():  format into a line buffer, then copy it into the write buffer.
+template <class Out>
+static int lineBuffPrintf(Out &out, const char *fmt, ...)
+{
+    static char lineBuff[Out::LineBuffSize + 1];
+    va_list arglist;
+    va_start(arglist, fmt);
+    int nChars = vsnprintf(lineBuff, sizeof(lineBuff), fmt, arglist);
+    va_end(arglist);
+    if (nChars > 0) {
+        if ((size_t)nChars > Out::LineBuffSize) {
+            nChars = (int)Out::LineBuffSize;
+        }
+        out.write(lineBuff, (size_t)nChars);
+    }
+    return nChars;
+}
+
+template <class Out>
+static int directPrintf(Out &out, const char *fmt, ...)
+{
+    va_list arglist;
+    va_start(arglist, fmt);
+    int retval = out.vprintf(fmt, arglist);
+    va_end(arglist);
+    return retval;
+}
+
+static const char Filler[] = "cache miss on shard 7, fetching from origin; retry budget 3 of 5, "
+        "backoff 120 ms, queue depth above threshold, connection reset by peer, "
+        "reconnecting to replica 2";
+
+// Print lines of 80 to 200 bytes through out; returns ns per line and the bytes written.
+template <class Out>
+static double nsPerLine(Out &out, size_t lines, bool direct, size_t *bytes)
+{
+    NullSink sink = { 0, 0 };
+    out.setFile(&sink);
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < lines; ++i) {
+        // The fixed part is 40 bytes; the filler adds 40 to 160.
+        int fill = (int)(40 + (i * 37) % 121);
+        if (direct) {
+            directPrintf(out, "12:%02u:%02u.%06u worker=%02u req=%08x %.*s\n", (unsigned)(i / 60 % 60),
+                    (unsigned)(i % 60), (unsigned)(i % 1000000), (unsigned)(i % 32), (unsigned)(i * 2654435761u),
+                    fill, Filler);
+        } else {
+            lineBuffPrintf(out, "12:%02u:%02u.%06u worker=%02u req=%08x %.*s\n", (unsigned)(i / 60 % 60),
+                    (unsigned)(i % 60), (unsigned)(i % 1000000), (unsigned)(i % 32), (unsigned)(i * 2654435761u),
+                    fill, Filler);
+        }
+    }
+    out.flush();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    out.setFile(NULL);
+    *bytes = sink.bytes;
+    return seconds * 1e9 / (double)lines;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t lines = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000000;
+    if ((0 == lines) || (argc > 2)) {
+        fprintf(stderr, "usage: %s [<lines>]\n", argv[0]);
+        return 2;
+    }
+    size_t bytes[4];
+    double basicBefore = nsPerLine(writer, lines, false, &bytes[0]);
+    double basicAfter = nsPerLine(writer, lines, true, &bytes[1]);
+    double doubleBefore = nsPerLine(doubleWriter, lines, false, &bytes[2]);
+    double doubleAfter = nsPerLine(doubleWriter, lines, true, &bytes[3]);
+    printf("%lu lines, %.1f bytes average\n", (unsigned long)lines, (double)bytes[0] / (double)lines);
+    printf("writer                  line buffer ns/line   direct ns/line\n");
+    printf("BasicBuffered           %19.1f %16.1f\n", basicBefore, basicAfter);
+    printf("BasicDoubleBuffered     %19.1f %16.1f\n", doubleBefore, doubleAfter);
+    bool same = (bytes[0] == bytes[1]) && (bytes[0] == bytes[2]) && (bytes[0] == bytes[3]);
+    if (!same) {
+        printf("BYTE COUNT MISMATCH\n");
+    }
+    return same ? 0 : 1;
+}
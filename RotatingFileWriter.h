@@ -0,0 +1,357 @@
+/****************************************************************************
+ *   FILENAME: RotatingFileWriter.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Size-based log rotation on top of a (Double)BufferedFileWriter.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       The writers count the bytes written (getBytesWrittenTotal()) precisely so that the
+ *       roll-over decision never needs the (roughly 100ms) file size query; this class is
+ *       that roll-over logic, so callers no longer each carry their own.
+ *
+ *       Files are named by a printf pattern with one unsigned conversion for a sequence
+ *       number, e.g. "trace%04u.log".  Each write(), writeStr() or vprintf() is one record;
+ *       after a record that brings the current file to sizeLimit bytes or more, the writer is
+ *       switched to the next sequence number.  A file therefore exceeds sizeLimit by less than
+ *       one record, and records never straddle two files.  retention files (the current one
+ *       included) are kept; older ones are deleted.  The size is the writer's
+ *       getBytesWrittenTotal() unless setSizeFunction() gives another measure (e.g. the
+ *       compressed size, CompressingBackend::storedSize()).
+ *
+ *       Rotation stays off the writing thread.  A rotation thread keeps the next file
+ *       already open (the "spare"); rotation on the writing thread is only flush(), the
+ *       writer's setFile() to the spare and resetBytesWrittenTotal().  Closing the old file,
+ *       deleting the oldest file and opening the next spare are done by the rotation thread.
+ *       If the spare is not open yet (slow media, or open failed and is being retried),
+ *       rotation is put off to a later record instead of waiting.  With a
+ *       DoubleBufferedFileWriter, flush() waits for buffers already handed off to the old
+ *       file, as any file switch must.
+ *
+ *       With the writer's setPreallocation(), each new file gets its first chunk reserved at
+ *       the switch; the space reserved past the data of a retired file is released
+ *       (Backend::trim(), SupportsReserve) by the rotation thread before it closes the file.
+ *
+ *       Numbering instead of renaming (trace.log -> trace.1.log -> ...) is deliberate:  a
+ *       rename chain costs retention directory updates per rotation, and emFile cannot
+ *       rename the open spare into place.  The spare is an extra, empty file on the media
+ *       until it is used; stop() deletes it.
+ *
+ *       Backend must support open / close / remove (SupportsOpen, see FileBackend.h) and
+ *       be the Backend the Writer was instantiated with.  The writer must only be used
+ *       through this class while it is started.  Single producer, as for the writers.
+ *
+ ****************************************************************************/
+
+#ifndef ROTATING_FILE_WRITER_H
+#define ROTATING_FILE_WRITER_H
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "FileBackend.h"
+
+#ifndef _ATTRIBUTE
+#define _ATTRIBUTE(attrs) __attribute__ (attrs)
+#endif
+
+template <class Writer, class Backend, size_t NameSize = 64>
+class RotatingFileWriter
+{
+public:
+    static_assert(Backend::SupportsOpen, "RotatingFileWriter needs a Backend with open / close / remove");
+
+    // Longest file name, including NUL; made constant to allow static allocation.
+    static const size_t MaxNameSize = NameSize;
+
+    // Size of file (the current one) for the sizeLimit comparison.
+    typedef size_t (*SizeFunction)(typename Backend::Handle file, void *context);
+
+    // namePattern:  printf pattern with one unsigned conversion (the sequence number); must
+    // outlive this object.  sizeLimit:  bytes per file.  retention:  files kept, at least 1.
+    RotatingFileWriter(Writer &_writer, const char *_namePattern, size_t _sizeLimit, uint32_t _retention);
+
+    // stop()s if started.
+    virtual ~RotatingFileWriter(void);
+
+    // Open file firstSequence (truncating it), connect the writer to it and start the
+    // rotation thread, which opens the spare.  Returns false if the file cannot be opened.
+    bool start(uint32_t firstSequence = 0);
+
+    // Flush and close the current file, delete the unused spare, stop the rotation thread.
+    void stop(void);
+
+    // Write (binary) data as one record.  Return code as for Writer::write().
+    uint32_t write(const char *source, size_t nChars);
+
+    // Write string as one record, length from strlen().  Return code as for Writer::writeStr().
+    uint32_t writeStr(const char *string);
+
+    // vprintf formatting as one record.  Return code as for Writer::vprintf().
+    int vprintf(const char * fmt, va_list arglist)
+            _ATTRIBUTE ((__format__ (__printf__, 2, 0)));
+
+    // Measure the current file with sizeFunction instead of the writer's byte count; NULL
+    // goes back to the byte count.
+    void setSizeFunction(SizeFunction _sizeFunction, void *_sizeContext);
+
+    // Flush the writer to the current file.  Returns Writer::flush() return code.
+    uint32_t flush(void);
+
+    // Return sequence number of the current file.
+    uint32_t getSequence(void);
+
+    // Return number of rotations done since start().
+    uint32_t getRotationCount(void);
+
+private:
+    typedef typename Backend::Handle Handle;
+
+    // Block copy-ctor, assignment operator.
+    RotatingFileWriter(const RotatingFileWriter &obj);
+    RotatingFileWriter& operator=(const RotatingFileWriter& obj);
+
+    // After each record:  rotate if the current file has reached sizeLimit.
+    void endRecord(void);
+
+    // Switch the writer to the spare if it is open; otherwise ask for it and carry on.
+    void rotate(void);
+
+    // Write the name of file number into name.  Returns false if it does not fit.
+    bool makeName(char *name, uint32_t number);
+
+    // Rotation thread:  close retired files, delete files past retention, open the spare.
+    void rotatorMain(void);
+
+    Writer &    writer;
+    const char * namePattern;
+    size_t      sizeLimit;
+    uint32_t    retention;
+    SizeFunction sizeFunction;
+    void *      sizeContext;
+    // Current file; writing thread only.
+    Handle      current;
+    uint32_t    rotationCount;
+
+    // Protects everything below.  Held only to hand over state, never during file I/O.
+    std::mutex  lock;
+    std::condition_variable wake;
+    std::thread rotator;
+    // Sequence number of the current file
+    uint32_t    sequence;
+    // Next file, opened ahead by the rotation thread; noFile() while not open
+    Handle      spare;
+    // Previous file, to be closed by the rotation thread; noFile() if none
+    Handle      retired;
+    // Rotation thread has work:  a retired file, or a spare to open
+    bool        workPending;
+    bool        stopping;
+};
+
+
+template <class Writer, class Backend, size_t NameSize>
+RotatingFileWriter<Writer, Backend, NameSize>::RotatingFileWriter(Writer &_writer, const char *_namePattern,
+        size_t _sizeLimit, uint32_t _retention)
+    : writer(_writer), namePattern(_namePattern), sizeLimit(_sizeLimit),
+      retention((_retention > 0) ? _retention : 1), sizeFunction(NULL), sizeContext(NULL),
+      current(Backend::noFile()), rotationCount(0),
+      sequence(0), spare(Backend::noFile()), retired(Backend::noFile()), workPending(false),
+      stopping(false)
+{
+}
+
+template <class Writer, class Backend, size_t NameSize>
+RotatingFileWriter<Writer, Backend, NameSize>::~RotatingFileWriter(void)
+{
+    stop();
+}
+
+template <class Writer, class Backend, size_t NameSize>
+bool RotatingFileWriter<Writer, Backend, NameSize>::start(uint32_t firstSequence)
+{
+    bool retval = false;
+    char name[MaxNameSize];
+    if ((Backend::noFile() == current) && makeName(name, firstSequence)) {
+        current = Backend::open(name);
+        if (Backend::noFile() != current) {
+            writer.setFile(current);
+            writer.resetBytesWrittenTotal();
+            rotationCount = 0;
+            sequence = firstSequence;
+            stopping = false;
+            workPending = true;
+            rotator = std::thread(&RotatingFileWriter::rotatorMain, this);
+            retval = true;
+        }
+    }
+    return retval;
+}
+
+// The rotation thread finishes any pending work (closing a retired file) before it exits.
+template <class Writer, class Backend, size_t NameSize>
+void RotatingFileWriter<Writer, Backend, NameSize>::stop(void)
+{
+    if (Backend::noFile() != current) {
+        writer.flush();
+        writer.setFile(Backend::noFile());
+        BackendReserve<Backend>::trim(current);
+        Backend::close(current);
+        current = Backend::noFile();
+
+        std::unique_lock<std::mutex> guard(lock);
+        stopping = true;
+        wake.notify_one();
+        guard.unlock();
+        rotator.join();
+
+        if (Backend::noFile() != spare) {
+            char name[MaxNameSize];
+            Backend::close(spare);
+            spare = Backend::noFile();
+            if (makeName(name, sequence + 1)) {
+                Backend::remove(name);
+            }
+        }
+    }
+}
+
+template <class Writer, class Backend, size_t NameSize>
+uint32_t RotatingFileWriter<Writer, Backend, NameSize>::write(const char *source, size_t nChars)
+{
+    uint32_t retval = writer.write(source, nChars);
+    endRecord();
+    return retval;
+}
+
+template <class Writer, class Backend, size_t NameSize>
+uint32_t RotatingFileWriter<Writer, Backend, NameSize>::writeStr(const char *string)
+{
+    uint32_t retval = writer.writeStr(string);
+    endRecord();
+    return retval;
+}
+
+template <class Writer, class Backend, size_t NameSize>
+int RotatingFileWriter<Writer, Backend, NameSize>::vprintf(const char * fmt, va_list arglist)
+{
+    int retval = writer.vprintf(fmt, arglist);
+    endRecord();
+    return retval;
+}
+
+template <class Writer, class Backend, size_t NameSize>
+void RotatingFileWriter<Writer, Backend, NameSize>::setSizeFunction(SizeFunction _sizeFunction, void *_sizeContext)
+{
+    sizeFunction = _sizeFunction;
+    sizeContext = _sizeContext;
+}
+
+template <class Writer, class Backend, size_t NameSize>
+uint32_t RotatingFileWriter<Writer, Backend, NameSize>::flush(void)
+{
+    return writer.flush();
+}
+
+template <class Writer, class Backend, size_t NameSize>
+uint32_t RotatingFileWriter<Writer, Backend, NameSize>::getSequence(void)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return sequence;
+}
+
+template <class Writer, class Backend, size_t NameSize>
+uint32_t RotatingFileWriter<Writer, Backend, NameSize>::getRotationCount(void)
+{
+    return rotationCount;
+}
+
+template <class Writer, class Backend, size_t NameSize>
+void RotatingFileWriter<Writer, Backend, NameSize>::endRecord(void)
+{
+    if (Backend::noFile() != current) {
+        size_t size = (NULL != sizeFunction) ? sizeFunction(current, sizeContext) : writer.getBytesWrittenTotal();
+        if (size >= sizeLimit) {
+            rotate();
+        }
+    }
+}
+
+// The old file gets everything written so far (flush()), then the writer moves to the spare
+// and the old handle goes to the rotation thread to be closed.
+template <class Writer, class Backend, size_t NameSize>
+void RotatingFileWriter<Writer, Backend, NameSize>::rotate(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (Backend::noFile() == spare) {
+        // Still opening, or the last open failed:  (re)try in the background, rotate later.
+        if (!workPending) {
+            workPending = true;
+            wake.notify_one();
+        }
+    } else {
+        Handle next = spare;
+        spare = Backend::noFile();
+        ++sequence;
+        guard.unlock();
+
+        writer.flush();
+        writer.setFile(next);
+        writer.resetBytesWrittenTotal();
+        Handle previous = current;
+        current = next;
+        ++rotationCount;
+
+        guard.lock();
+        retired = previous;
+        workPending = true;
+        wake.notify_one();
+    }
+}
+
+template <class Writer, class Backend, size_t NameSize>
+bool RotatingFileWriter<Writer, Backend, NameSize>::makeName(char *name, uint32_t number)
+{
+    int nChars = snprintf(name, MaxNameSize, namePattern, (unsigned)number);
+    return (nChars > 0) && ((size_t)nChars < MaxNameSize);
+}
+
+// Work is taken under the lock and done without it, so the writing thread never waits on
+// file system calls.  The spare is always the file after the current one.
+template <class Writer, class Backend, size_t NameSize>
+void RotatingFileWriter<Writer, Backend, NameSize>::rotatorMain(void)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        wake.wait(guard, [this] { return workPending || stopping; });
+        if (!workPending) {
+            break;
+        }
+        workPending = false;
+        Handle toClose = retired;
+        retired = Backend::noFile();
+        uint32_t active = sequence;
+        bool needSpare = (Backend::noFile() == spare) && !stopping;
+        guard.unlock();
+
+        char name[MaxNameSize];
+        if (Backend::noFile() != toClose) {
+            BackendReserve<Backend>::trim(toClose);
+            Backend::close(toClose);
+            if ((active >= retention) && makeName(name, active - retention)) {
+                Backend::remove(name);
+            }
+        }
+        Handle opened = Backend::noFile();
+        if (needSpare && makeName(name, active + 1)) {
+            opened = Backend::open(name);
+        }
+
+        guard.lock();
+        if (Backend::noFile() != opened) {
+            spare = opened;
+        }
+    }
+}
+
+#endif //ndef ROTATING_FILE_WRITER_H
@@ -0,0 +1,81 @@
+/****************************************************************************
+ *   FILENAME: StdioFileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: BasicBufferedFileWriter backend for C stdio streams.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Writes with fwrite().  Returns the number of bytes written.
+ *       The stream's own buffering still applies; use setvbuf(file, NULL, _IONBF, 0) to have
+ *       each flush() reach the OS directly.
+ *       Supports open / close / remove (fopen(name, "wb"), fclose(), remove()).
+ *       Supports sync on POSIX hosts:  fflush(), then fdatasync(2) on fileno().
+ *       Supports reserve / trim on Linux hosts, as PosixFileBackend on fileno() at ftell().
+ *
+ ****************************************************************************/
+
+#ifndef STDIO_FILE_BACKEND_H
+#define STDIO_FILE_BACKEND_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE         // fallocate()
+#endif
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "FileBackend.h"
+
+struct StdioFileBackend : public FileBackendDefaults
+{
+    typedef FILE * Handle;
+
+    static const bool SupportsOpen = true;
+    static const bool SupportsSync = true;
+    static const bool SupportsReserve = true;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    static Handle open(const char *name)
+    {
+        return fopen(name, "wb");
+    }
+
+    static void close(Handle file)
+    {
+        fclose(file);
+    }
+
+    static bool remove(const char *name)
+    {
+        return 0 == ::remove(name);
+    }
+
+    static bool sync(Handle file)
+    {
+        return (0 == fflush(file)) && (0 == ::fdatasync(fileno(file)));
+    }
+
+    static bool reserve(Handle file, size_t nBytes)
+    {
+        long position = ftell(file);
+        return (position >= 0) && (0 == fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, (off_t)position, (off_t)nBytes));
+    }
+
+    // Flushes the stream first, so the file size reaches the write position.
+    static bool trim(Handle file)
+    {
+        long position = ftell(file);
+        return (position >= 0) && (0 == fflush(file)) && (0 == ftruncate(fileno(file), (off_t)position));
+    }
+
+    // Returns number of bytes written.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return (uint32_t)fwrite(data, 1, nChars, file);
+    }
+};
+
+#endif //ndef STDIO_FILE_BACKEND_H
@@ -0,0 +1,131 @@
+/****************************************************************************
+ *   FILENAME: TimestampFormat.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: ISO-8601 UTC timestamps for log lines, e.g. "2020-06-30T14:05:09.123Z".
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Every log line starts with a timestamp, and consecutive lines almost always share
+ *       the same date, hour and minute.  A TimestampFormat keeps the text up to the minute
+ *       ("YYYY-MM-DDTHH:MM:") for the last minute it formatted; a timestamp in that minute
+ *       is a copy of the prefix plus the seconds and fraction (NumberFormat::formatFixed()).
+ *       Only a new minute runs the calendar conversion.
+ *
+ *       Time is seconds since the Unix epoch (UTC, no leap seconds) plus nanoseconds, as in
+ *       struct timespec.  The date is computed here (days-from-civil inverse, Howard Hinnant)
+ *       rather than by gmtime(), which not every embedded C library has, and which may lock.
+ *       Years before 0 or after 9999 are written with as many digits as needed.
+ *
+ *       Holds the cache, so one TimestampFormat per writer (or per thread); not thread safe.
+ *
+ ****************************************************************************/
+
+#ifndef TIMESTAMP_FORMAT_H
+#define TIMESTAMP_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "NumberFormat.h"
+
+class TimestampFormat
+{
+public:
+    // Longest output:  13-character year, "-MM-DDTHH:MM:SS", 9 decimals, 'Z'.
+    static const size_t MaxChars = 13 + 15 + 10 + 1;
+
+    // decimals:  digits of the fraction of a second, 0 (none, no '.') to 9.
+    explicit TimestampFormat(unsigned _decimals = 3);
+
+    // Write timestamp for seconds since the epoch + nanoseconds (< 10^9).  Returns length.
+    size_t format(char *dest, int64_t seconds, uint32_t nanoseconds);
+
+private:
+    // Longest prefix:  13-character year, "-MM-DDTHH:MM:".
+    static const size_t MaxPrefixChars = 13 + 13;
+
+    // Rebuild prefix for minute (minutes since the epoch).
+    void setMinute(int64_t minute);
+
+    // Digits of the fraction
+    unsigned    decimals;
+    // Minute the prefix was built for
+    int64_t     cachedMinute;
+    // "YYYY-MM-DDTHH:MM:" of cachedMinute
+    char        prefix[MaxPrefixChars];
+    size_t      prefixLength;
+};
+
+
+inline TimestampFormat::TimestampFormat(unsigned _decimals) :
+        decimals((_decimals > 9) ? 9 : _decimals),
+        cachedMinute(INT64_MIN),
+        prefixLength(0)
+{
+}
+
+inline size_t TimestampFormat::format(char *dest, int64_t seconds, uint32_t nanoseconds)
+{
+    // Floor division, so times before the epoch land in the right minute.
+    int64_t minute = seconds / 60;
+    int64_t second = seconds % 60;
+    if (second < 0) {
+        second += 60;
+        --minute;
+    }
+    if (minute != cachedMinute) {
+        setMinute(minute);
+    }
+    memcpy(dest, prefix, prefixLength);
+    size_t nChars = prefixLength;
+    if (second < 10) {
+        dest[nChars++] = '0';
+    }
+    uint64_t fraction = (nanoseconds % 1000000000u) / NumberFormat::powerOf10(9 - decimals);
+    nChars += NumberFormat::formatFixed(dest + nChars,
+            (int64_t)((uint64_t)second * NumberFormat::powerOf10(decimals) + fraction), decimals);
+    dest[nChars++] = 'Z';
+    return nChars;
+}
+
+inline void TimestampFormat::setMinute(int64_t minute)
+{
+    int64_t days = minute / 1440;
+    int64_t minuteOfDay = minute % 1440;
+    if (minuteOfDay < 0) {
+        minuteOfDay += 1440;
+        --days;
+    }
+
+    // Civil date from days since 1970-01-01, in 400-year eras starting on March 1.
+    days += 719468;
+    int64_t era = ((days >= 0) ? days : days - 146096) / 146097;
+    int64_t dayOfEra = days - era * 146097;
+    int64_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int64_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int64_t monthIndex = (5 * dayOfYear + 2) / 153;     // 0 = March
+    int day = (int)(dayOfYear - (153 * monthIndex + 2) / 5 + 1);
+    int month = (int)((monthIndex < 10) ? monthIndex + 3 : monthIndex - 9);
+    int64_t year = yearOfEra + era * 400 + ((month <= 2) ? 1 : 0);
+
+    size_t nChars = 0;
+    if ((year >= 0) && (year <= 9999)) {
+        char *first = NumberFormat::writeDecBackward(prefix + 4, (uint64_t)year);
+        while (first > prefix) {
+            *--first = '0';
+        }
+        nChars = 4;
+    } else {
+        nChars = NumberFormat::formatDec(prefix, year);
+    }
+    const int fields[4] = { month, day, (int)(minuteOfDay / 60), (int)(minuteOfDay % 60) };
+    const char separators[4] = { '-', '-', 'T', ':' };
+    for (size_t i = 0; i < 4; ++i) {
+        prefix[nChars++] = separators[i];
+        prefix[nChars++] = (char)('0' + fields[i] / 10);
+        prefix[nChars++] = (char)('0' + fields[i] % 10);
+    }
+    prefix[nChars++] = ':';
+    prefixLength = nChars;
+    cachedMinute = minute;
+}
+
+#endif //ndef TIMESTAMP_FORMAT_H
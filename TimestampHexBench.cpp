@@ -0,0 +1,209 @@
+/****************************************************************************
+ *   FILENAME: TimestampHexBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  time appendTimestamp() (per line) and appendHexDump() (per KiB)
+ *            against formatting the same text with gmtime_r() / printf().
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  TimestampHexBench [<lines> [<KiB>]]
+ *       Defaults:  2000000 timestamps, 65536 KiB of hex dump.
+ *
+ *       Before (character by character, as the writers' callers did it):
+ *           timestamp:  gmtime_r(), then vprintf("%04d-%02d-%02dT%02d:%02d:%02d.%03uZ")
+ *           hex dump:   each line assembled by snprintf() ("%08llx  ", "%02x " per byte,
+ *                       the ASCII column a character at a time), then write()
+ *       After:  appendTimestamp() (cached date prefix) and appendHexDump() (SSE2 where the
+ *       compiler targets it; build with -U__SSE2__ to time the scalar path).
+ *       Timestamps advance 13579 us per line, so a new minute comes every few thousand lines.
+ *       Each writer is a BasicBufferedFileWriter<65536> on NullFileBackend.  Before the timing,
+ *       both paths write the same input to memory and must match (exit code 1 if not).
+ *
+ *       Builds for the host only (gmtime_r(), <chrono>); not part of the target image.
+ *       Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "MemoryFileBackend.h"
+#include "NumberFormat.h"
+#include "TimestampFormat.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int64_t StartSeconds = 1593525909;     // 2020-06-30T14:05:09Z
+static const uint64_t StepNanoseconds = 13579000;
+static const size_t CheckBytes = 65536;
+
+// The same output, once through memory (checked) and once through NullFileBackend (timed).
+static BasicBufferedFileWriter<65536, 2048, MemoryFileBackend> checkWriter;
+static BasicBufferedFileWriter<65536, 2048, NullFileBackend> writer;
+
+template <class Out>
+static int outPrintf(Out &out, const char *fmt, ...)
+{
+    va_list arglist;
+    va_start(arglist, fmt);
+    int retval = out.vprintf(fmt, arglist);
+    va_end(arglist);
+    return retval;
+}
+
+template <class Out>
+static void printTimestamp(Out &out, int64_t seconds, uint32_t nanoseconds)
+{
+    time_t time = (time_t)seconds;
+    struct tm fields;
+    gmtime_r(&time, &fields);
+    outPrintf(out, "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ", fields.tm_year + 1900, fields.tm_mon + 1,
+            fields.tm_mday, fields.tm_hour, fields.tm_min, fields.tm_sec, nanoseconds / 1000000u);
+}
+
+// Lines timestamps starting at StartSeconds, one per line.
+template <class Out>
+static void writeTimestamps(Out &out, size_t lines, bool cached)
+{
+    TimestampFormat timestamp;
+    uint64_t nanoseconds = 0;
+    for (size_t i = 0; i < lines; ++i) {
+        int64_t seconds = StartSeconds + (int64_t)(nanoseconds / 1000000000u);
+        uint32_t fraction = (uint32_t)(nanoseconds % 1000000000u);
+        if (cached) {
+            out.appendTimestamp(timestamp, seconds, fraction);
+        } else {
+            printTimestamp(out, seconds, fraction);
+        }
+        out.write("\n", 1);
+        nanoseconds += StepNanoseconds;
+    }
+}
+
+template <class Out>
+static void printHexDump(Out &out, const uint8_t *data, size_t nBytes, uint64_t offset)
+{
+    char line[128];
+    for (size_t start = 0; start < nBytes; start += NumberFormat::HexDumpLineBytes) {
+        size_t lineBytes = (nBytes - start < NumberFormat::HexDumpLineBytes) ? (nBytes - start) : NumberFormat::HexDumpLineBytes;
+        size_t pos = (size_t)snprintf(line, sizeof(line), "%08llx  ", (unsigned long long)(offset + start));
+        for (size_t i = 0; i < NumberFormat::HexDumpLineBytes; ++i) {
+            if (i < lineBytes) {
+                pos += (size_t)snprintf(line + pos, sizeof(line) - pos, "%02x ", data[start + i]);
+            } else {
+                pos += (size_t)snprintf(line + pos, sizeof(line) - pos, "   ");
+            }
+            if (7 == i) {
+                line[pos++] = ' ';
+            }
+        }
+        line[pos++] = ' ';
+        line[pos++] = '|';
+        for (size_t i = 0; i < lineBytes; ++i) {
+            uint8_t byte = data[start + i];
+            line[pos++] = ((byte >= 0x20) && (byte < 0x7f)) ? (char)byte : '.';
+        }
+        line[pos++] = '|';
+        line[pos++] = '\n';
+        out.write(line, pos);
+    }
+}
+
+// Dump total bytes from data (dataSize bytes, repeated), KiB per call.
+template <class Out>
+static void writeHexDump(Out &out, const uint8_t *data, size_t dataSize, size_t total, bool kernel)
+{
+    for (size_t offset = 0; offset < total; offset += 1024) {
+        const uint8_t *block = data + offset % dataSize;
+        if (kernel) {
+            out.appendHexDump(block, 1024, offset);
+        } else {
+            printHexDump(out, block, 1024, offset);
+        }
+    }
+}
+
+// Run write into the memory writer for both paths; true if the output is the same.
+template <class Write>
+static bool sameOutput(char *before, char *after, size_t capacity, Write write)
+{
+    MemorySink beforeSink = { before, capacity, 0 };
+    MemorySink afterSink = { after, capacity, 0 };
+    checkWriter.setFile(&beforeSink);
+    write(false);
+    checkWriter.flush();
+    checkWriter.setFile(&afterSink);
+    write(true);
+    checkWriter.flush();
+    checkWriter.setFile(NULL);
+    return (beforeSink.size == afterSink.size) && (beforeSink.size < capacity)
+            && (0 == memcmp(before, after, beforeSink.size));
+}
+
+template <class Write>
+static double seconds(Write write)
+{
+    NullSink sink = { 0, 0 };
+    writer.setFile(&sink);
+    Clock::time_point start = Clock::now();
+    write();
+    writer.flush();
+    double retval = std::chrono::duration<double>(Clock::now() - start).count();
+    writer.setFile(NULL);
+    return retval;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t lines = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000000;
+    size_t kibibytes = (argc > 2) ? strtoul(argv[2], NULL, 0) : 65536;
+    if ((0 == lines) || (0 == kibibytes) || (argc > 3)) {
+        fprintf(stderr, "usage: %s [<lines> [<KiB>]]\n", argv[0]);
+        return 2;
+    }
+    uint8_t *data = (uint8_t *)malloc(CheckBytes + 1024);
+    size_t capacity = CheckBytes * 16;
+    char *before = (char *)malloc(capacity);
+    char *after = (char *)malloc(capacity);
+    if ((NULL == data) || (NULL == before) || (NULL == after)) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    uint32_t random = 2463534242u;
+    for (size_t i = 0; i < CheckBytes + 1024; ++i) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        data[i] = (uint8_t)random;
+    }
+
+    int retval = 0;
+    if (!sameOutput(before, after, capacity, [](bool cached) { writeTimestamps(checkWriter, 20000, cached); })
+            || !sameOutput(before, after, capacity, [data](bool kernel) { writeHexDump(checkWriter, data, CheckBytes, CheckBytes, kernel); })) {
+        printf("OUTPUT MISMATCH\n");
+        retval = 1;
+    }
+
+    double printfTime = seconds([lines] { writeTimestamps(writer, lines, false); });
+    double cachedTime = seconds([lines] { writeTimestamps(writer, lines, true); });
+    printf("timestamp:  gmtime_r + vprintf %7.1f ns/line, appendTimestamp %7.1f ns/line (%.1fx)\n",
+            printfTime * 1e9 / lines, cachedTime * 1e9 / lines, printfTime / cachedTime);
+    size_t total = kibibytes * 1024;
+    printfTime = seconds([data, total] { writeHexDump(writer, data, CheckBytes, total, false); });
+    double kernelTime = seconds([data, total] { writeHexDump(writer, data, CheckBytes, total, true); });
+    printf("hex dump:   snprintf         %7.2f us/KiB,  appendHexDump   %7.2f us/KiB  (%.1fx, %s)\n",
+            printfTime * 1e6 / kibibytes, kernelTime * 1e6 / kibibytes, printfTime / kernelTime,
+#if defined(__SSE2__)
+            "SSE2"
+#else
+            "scalar"
+#endif
+            );
+    free(after);
+    free(before);
+    free(data);
+    return retval;
+}
@@ -0,0 +1,564 @@
+/****************************************************************************
+ *   FILENAME: TypedFormat.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Type-safe printf-style formatting without varargs, checked at compile time.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       vsnprintf() is general:  it fetches every argument through va_arg, consults the
+ *       locale and handles every specifier and length modifier, on every call.  A logging
+ *       hot path calls it millions of times with the same handful of format strings.
+ *
+ *       TypedFormat::format() takes the arguments as a variadic template instead.  Each
+ *       argument's C++ type selects its converter at compile time (integers, strings and
+ *       pointers are converted here, decimal digits by NumberFormat; floating point is passed
+ *       to snprintf() one value at a time).  The format string only supplies literal text,
+ *       flags, width, precision and base / case, so a mismatched argument can never be misread.
+ *
+ *       TYPED_PRINTF(writer, "literal format", args...) additionally checks at compile time
+ *       (constexpr, C++11) that every conversion matches its argument and that the argument
+ *       count is right, then calls writer.format().  The format must be a string literal.
+ *       The check recurses once per format character, so very long formats may need a larger
+ *       -fconstexpr-depth (default 512).
+ *
+ *       Output is printf-compatible for:
+ *           %d %i %u %o %x %X %c %s %p %f %F %e %E %g %G %a %A %%
+ *       with flags '-', '+', ' ', '#', '0', a decimal width and a precision.  Length modifiers
+ *       (h, hh, l, ll, j, z, t, L) are accepted and ignored:  the argument's own type sets the
+ *       width, which is what a correct modifier would have said.  '*' width / precision and
+ *       %n are not supported (rejected by TYPED_PRINTF).
+ *
+ *       Unchecked calls to format() never misread an argument:  a conversion without an
+ *       argument is copied to the output as text, and an argument whose type does not match
+ *       its conversion is printed by its type (e.g. an integer given for %s prints in decimal).
+ *
+ ****************************************************************************/
+
+#ifndef TYPED_FORMAT_H
+#define TYPED_FORMAT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <cstddef>
+#include <type_traits>
+#include "NumberFormat.h"
+
+#ifndef _ATTRIBUTE
+#define _ATTRIBUTE(attrs) __attribute__ (attrs)
+#endif
+
+template <class... Args>
+struct TypedFormatCheck;
+
+class TypedFormat
+{
+public:
+    // Format args into dest per fmt, with snprintf() semantics:  writes at most space - 1
+    // characters and a terminating NUL (nothing if space is 0).
+    // Returns the length of the complete output, which may exceed space - 1.
+    template <class... Args>
+    static int format(char *dest, size_t space, const char *fmt, const Args&... args);
+
+    // Compile-time checks used by TypedFormatCheck.
+
+    // True if c is one of the characters of set.
+    static constexpr bool isOneOf(char c, const char *set)
+    {
+        return ('\0' != *set) && ((c == *set) || isOneOf(c, set + 1));
+    }
+
+    // Skip a conversion specification's flags, width, precision and length modifiers;
+    // fmt points just after the '%'.  Returns pointer to the conversion character.
+    static constexpr const char *skipSpec(const char *fmt)
+    {
+        return skipWhile(skipPrecision(skipWhile(skipWhile(fmt, "-+ #0"), "0123456789")), "hlLqjzt");
+    }
+
+    // True if an argument of (decayed) type T may be given for conversion character conv.
+    template <class T>
+    static constexpr bool accepts(char conv)
+    {
+        return isOneOf(conv, "diuoxXc") ? std::is_integral<T>::value
+             : isOneOf(conv, "fFeEgGaA") ? std::is_floating_point<T>::value
+             : ('s' == conv) ? (std::is_same<T, const char *>::value || std::is_same<T, char *>::value)
+             : ('p' == conv) ? (std::is_pointer<T>::value || std::is_same<T, std::nullptr_t>::value)
+             : false;
+    }
+
+private:
+    static constexpr const char *skipWhile(const char *fmt, const char *set)
+    {
+        return isOneOf(*fmt, set) ? skipWhile(fmt + 1, set) : fmt;
+    }
+
+    static constexpr const char *skipPrecision(const char *fmt)
+    {
+        return ('.' == *fmt) ? skipWhile(fmt + 1, "0123456789") : fmt;
+    }
+
+    enum SpecFlags {
+        FlagMinus = 1,      // '-':  left-justify
+        FlagPlus = 2,       // '+':  sign always
+        FlagSpace = 4,      // ' ':  space for positive sign
+        FlagAlt = 8,        // '#':  0x / leading 0
+        FlagZero = 16       // '0':  pad with zeros
+    };
+
+    // One parsed conversion specification.
+    struct Spec {
+        unsigned    flags;
+        int         width;
+        int         precision;      // -1 if none
+        char        conv;           // Conversion character, '\0' if fmt ended after the '%'
+    };
+
+    // Output cursor; counts every character, stores only those that fit.
+    struct Output {
+        char *      ptr;
+        char *      end;            // Last storable position, kept for the terminating NUL
+        size_t      count;
+        bool        terminated;     // Room for the NUL at end (false if space is 0:  store nothing)
+
+        void put(char c)
+        {
+            if (ptr < end) {
+                *ptr++ = c;
+            }
+            ++count;
+        }
+
+        // Short runs (most fields) are copied inline rather than through memcpy() / memset().
+        void put(const char *source, size_t nChars)
+        {
+            size_t room = (size_t)(end - ptr);
+            size_t stored = (nChars < room) ? nChars : room;
+            if (stored > 16) {
+                copyLong(source, stored);
+            } else {
+                for (size_t i = 0; i < stored; ++i) {
+                    *ptr++ = source[i];
+                }
+            }
+            count += nChars;
+        }
+
+        // Out of line, so that inlining put() for a short literal does not draw a (false)
+        // -Wstringop-overread from the memcpy() it can never reach.
+        _ATTRIBUTE ((noinline)) void copyLong(const char *source, size_t nChars)
+        {
+            memcpy(ptr, source, nChars);
+            ptr += nChars;
+        }
+
+        void pad(char c, size_t nChars)
+        {
+            size_t room = (size_t)(end - ptr);
+            size_t stored = (nChars < room) ? nChars : room;
+            if (stored > 16) {
+                memset(ptr, c, stored);
+                ptr += stored;
+            } else {
+                for (size_t i = 0; i < stored; ++i) {
+                    *ptr++ = c;
+                }
+            }
+            count += nChars;
+        }
+
+        // Account for nChars produced in place at ptr (of which at most end - ptr were stored).
+        void advance(size_t nChars)
+        {
+            size_t room = (size_t)(end - ptr);
+            ptr += (nChars < room) ? nChars : room;
+            count += nChars;
+        }
+    };
+
+    // Copy literal text (and %% as '%') up to the next conversion.
+    // Returns pointer to the conversion's '%', or to the terminating NUL.
+    static const char *copyLiteral(Output &out, const char *fmt);
+
+    // Parse the specification following a '%'.  Returns pointer just past it.
+    static const char *parseSpec(const char *fmt, Spec &spec);
+
+    // No arguments left:  copy the rest of fmt, conversions included, as text.
+    static void formatArgs(Output &out, const char *fmt);
+
+    template <class Arg, class... Rest>
+    static void formatArgs(Output &out, const char *fmt, const Arg &arg, const Rest&... rest);
+
+    // Converters, selected by argument type.
+    template <class T>
+    static typename std::enable_if<std::is_integral<T>::value>::type
+    emit(Output &out, const Spec &spec, const T &value);
+
+    template <class T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type
+    emit(Output &out, const Spec &spec, const T &value);
+
+    static void emit(Output &out, const Spec &spec, const char *string);
+
+    template <class T>
+    static void emit(Output &out, const Spec &spec, const T *pointer);
+
+    static void emit(Output &out, const Spec &spec, std::nullptr_t);
+
+    // Emit an integer from its sign character ('\0' for none) and magnitude.
+    static void emitInteger(Output &out, const Spec &spec, char sign, unsigned long long magnitude);
+
+    // Emit nChars characters, padded to the width.
+    static void emitPadded(Output &out, const Spec &spec, const char *source, size_t nChars);
+
+    // Emit a floating point value through snprintf(), rebuilding the specification.
+    static void emitFloat(Output &out, const Spec &spec, double value);
+    static void emitFloat(Output &out, const Spec &spec, long double value);
+
+    // Build a "%<flags>*.*<conv>" snprintf() format for spec.  Returns true if it has a precision.
+    static bool floatFormat(const Spec &spec, bool isLong, char *fmt);
+};
+
+// Compile-time check that a format string's conversions match the (decayed) argument types
+// Args, in order and in number.  check() is constexpr; TYPED_PRINTF static_asserts it.
+template <>
+struct TypedFormatCheck<>
+{
+    // True if fmt has no conversions left.
+    static constexpr bool check(const char *fmt)
+    {
+        return ('\0' == *fmt) ? true
+             : ('%' != *fmt) ? check(fmt + 1)
+             : ('%' == fmt[1]) ? check(fmt + 2)
+             : false;
+    }
+};
+
+template <class Arg, class... Rest>
+struct TypedFormatCheck<Arg, Rest...>
+{
+    // True if the next conversion in fmt accepts Arg and the rest of fmt matches Rest.
+    static constexpr bool check(const char *fmt)
+    {
+        return ('\0' == *fmt) ? false
+             : ('%' != *fmt) ? check(fmt + 1)
+             : ('%' == fmt[1]) ? check(fmt + 2)
+             : checkConversion(TypedFormat::skipSpec(fmt + 1));
+    }
+
+    static constexpr bool checkConversion(const char *conv)
+    {
+        return TypedFormat::accepts<Arg>(*conv) && TypedFormatCheck<Rest...>::check(conv + 1);
+    }
+};
+
+// Declared only, for decltype() in TYPED_PRINTF:  the checker for the given arguments.
+template <class... Args>
+TypedFormatCheck<typename std::decay<Args>::type...> typedFormatCheckFor(const Args&... args);
+
+// Format into writer (any class with a format() member, e.g. BasicBufferedFileWriter) after
+// checking at compile time that the literal fmt matches the arguments.
+// Returns writer.format() return code.
+#define TYPED_PRINTF(writer, fmt, ...) \
+    ([&]() -> int { \
+        static_assert(decltype(typedFormatCheckFor(__VA_ARGS__))::check(fmt), \
+                "TYPED_PRINTF format does not match its arguments"); \
+        return (writer).format(fmt, ##__VA_ARGS__); \
+    }())
+
+
+template <class... Args>
+int TypedFormat::format(char *dest, size_t space, const char *fmt, const Args&... args)
+{
+    Output out;
+    out.ptr = dest;
+    out.end = (space > 0) ? (dest + space - 1) : dest;
+    out.count = 0;
+    out.terminated = (space > 0);
+    if (NULL != fmt) {
+        formatArgs(out, fmt, args...);
+    }
+    if (space > 0) {
+        *out.ptr = '\0';
+    }
+    return (int)out.count;
+}
+
+inline const char *TypedFormat::copyLiteral(Output &out, const char *fmt)
+{
+    for (;;) {
+        const char *scan = fmt;
+        while (('\0' != *scan) && ('%' != *scan)) {
+            ++scan;
+        }
+        out.put(fmt, (size_t)(scan - fmt));
+        if (('%' != *scan) || ('%' != scan[1])) {
+            return scan;
+        }
+        out.put('%');
+        fmt = scan + 2;
+    }
+}
+
+inline const char *TypedFormat::parseSpec(const char *fmt, Spec &spec)
+{
+    spec.flags = 0;
+    spec.width = 0;
+    spec.precision = -1;
+    for (;; ++fmt) {
+        if ('-' == *fmt) {
+            spec.flags |= FlagMinus;
+        } else if ('+' == *fmt) {
+            spec.flags |= FlagPlus;
+        } else if (' ' == *fmt) {
+            spec.flags |= FlagSpace;
+        } else if ('#' == *fmt) {
+            spec.flags |= FlagAlt;
+        } else if ('0' == *fmt) {
+            spec.flags |= FlagZero;
+        } else {
+            break;
+        }
+    }
+    while ((*fmt >= '0') && (*fmt <= '9')) {
+        spec.width = spec.width * 10 + (*fmt++ - '0');
+    }
+    if ('.' == *fmt) {
+        spec.precision = 0;
+        ++fmt;
+        while ((*fmt >= '0') && (*fmt <= '9')) {
+            spec.precision = spec.precision * 10 + (*fmt++ - '0');
+        }
+    }
+    while (('h' == *fmt) || ('l' == *fmt) || ('L' == *fmt) || ('q' == *fmt) || ('j' == *fmt)
+            || ('z' == *fmt) || ('t' == *fmt)) {
+        ++fmt;
+    }
+    spec.conv = *fmt;
+    if ('\0' != *fmt) {
+        ++fmt;
+    }
+    return fmt;
+}
+
+inline void TypedFormat::formatArgs(Output &out, const char *fmt)
+{
+    for (;;) {
+        fmt = copyLiteral(out, fmt);
+        if ('\0' == *fmt) {
+            break;
+        }
+        out.put(*fmt++);
+    }
+}
+
+template <class Arg, class... Rest>
+void TypedFormat::formatArgs(Output &out, const char *fmt, const Arg &arg, const Rest&... rest)
+{
+    fmt = copyLiteral(out, fmt);
+    if ('\0' != *fmt) {
+        Spec spec;
+        fmt = parseSpec(fmt + 1, spec);
+        emit(out, spec, arg);
+        formatArgs(out, fmt, rest...);
+    }
+}
+
+// Integers are promoted as by varargs, then read as signed for %d / %i (and conversions that
+// do not name an integer) or as unsigned for %u, %o, %x, %X, exactly as printf() reads them.
+template <class T>
+typename std::enable_if<std::is_integral<T>::value>::type
+TypedFormat::emit(Output &out, const Spec &spec, const T &value)
+{
+    typedef decltype(+value) Promoted;
+    if ('c' == spec.conv) {
+        char c = (char)value;
+        emitPadded(out, spec, &c, 1);
+    } else if (('u' == spec.conv) || ('o' == spec.conv) || ('x' == spec.conv) || ('X' == spec.conv)) {
+        emitInteger(out, spec, '\0', (typename std::make_unsigned<Promoted>::type)value);
+    } else {
+        typename std::make_signed<Promoted>::type signedValue = value;
+        unsigned long long magnitude = (unsigned long long)signedValue;
+        char sign = '\0';
+        if (signedValue < 0) {
+            sign = '-';
+            magnitude = 0 - magnitude;
+        } else if (0 != (spec.flags & FlagPlus)) {
+            sign = '+';
+        } else if (0 != (spec.flags & FlagSpace)) {
+            sign = ' ';
+        }
+        Spec decimal = spec;
+        decimal.conv = 'd';
+        emitInteger(out, decimal, sign, magnitude);
+    }
+}
+
+template <class T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+TypedFormat::emit(Output &out, const Spec &spec, const T &value)
+{
+    emitFloat(out, spec, value);
+}
+
+inline void TypedFormat::emit(Output &out, const Spec &spec, const char *string)
+{
+    if ('p' == spec.conv) {
+        emit(out, spec, static_cast<const void *>(string));
+    } else if (NULL == string) {
+        emitPadded(out, spec, "(null)", 6);
+    } else {
+        size_t nChars;
+        if (spec.precision < 0) {
+            nChars = strlen(string);
+        } else {
+            const char *nul = static_cast<const char *>(memchr(string, '\0', (size_t)spec.precision));
+            nChars = (NULL != nul) ? (size_t)(nul - string) : (size_t)spec.precision;
+        }
+        emitPadded(out, spec, string, nChars);
+    }
+}
+
+// As glibc:  "(nil)" for NULL, otherwise %#x of the address.
+template <class T>
+void TypedFormat::emit(Output &out, const Spec &spec, const T *pointer)
+{
+    if (NULL == pointer) {
+        emit(out, spec, nullptr);
+    } else {
+        Spec hex = spec;
+        hex.flags |= FlagAlt;
+        hex.conv = 'x';
+        emitInteger(out, hex, '\0', (uintptr_t)pointer);
+    }
+}
+
+inline void TypedFormat::emit(Output &out, const Spec &spec, std::nullptr_t)
+{
+    Spec text = spec;
+    text.precision = -1;
+    emitPadded(out, text, "(nil)", 5);
+}
+
+// Digits are produced backwards into a local buffer; base and case come from spec.conv.
+// Precision is the minimum digit count (0 with value 0 gives no digits); '0' pads to the
+// width only without precision or '-'.
+inline void TypedFormat::emitInteger(Output &out, const Spec &spec, char sign, unsigned long long magnitude)
+{
+    static const char lowerDigits[] = "0123456789abcdef";
+    static const char upperDigits[] = "0123456789ABCDEF";
+    char digits[24];
+    char *digitPtr = digits + sizeof(digits);
+    if ((0 != magnitude) || (0 != spec.precision)) {
+        if (('x' == spec.conv) || ('X' == spec.conv)) {
+            const char *table = ('X' == spec.conv) ? upperDigits : lowerDigits;
+            do {
+                *--digitPtr = table[magnitude & 0xf];
+                magnitude >>= 4;
+            } while (0 != magnitude);
+        } else if ('o' == spec.conv) {
+            do {
+                *--digitPtr = (char)('0' + (magnitude & 7));
+                magnitude >>= 3;
+            } while (0 != magnitude);
+        } else {
+            digitPtr = NumberFormat::writeDecBackward(digitPtr, magnitude);
+        }
+    }
+    size_t nDigits = (size_t)(digits + sizeof(digits) - digitPtr);
+
+    const char *prefix = "";
+    size_t prefixLength = 0;
+    if (0 != (spec.flags & FlagAlt)) {
+        if ((('x' == spec.conv) || ('X' == spec.conv)) && (nDigits > 0) && ('0' != *digitPtr)) {
+            prefix = ('X' == spec.conv) ? "0X" : "0x";
+            prefixLength = 2;
+        } else if (('o' == spec.conv) && ((0 == nDigits) || ('0' != *digitPtr))) {
+            prefix = "0";
+            prefixLength = 1;
+        }
+    }
+    size_t zeros = ((spec.precision > 0) && ((size_t)spec.precision > nDigits)) ? (size_t)spec.precision - nDigits : 0;
+    size_t total = prefixLength + (('\0' != sign) ? 1 : 0) + zeros + nDigits;
+    size_t padding = ((size_t)spec.width > total) ? (size_t)spec.width - total : 0;
+
+    if ((0 != (spec.flags & FlagZero)) && (0 == (spec.flags & FlagMinus)) && (spec.precision < 0)) {
+        zeros += padding;
+        padding = 0;
+    }
+    if (0 == (spec.flags & FlagMinus)) {
+        out.pad(' ', padding);
+    }
+    if ('\0' != sign) {
+        out.put(sign);
+    }
+    out.put(prefix, prefixLength);
+    out.pad('0', zeros);
+    out.put(digitPtr, nDigits);
+    if (0 != (spec.flags & FlagMinus)) {
+        out.pad(' ', padding);
+    }
+}
+
+inline void TypedFormat::emitPadded(Output &out, const Spec &spec, const char *source, size_t nChars)
+{
+    size_t padding = ((size_t)spec.width > nChars) ? (size_t)spec.width - nChars : 0;
+    if (0 == (spec.flags & FlagMinus)) {
+        out.pad(' ', padding);
+    }
+    out.put(source, nChars);
+    if (0 != (spec.flags & FlagMinus)) {
+        out.pad(' ', padding);
+    }
+}
+
+inline void TypedFormat::emitFloat(Output &out, const Spec &spec, double value)
+{
+    char fmt[16];
+    size_t room = out.terminated ? ((size_t)(out.end - out.ptr) + 1) : 0;
+    int nChars;
+    if (floatFormat(spec, false, fmt)) {
+        nChars = snprintf(out.ptr, room, fmt, spec.width, spec.precision, value);
+    } else {
+        nChars = snprintf(out.ptr, room, fmt, spec.width, value);
+    }
+    if (nChars > 0) {
+        out.advance((size_t)nChars);
+    }
+}
+
+inline void TypedFormat::emitFloat(Output &out, const Spec &spec, long double value)
+{
+    char fmt[16];
+    size_t room = out.terminated ? ((size_t)(out.end - out.ptr) + 1) : 0;
+    int nChars;
+    if (floatFormat(spec, true, fmt)) {
+        nChars = snprintf(out.ptr, room, fmt, spec.width, spec.precision, value);
+    } else {
+        nChars = snprintf(out.ptr, room, fmt, spec.width, value);
+    }
+    if (nChars > 0) {
+        out.advance((size_t)nChars);
+    }
+}
+
+inline bool TypedFormat::floatFormat(const Spec &spec, bool isLong, char *fmt)
+{
+    static const char flagChars[] = "-+ #0";
+    *fmt++ = '%';
+    for (unsigned i = 0; i < 5; ++i) {
+        if (0 != (spec.flags & (1u << i))) {
+            *fmt++ = flagChars[i];
+        }
+    }
+    *fmt++ = '*';
+    if (spec.precision >= 0) {
+        *fmt++ = '.';
+        *fmt++ = '*';
+    }
+    if (isLong) {
+        *fmt++ = 'L';
+    }
+    *fmt++ = isOneOf(spec.conv, "fFeEgGaA") ? spec.conv : 'f';
+    *fmt = '\0';
+    return (spec.precision >= 0);
+}
+
+#endif //ndef TYPED_FORMAT_H
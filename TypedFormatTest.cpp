@@ -0,0 +1,126 @@
+/****************************************************************************
+ *   FILENAME: TypedFormatTest.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  check TypedFormat against snprintf(), and time it against the
+ *            writers' vprintf() path.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  TypedFormatTest [<iterations>]
+ *       Every case is formatted by TypedFormat::format() and by snprintf() into every buffer
+ *       size from 0 (dest NULL, the length query) to the full length plus one; the returned
+ *       length and the stored text must match.  Failures are printed; exit code 1 if any.
+ *       Then each benchmark line is written iterations times (default 2000000) through a
+ *       BasicBufferedFileWriter on NullFileBackend, by vprintf() and by format().
+ *
+ *       Builds for the host only (uses stdio, <chrono>); not part of the target image.
+ *       Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "MemoryFileBackend.h"
+#include "TypedFormat.h"
+
+static unsigned failures = 0;
+
+// Compare TypedFormat::format() with snprintf() for every buffer size.
+template <class... Args>
+static void check(const char *fmt, const Args&... args)
+{
+    char expected[512];
+    char actual[512];
+    int length = snprintf(expected, sizeof(expected), fmt, args...);
+    for (size_t space = 0; space <= (size_t)length + 1; ++space) {
+        memset(actual, '#', sizeof(actual));
+        int result = TypedFormat::format((0 == space) ? NULL : actual, space, fmt, args...);
+        bool ok = (result == length);
+        if (ok && (space > 0)) {
+            size_t stored = (space - 1 < (size_t)length) ? (space - 1) : (size_t)length;
+            ok = (0 == memcmp(actual, expected, stored)) && ('\0' == actual[stored]) && ('#' == actual[stored + 1]);
+        }
+        if (!ok) {
+            ++failures;
+            fprintf(stderr, "FAIL \"%s\" space %lu:  returned %d, expected %d \"%s\"\n", fmt, (unsigned long)space,
+                    result, length, expected);
+            break;
+        }
+    }
+}
+
+static void checkAll(void)
+{
+    check("plain text");
+    check("100%%");
+    check("v=%d", 0);
+    check("v=%d %d %d", INT32_MIN, INT32_MAX, -1);
+    check("%lld %llu", (long long)INT64_MIN, (unsigned long long)UINT64_MAX);
+    check("[%5d|%-5d|%05d|%+d|% d]", 42, 42, 42, 42, 42);
+    check("[%.3d|%8.3d|%-8.3d|%.0d]", 7, -7, 7, 0);
+    check("%u %o %x %X %#o %#x %#X", 3000000000u, 511u, 48879u, 48879u, 8u, 255u, 255u);
+    check("%08x %-8x| %#010x", 0xbeefu, 0xbeefu, 0xbeefu);
+    check("%c%c%c", 'a', 'b', 'c');
+    check("[%s|%10s|%-10s|%.2s]", "abc", "abc", "abc", "abc");
+    check("%p", (const void *)&failures);
+    check("v=%.3f", 1.5);
+    check("v=%f %e %g %a", 3.14159, 31415.9, 0.0001, 1.0);
+    check("[%10.2f|%-10.2f|%+.1e|%010.3f]", -2.5, 2.5, 12345.678, 3.25);
+    check("%G %E %F", 1e-10, 6.02e23, 1e300);
+    check("%Lf", (long double)1.25);
+    check("%s=%d (%.2f%%) at %x", "load", 97, 97.5, 0x1000u);
+}
+
+// Benchmark pair:  the same line through vprintf() and format().
+static BasicBufferedFileWriter<4096, 2048, NullFileBackend> writer;
+
+static int viaVprintf(const char *fmt, ...)
+{
+    va_list arglist;
+    va_start(arglist, fmt);
+    int retval = writer.vprintf(fmt, arglist);
+    va_end(arglist);
+    return retval;
+}
+
+template <class Function>
+static double nanosecondsPerLine(unsigned long iterations, Function function)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < iterations; ++i) {
+        function(i);
+    }
+    writer.flush();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000000;
+    checkAll();
+    printf("%u check failures\n", failures);
+
+    NullSink sink = { 0, 0 };
+    writer.setFile(&sink);
+    double vprintfTime = nanosecondsPerLine(iterations, [](unsigned long i) {
+        viaVprintf("%s %5u id=%08x val=%d of %d [%s]\n", "sensor", (unsigned)i, (unsigned)(i * 2654435761u),
+                (int)i - 1000, 100000, "OK");
+    });
+    double typedTime = nanosecondsPerLine(iterations, [](unsigned long i) {
+        TYPED_PRINTF(writer, "%s %5u id=%08x val=%d of %d [%s]\n", "sensor", (unsigned)i,
+                (unsigned)(i * 2654435761u), (int)i - 1000, 100000, "OK");
+    });
+    printf("integers / strings:  vprintf %.1f ns/line, format %.1f ns/line\n", vprintfTime, typedTime);
+    vprintfTime = nanosecondsPerLine(iterations, [](unsigned long i) {
+        viaVprintf("t=%lu v=%.3f\n", i, i * 0.001);
+    });
+    typedTime = nanosecondsPerLine(iterations, [](unsigned long i) {
+        TYPED_PRINTF(writer, "t=%lu v=%.3f\n", i, i * 0.001);
+    });
+    printf("one double:  vprintf %.1f ns/line, format %.1f ns/line\n", vprintfTime, typedTime);
+    writer.setFile(NULL);
+    return (0 == failures) ? 0 : 1;
+}
@@ -0,0 +1,553 @@
+/****************************************************************************
+ *   FILENAME: UringFileBackend.h
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: BasicBufferedFileWriter backend with asynchronous writes through Linux io_uring.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       With PosixFileBackend every flush blocks the writing thread in write(2) until the
+ *       kernel has taken the data.  The handle of this backend is a UringFile, whose write()
+ *       copies the flushed bytes into a free slot of a fixed buffer pool (SlotCount buffers of
+ *       SlotSize bytes, registered with the ring) and submits them as an asynchronous
+ *       IORING_OP_WRITE_FIXED; it returns as soon as the write is queued.  A slot is recycled
+ *       when its write completes.  The writer's own buffer is free again on return, so the
+ *       writers need no change.  The copy is the price of that:  a memcpy of one buffer per
+ *       flush instead of a system call that waits for the page cache (or the device).
+ *
+ *       write() only waits when all SlotCount slots are in flight (backpressure; counted in
+ *       Stats::waits).  Choose SlotSize >= the writer's BufferSize, so one flush is one write.
+ *
+ *       Completions (file offset, length, bytes written or -errno) are reaped without a
+ *       system call by write(), poll() and drain(), and passed to the CompletionFunction if
+ *       one is set.  drain() waits for every write in flight; sync() is drain() and
+ *       fdatasync(2) (SupportsSync, so FileCheckpointer works as with PosixFileBackend).
+ *       Short writes are resubmitted for the rest.  A write only counts as in flight once the
+ *       kernel has taken it from the submission queue; if io_uring_enter(2) does not take it
+ *       (EAGAIN / EBUSY are retried SubmitAttempts times, other errors not at all), the entry
+ *       is taken back out and the write completes at once with the -errno, like a failed one.
+ *
+ *       Fallbacks, decided in attach():  if the ring cannot be set up (kernel without
+ *       io_uring, or io_uring_disabled), writes are synchronous pwrite(2) from the caller's
+ *       data and completions are reported at once, through the same callback.  If the pool
+ *       cannot be registered (RLIMIT_MEMLOCK), writes are asynchronous IORING_OP_WRITE from
+ *       the same slots.
+ *
+ *       Talks to the kernel directly (io_uring_setup / io_uring_enter / io_uring_register)
+ *       rather than through liburing, which our server build does not ship.
+ *
+ *       Writes go to explicit offsets, starting at the file position at attach(), so the fd
+ *       must be a regular file (or block device).  Not for an O_DIRECT fd:  the slots are
+ *       page aligned, but O_DIRECT also needs every length and offset to be a block multiple,
+ *       and a writer's flush() passes whatever is buffered, so it would fail with EINVAL
+ *       (PosixDirectFileBackend pads the last block instead).  Not thread safe:  write(),
+ *       poll(), drain() and sync() must all be called by one thread (that of a
+ *       BasicBufferedFileWriter; a DoubleBufferedFileWriter adds nothing here).  The pool is
+ *       part of the object (static allocation; SlotCount * SlotSize bytes).
+ *
+ ****************************************************************************/
+
+#ifndef URING_FILE_BACKEND_H
+#define URING_FILE_BACKEND_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "FileBackend.h"
+
+template <size_t SlotSize = 65536, size_t SlotCount = 8>
+class UringFile
+{
+public:
+    static_assert((SlotSize % 4096) == 0, "SlotSize must be a multiple of 4096");
+    static_assert((SlotCount > 0) && (SlotCount <= 64), "SlotCount must be 1 to 64");
+
+    // One finished write.
+    struct Completion
+    {
+        uint64_t    offset;             // File offset of the write
+        uint32_t    length;             // Bytes submitted
+        int32_t     result;             // Bytes written, or -errno
+    };
+    // Called for each finished write, on the thread calling write(), poll(), drain() or sync().
+    typedef void (*CompletionFunction)(const Completion &completion, void *context);
+
+    // Counts since construction or the last resetStats().
+    struct Stats
+    {
+        uint64_t    writes;             // Writes completed
+        uint64_t    bytes;              // Bytes written
+        uint32_t    errors;             // Writes that failed
+        uint32_t    waits;              // write() calls that had to wait for a free slot
+        uint32_t    maxInFlight;        // Most writes in flight at once
+    };
+
+    UringFile(void);
+
+    // detach()es if attached.
+    ~UringFile(void);
+
+    // Write to fd (open for write, not closed by this class) from its current position.
+    // Sets up the ring, or the pwrite(2) fallback.  Returns false if fd is invalid.
+    bool attach(int _fd);
+
+    // Wait for all writes in flight and release the ring.
+    void detach(void);
+
+    // Writes are asynchronous (false:  pwrite(2) fallback, or not attached).
+    bool isAsync(void) { return ringFd >= 0; }
+
+    // Slots are registered with the ring (IORING_OP_WRITE_FIXED).
+    bool isRegistered(void) { return registered; }
+
+    void setCompletion(CompletionFunction _completion, void *_completionContext);
+
+    // Backend write:  queue data.  Returns nChars, 0 if not attached.
+    uint32_t write(const char *data, size_t nChars);
+
+    // Reap finished writes without waiting.  Returns the number reaped.
+    size_t poll(void);
+
+    // Wait for all writes in flight.  Returns false if any write failed since the last drain().
+    bool drain(void);
+
+    // drain() and fdatasync(2).  Returns true on success.
+    bool sync(void);
+
+    // File offset of the next write.
+    uint64_t getOffset(void) { return offset; }
+
+    Stats getStats(void) { return stats; }
+
+    void resetStats(void);
+
+private:
+    // io_uring_enter(2) calls for one submission before giving up on EAGAIN / EBUSY.
+    static const unsigned SubmitAttempts = 16;
+
+    struct Slot
+    {
+        uint64_t    offset;             // File offset of the write
+        uint32_t    length;             // Bytes in the slot
+        uint32_t    done;               // Bytes written so far (short writes)
+        bool        busy;
+    };
+
+    // Block copy-ctor, assignment operator.
+    UringFile(const UringFile &obj);
+    UringFile& operator=(const UringFile& obj);
+
+    // Create the ring and map it; register the pool.  Returns false if no ring.
+    bool setupRing(void);
+
+    void releaseRing(void);
+
+    // Queue the unwritten part of slot index.  Returns 0 once the kernel has taken it, else
+    // -errno (and the entry is no longer queued).
+    int32_t submit(size_t index);
+
+    // Reap finished writes; with wait, first wait until at least one has finished.
+    size_t reap(bool wait);
+
+    // Free slot index (not in flight) and report its write with result.
+    void finish(size_t index, int32_t result);
+
+    // Report a finished write.
+    void complete(const Completion &completion);
+
+    // Fallback:  pwrite(2) all of data at offset.  Returns bytes written or -errno.
+    int32_t writeAt(const char *data, size_t nChars, uint64_t at);
+
+    // Write buffers, registered with the ring
+    alignas(4096) char pool[SlotCount][SlotSize];
+    Slot        slots[SlotCount];
+    size_t      inFlight;
+    int         fd;
+    uint64_t    offset;
+    CompletionFunction completion;
+    void *      completionContext;
+    // A write failed since the last drain()
+    bool        failed;
+    Stats       stats;
+
+    // Ring:  ringFd < 0 when not set up
+    int         ringFd;
+    bool        registered;
+    void *      sqRing;
+    size_t      sqRingSize;
+    void *      cqRing;
+    size_t      cqRingSize;
+    struct io_uring_sqe * sqes;
+    size_t      sqesSize;
+    unsigned *  sqHead;
+    unsigned *  sqTail;
+    unsigned    sqMask;
+    unsigned *  sqArray;
+    unsigned *  cqHead;
+    unsigned *  cqTail;
+    unsigned    cqMask;
+    struct io_uring_cqe * cqes;
+};
+
+template <size_t SlotSize = 65536, size_t SlotCount = 8>
+struct UringFileBackend : public FileBackendDefaults
+{
+    typedef UringFile<SlotSize, SlotCount> * Handle;
+
+    static const bool SupportsSync = true;
+
+    static Handle noFile(void)
+    {
+        return NULL;
+    }
+
+    // Returns number of bytes queued.
+    static uint32_t write(Handle file, const char *data, size_t nChars)
+    {
+        return file->write(data, nChars);
+    }
+
+    static bool sync(Handle file)
+    {
+        return file->sync();
+    }
+};
+
+
+template <size_t SlotSize, size_t SlotCount>
+UringFile<SlotSize, SlotCount>::UringFile(void)
+    : inFlight(0), fd(-1), offset(0), completion(NULL), completionContext(NULL), failed(false),
+      ringFd(-1), registered(false), sqRing(MAP_FAILED), sqRingSize(0), cqRing(MAP_FAILED),
+      cqRingSize(0), sqes(NULL), sqesSize(0)
+{
+    for (size_t i = 0; i < SlotCount; ++i) {
+        slots[i].busy = false;
+    }
+    resetStats();
+}
+
+template <size_t SlotSize, size_t SlotCount>
+UringFile<SlotSize, SlotCount>::~UringFile(void)
+{
+    detach();
+}
+
+template <size_t SlotSize, size_t SlotCount>
+bool UringFile<SlotSize, SlotCount>::attach(int _fd)
+{
+    detach();
+    off_t position = (_fd >= 0) ? lseek(_fd, 0, SEEK_CUR) : -1;
+    if (position >= 0) {
+        fd = _fd;
+        offset = (uint64_t)position;
+        failed = false;
+        setupRing();
+    }
+    return fd >= 0;
+}
+
+template <size_t SlotSize, size_t SlotCount>
+void UringFile<SlotSize, SlotCount>::detach(void)
+{
+    if (fd >= 0) {
+        drain();
+        releaseRing();
+        // Leave the file position after the data, as write(2) would have.
+        lseek(fd, (off_t)offset, SEEK_SET);
+        fd = -1;
+    }
+}
+
+template <size_t SlotSize, size_t SlotCount>
+void UringFile<SlotSize, SlotCount>::setCompletion(CompletionFunction _completion, void *_completionContext)
+{
+    completion = _completion;
+    completionContext = _completionContext;
+}
+
+// Data is split into slots; each slot is one write in flight.
+template <size_t SlotSize, size_t SlotCount>
+uint32_t UringFile<SlotSize, SlotCount>::write(const char *data, size_t nChars)
+{
+    size_t queued = 0;
+    if ((fd >= 0) && (ringFd < 0)) {
+        Completion done = { offset, (uint32_t)nChars, writeAt(data, nChars, offset) };
+        offset += nChars;
+        complete(done);
+        queued = nChars;
+    } else if (fd >= 0) {
+        while (queued < nChars) {
+            if (SlotCount == inFlight) {
+                ++stats.waits;
+                while (SlotCount == inFlight) {
+                    reap(true);
+                }
+            }
+            size_t index = 0;
+            while (slots[index].busy) {
+                ++index;
+            }
+            size_t chunk = ((nChars - queued) < SlotSize) ? (nChars - queued) : SlotSize;
+            memcpy(pool[index], data + queued, chunk);
+            slots[index].offset = offset;
+            slots[index].length = (uint32_t)chunk;
+            slots[index].done = 0;
+            slots[index].busy = true;
+            int32_t error = submit(index);
+            if (0 == error) {
+                ++inFlight;
+                if (inFlight > stats.maxInFlight) {
+                    stats.maxInFlight = (uint32_t)inFlight;
+                }
+            } else {
+                finish(index, error);
+            }
+            offset += chunk;
+            queued += chunk;
+        }
+        reap(false);
+    }
+    return (uint32_t)queued;
+}
+
+template <size_t SlotSize, size_t SlotCount>
+size_t UringFile<SlotSize, SlotCount>::poll(void)
+{
+    return (ringFd >= 0) ? reap(false) : 0;
+}
+
+template <size_t SlotSize, size_t SlotCount>
+bool UringFile<SlotSize, SlotCount>::drain(void)
+{
+    while (inFlight > 0) {
+        reap(true);
+    }
+    bool retval = !failed;
+    failed = false;
+    return retval;
+}
+
+template <size_t SlotSize, size_t SlotCount>
+bool UringFile<SlotSize, SlotCount>::sync(void)
+{
+    bool retval = drain();
+    return (0 == fdatasync(fd)) && retval;
+}
+
+template <size_t SlotSize, size_t SlotCount>
+void UringFile<SlotSize, SlotCount>::resetStats(void)
+{
+    stats.writes = 0;
+    stats.bytes = 0;
+    stats.errors = 0;
+    stats.waits = 0;
+    stats.maxInFlight = 0;
+}
+
+// Ring memory layout and offsets come from the kernel in io_uring_params.
+template <size_t SlotSize, size_t SlotCount>
+bool UringFile<SlotSize, SlotCount>::setupRing(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = (int)syscall(__NR_io_uring_setup, (unsigned)SlotCount, &params);
+    if (ringFd >= 0) {
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (0 != (params.features & IORING_FEAT_SINGLE_MMAP));
+        if (single) {
+            sqRingSize = cqRingSize = (sqRingSize > cqRingSize) ? sqRingSize : cqRingSize;
+        }
+        sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                IORING_OFF_SQ_RING);
+        cqRing = (single || (MAP_FAILED == sqRing)) ? sqRing :
+                mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                        IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void *sqeMap = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                IORING_OFF_SQES);
+        sqes = (MAP_FAILED != sqeMap) ? (struct io_uring_sqe *)sqeMap : NULL;
+        if ((MAP_FAILED == sqRing) || (MAP_FAILED == cqRing) || (NULL == sqes)) {
+            releaseRing();
+        } else {
+            char *sq = (char *)sqRing;
+            char *cq = (char *)cqRing;
+            sqHead = (unsigned *)(sq + params.sq_off.head);
+            sqTail = (unsigned *)(sq + params.sq_off.tail);
+            sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+            sqArray = (unsigned *)(sq + params.sq_off.array);
+            cqHead = (unsigned *)(cq + params.cq_off.head);
+            cqTail = (unsigned *)(cq + params.cq_off.tail);
+            cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+            cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+            struct iovec iov[SlotCount];
+            for (size_t i = 0; i < SlotCount; ++i) {
+                iov[i].iov_base = pool[i];
+                iov[i].iov_len = SlotSize;
+            }
+            registered = (0 == syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, iov,
+                    (unsigned)SlotCount));
+        }
+    }
+    return ringFd >= 0;
+}
+
+// Closing the ring fd also unregisters the pool.
+template <size_t SlotSize, size_t SlotCount>
+void UringFile<SlotSize, SlotCount>::releaseRing(void)
+{
+    if (NULL != sqes) {
+        munmap(sqes, sqesSize);
+        sqes = NULL;
+    }
+    if ((MAP_FAILED != cqRing) && (cqRing != sqRing)) {
+        munmap(cqRing, cqRingSize);
+    }
+    if (MAP_FAILED != sqRing) {
+        munmap(sqRing, sqRingSize);
+    }
+    sqRing = cqRing = MAP_FAILED;
+    if (ringFd >= 0) {
+        ::close(ringFd);
+        ringFd = -1;
+    }
+    registered = false;
+}
+
+// At most SlotCount writes are in flight and the ring has at least SlotCount entries, so the
+// submission queue always has room.  The queue is empty between calls:  an entry is either
+// taken by the kernel (the SQ head passes it) or taken back out here.
+template <size_t SlotSize, size_t SlotCount>
+int32_t UringFile<SlotSize, SlotCount>::submit(size_t index)
+{
+    Slot &slot = slots[index];
+    unsigned tail = *sqTail;
+    unsigned entry = tail & sqMask;
+    struct io_uring_sqe *sqe = &sqes[entry];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)(pool[index] + slot.done);
+    sqe->len = slot.length - slot.done;
+    sqe->off = slot.offset + slot.done;
+    sqe->buf_index = (uint16_t)index;
+    sqe->user_data = index;
+    sqArray[entry] = entry;
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+    int32_t retval = 0;
+    unsigned attempts = 0;
+    while (tail == __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) {
+        int error = EAGAIN;             // Entered, but the entry was not taken
+        if (syscall(__NR_io_uring_enter, ringFd, 1, 0, 0, NULL, 0) < 0) {
+            error = errno;
+        } else if (tail != __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if ((EAGAIN == error) || (EBUSY == error)) {
+            if (++attempts == SubmitAttempts) {
+                retval = -error;
+                break;
+            }
+            sched_yield();
+        } else if (EINTR != error) {
+            retval = -error;
+            break;
+        }
+    }
+    if (tail != __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) {
+        retval = 0;                     // Taken (even if the call failed):  a completion follows
+    } else {
+        // Not taken:  remove the entry, so no later io_uring_enter() sends it for a freed slot.
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+    }
+    return retval;
+}
+
+template <size_t SlotSize, size_t SlotCount>
+size_t UringFile<SlotSize, SlotCount>::reap(bool wait)
+{
+    if (wait) {
+        while ((syscall(__NR_io_uring_enter, ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+                && (EINTR == errno)) {
+        }
+    }
+    size_t count = 0;
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &cqes[head & cqMask];
+        size_t index = (size_t)cqe->user_data;
+        int32_t result = cqe->res;
+        ++head;
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+        Slot &slot = slots[index];
+        bool resubmit = (-EINTR == result) || (-EAGAIN == result);
+        if ((result > 0) && (slot.done + (uint32_t)result < slot.length)) {
+            slot.done += (uint32_t)result;
+            resubmit = true;
+        }
+        if (resubmit) {
+            result = submit(index);
+        } else if (result >= 0) {
+            result = (int32_t)(slot.done + (uint32_t)result);
+        }
+        // Finished, or the resubmission was not taken
+        if (!resubmit || (result < 0)) {
+            --inFlight;
+            ++count;
+            finish(index, result);
+        }
+    }
+    return count;
+}
+
+template <size_t SlotSize, size_t SlotCount>
+void UringFile<SlotSize, SlotCount>::finish(size_t index, int32_t result)
+{
+    Slot &slot = slots[index];
+    Completion done = { slot.offset, slot.length, result };
+    slot.busy = false;
+    complete(done);
+}
+
+template <size_t SlotSize, size_t SlotCount>
+void UringFile<SlotSize, SlotCount>::complete(const Completion &done)
+{
+    if (done.result == (int32_t)done.length) {
+        ++stats.writes;
+        stats.bytes += done.length;
+    } else {
+        ++stats.errors;
+        failed = true;
+    }
+    if (NULL != completion) {
+        completion(done, completionContext);
+    }
+}
+
+template <size_t SlotSize, size_t SlotCount>
+int32_t UringFile<SlotSize, SlotCount>::writeAt(const char *data, size_t nChars, uint64_t at)
+{
+    size_t written = 0;
+    int32_t retval = 0;
+    while (written < nChars) {
+        ssize_t n = pwrite(fd, data + written, nChars - written, (off_t)(at + written));
+        if (n > 0) {
+            written += (size_t)n;
+        } else if ((n < 0) && (EINTR == errno)) {
+            continue;
+        } else {
+            retval = (n < 0) ? -errno : -EIO;
+            break;
+        }
+    }
+    return (0 == retval) ? (int32_t)written : retval;
+}
+
+#endif //ndef URING_FILE_BACKEND_H
@@ -0,0 +1,111 @@
+/****************************************************************************
+ *   FILENAME: WriteBench.cpp
+ *   Copyright (c) 2020 EmbedHead Design; All Rights Reserved
+ *   PURPOSE: Host tool:  time BasicBufferedFileWriter::write() against the original
+ *            byte-at-a-time copy loop, for record sizes from 1 byte to 64 KiB.
+ *   DEPENDENCIES, LIMITATIONS, & DESIGN NOTES:
+ *       Usage:  WriteBench [<MiB per record size>]
+ *       Default 256 MiB per record size.  Both writers have a 4096 byte buffer and write to
+ *       NullFileBackend (counts bytes, stores nothing), so only the copy path is timed.  The
+ *       byte loop is the original BufferedFileWriter::write():  one byte per iteration,
+ *       counting and checking for a full buffer on every byte.
+ *
+ *       Builds for the host only (uses <chrono>, malloc()); not part of the target image.
+ *       Link with NumberFormat.cpp.
+ *
+ ****************************************************************************/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "BasicBufferedFileWriter.h"
+#include "MemoryFileBackend.h"
+
+// The original write loop, on the same backend.
+class ByteLoopWriter
+{
+public:
+    static const size_t BufferSize = 4096;
+
+    explicit ByteLoopWriter(NullSink *_file)
+        : file(_file), writePtr(buff), writeEndPtr(buff + BufferSize), bytesWrittenTotal(0)
+    {
+    }
+
+    uint32_t flush(void)
+    {
+        uint32_t retval = 0;
+        if (writePtr > buff) {
+            retval = NullFileBackend::write(file, buff, (size_t)(writePtr - buff));
+            writePtr = buff;
+        }
+        return retval;
+    }
+
+    uint32_t write(const char *source, size_t nChars)
+    {
+        uint32_t retval = 0;
+        while (nChars > 0) {
+            *writePtr++ = *source++;
+            --nChars;
+            ++bytesWrittenTotal;
+            if (writePtr >= writeEndPtr) {
+                retval = flush();
+            }
+        }
+        return retval;
+    }
+
+private:
+    NullSink *  file;
+    char        buff[BufferSize];
+    char *      writePtr;
+    char *      writeEndPtr;
+    size_t      bytesWrittenTotal;
+};
+
+static BasicBufferedFileWriter<4096, 2048, NullFileBackend> writer;
+
+// Write total bytes as records of recordSize from source; returns MB/s.
+template <class Writer>
+static double megabytesPerSecond(Writer &out, const char *source, size_t recordSize, size_t total)
+{
+    size_t records = total / recordSize;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records; ++i) {
+        // Vary the source position, so the copies cannot be hoisted out of the loop.
+        out.write(source + (i & 63), recordSize);
+    }
+    out.flush();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (double)(records * recordSize) / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t sizes[] = { 1, 2, 4, 8, 16, 32, 64, 256, 1024, 4096, 16384, 65536 };
+    size_t total = ((argc > 1) ? strtoul(argv[1], NULL, 0) : 256) * 1024 * 1024;
+    char *source = (char *)malloc(65536 + 64);
+    if ((NULL == source) || (0 == total)) {
+        fprintf(stderr, "usage: %s [<MiB per record size>]\n", argv[0]);
+        return 2;
+    }
+    for (size_t i = 0; i < 65536 + 64; ++i) {
+        source[i] = (char)('a' + i % 26);
+    }
+    NullSink loopSink = { 0, 0 };
+    NullSink blockSink = { 0, 0 };
+    static ByteLoopWriter loopWriter(&loopSink);
+    writer.setFile(&blockSink);
+    printf("record bytes   byte loop MB/s   write() MB/s\n");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        double loop = megabytesPerSecond(loopWriter, source, sizes[i], total);
+        double block = megabytesPerSecond(writer, source, sizes[i], total);
+        printf("%12lu %16.0f %14.0f\n", (unsigned long)sizes[i], loop, block);
+    }
+    writer.setFile(NULL);
+    free(source);
+    return (loopSink.bytes == blockSink.bytes) ? 0 : 1;
+}